@@ -0,0 +1,87 @@
+#include "AllocGate.h"
+#include <ESPAsyncWebServer.h>
+
+#ifdef ALLOC_GATE
+#include <coredecls.h>
+
+static volatile bool gateOpen = false;
+static volatile bool gatePaused = false;
+static volatile uint32_t windowAllocations = 0;
+static volatile uint32_t windowCaller = 0;
+static uint32_t gatePresses = 0;
+static uint32_t gateViolations = 0;
+static uint32_t gateAllocations = 0;
+static uint32_t gateFirstCaller = 0; //look it up with xtensa-lx106-elf-addr2line
+
+static inline void countAllocation(void* caller){
+  if (!gateOpen || gatePaused || !can_yield()) return;
+  if (!windowAllocations) windowCaller = (uint32_t)caller;
+  windowAllocations++;
+}
+
+extern "C" {
+  void* __real_malloc(size_t size);
+  void* __real_calloc(size_t count, size_t size);
+  void* __real_realloc(void* ptr, size_t size);
+
+  void* __wrap_malloc(size_t size){
+    countAllocation(__builtin_return_address(0));
+    return __real_malloc(size);
+  }
+
+  void* __wrap_calloc(size_t count, size_t size){
+    countAllocation(__builtin_return_address(0));
+    return __real_calloc(count, size);
+  }
+
+  void* __wrap_realloc(void* ptr, size_t size){
+    countAllocation(__builtin_return_address(0));
+    return __real_realloc(ptr, size);
+  }
+}
+#endif
+
+void AllocGateOpen(){
+#ifdef ALLOC_GATE
+  windowAllocations = 0;
+  gatePaused = false;
+  gateOpen = true;
+#endif
+}
+
+void AllocGateClose(){
+#ifdef ALLOC_GATE
+  if (!gateOpen) return;
+  gateOpen = false;
+  gatePresses++;
+  if (!windowAllocations) return;
+  if (!gateViolations) gateFirstCaller = windowCaller;
+  gateViolations++;
+  gateAllocations += windowAllocations;
+#endif
+}
+
+void AllocGatePause(){
+#ifdef ALLOC_GATE
+  gatePaused = true;
+#endif
+}
+
+void AllocGateResume(){
+#ifdef ALLOC_GATE
+  gatePaused = false;
+#endif
+}
+
+void SetupAllocGate(AsyncWebServer* server){
+#ifdef ALLOC_GATE
+  server->on("/allocgate", HTTP_GET, [](AsyncWebServerRequest* request){
+    char json[112];
+    snprintf(json, sizeof(json), "{\"presses\":%u,\"violations\":%u,\"allocations\":%u,\"first_caller\":\"0x%08x\"}",
+      gatePresses, gateViolations, gateAllocations, gateFirstCaller);
+    request->send(200, "application/json", json);
+  });
+#else
+  (void)server;
+#endif
+}
@@ -0,0 +1,25 @@
+#ifndef ALLOCGATE_H_
+#define ALLOCGATE_H_
+
+#include <Arduino.h>
+
+//Counts heap allocations made by loop() between a key event and the first audible sample.
+//The path from key to sound must not touch the heap, a long running phone would slowly
+//fragment its ~40kB otherwise.
+//
+//Only active in the d1_mini_allocgate environment (-DALLOC_GATE, malloc/calloc/realloc
+//wrapped by the linker). Allocations from the network stack do not run in loop() context
+//and are not counted.
+//  GET /allocgate   {"presses":12,"violations":0,"allocations":0,"first_caller":"0x00000000"}
+//tools/key_driver.py --alloc-gate fails the run when violations is not 0.
+
+void AllocGateOpen();   //key event, starts a new window
+void AllocGateClose();  //first audible sample, a window with allocations is a violation
+//for a call that has to allocate on every press, see PhoneFileSource::open
+void AllocGatePause();
+void AllocGateResume();
+
+class AsyncWebServer;
+void SetupAllocGate(AsyncWebServer* server);
+
+#endif
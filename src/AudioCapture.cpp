@@ -0,0 +1,227 @@
+#include "AudioCapture.h"
+#include <SD.h>
+#include <ESPAsyncWebServer.h>
+#include "Metrics.h"
+#include "PhoneAudio.h"
+
+#ifdef AUDIO_CAPTURE
+#define FNV_OFFSET 2166136261u
+#define FNV_PRIME 16777619u
+
+struct CaptureSession{
+  char name[AUDIO_CAPTURE_NAME_MAX];
+  volatile bool active;
+  uint32_t frames; //all samples of the session
+  uint16_t samplesStarted;
+  //the fingerprint is of the last sample started: what played before it was cut off by the
+  //next key at a point that depends on timing
+  uint32_t hash;
+  uint32_t sampleFrames;
+  uint32_t startMicros;
+  uint32_t endMicros;
+  uint32_t decodeMicros;
+  uint32_t underrunsAtStart;
+  //timing of the current sample, restarted by AudioCaptureBegin() and rate changes
+  uint32_t rate;
+  uint32_t segmentFrames;
+  uint32_t segmentStartMicros;
+  uint64_t frameMicrosQ16; //play time of one frame, 16 fraction bits
+  uint64_t playMicrosQ16; //play time of the last frame since the segment started
+  bool leadValid;
+  int32_t leadMin;
+  int32_t leadMax;
+  //envelope
+  uint64_t blockSquares;
+  uint16_t blockFrames;
+  uint16_t envelope[AUDIO_CAPTURE_ENVELOPE];
+  uint16_t envelopeLength;
+  //optional wav copy
+  File wav;
+  uint8_t wavBuffer[512];
+  uint16_t wavLength;
+  uint32_t wavBytes;
+};
+
+static CaptureSession capture;
+
+static void closeEnvelopeBlock(){
+  if (!capture.blockFrames) return;
+  if (capture.envelopeLength < AUDIO_CAPTURE_ENVELOPE){
+    capture.envelope[capture.envelopeLength++] = sqrt((double)capture.blockSquares / capture.blockFrames);
+  }
+  capture.blockSquares = 0;
+  capture.blockFrames = 0;
+}
+
+static void writeWavHeader(){
+  uint8_t header[44];
+  uint32_t rate = capture.rate ? capture.rate : 44100;
+  memcpy(header, "RIFF", 4);
+  uint32_t riffSize = 36 + capture.wavBytes;
+  memcpy(header + 4, &riffSize, 4);
+  memcpy(header + 8, "WAVEfmt ", 8);
+  uint32_t fmtSize = 16;
+  uint16_t format = 1, channels = 2, blockAlign = 4, bits = 16;
+  uint32_t byteRate = rate * 4;
+  memcpy(header + 16, &fmtSize, 4);
+  memcpy(header + 20, &format, 2);
+  memcpy(header + 22, &channels, 2);
+  memcpy(header + 24, &rate, 4);
+  memcpy(header + 28, &byteRate, 4);
+  memcpy(header + 32, &blockAlign, 2);
+  memcpy(header + 34, &bits, 2);
+  memcpy(header + 36, "data", 4);
+  memcpy(header + 40, &capture.wavBytes, 4);
+  capture.wav.seek(0);
+  capture.wav.write(header, sizeof(header));
+}
+#endif
+
+void AudioCaptureSample(const int16_t sample[2], uint32_t rate){
+#ifdef AUDIO_CAPTURE
+  if (!capture.active) return;
+  uint32_t now = micros();
+  //the same bytes as the frame in a 16 bit stereo wav
+  uint8_t bytes[4] = {(uint8_t)sample[0], (uint8_t)(sample[0] >> 8), (uint8_t)sample[1], (uint8_t)(sample[1] >> 8)};
+  uint32_t hash = capture.hash;
+  for (uint8_t i = 0; i < 4; i++) hash = (hash ^ bytes[i]) * FNV_PRIME;
+  capture.hash = hash;
+  capture.sampleFrames++;
+  capture.frames++;
+
+  if (rate != capture.rate && rate){
+    capture.rate = rate;
+    capture.segmentFrames = 0;
+    capture.segmentStartMicros = now;
+    capture.frameMicrosQ16 = ((uint64_t)1000000 << 16) / rate;
+    capture.playMicrosQ16 = 0;
+  }
+  else if (capture.rate){
+    capture.playMicrosQ16 += capture.frameMicrosQ16;
+    //the first DMA buffers fill as fast as the decoder can go, the lead only counts after that
+    if (++capture.segmentFrames >= PHONEAUDIO_DMA_SAMPLES){
+      int32_t lead = (int32_t)(capture.playMicrosQ16 >> 16) - (int32_t)(now - capture.segmentStartMicros);
+      if (!capture.leadValid || lead < capture.leadMin) capture.leadMin = lead;
+      if (!capture.leadValid || lead > capture.leadMax) capture.leadMax = lead;
+      capture.leadValid = true;
+    }
+  }
+
+  int32_t mono = ((int32_t)sample[0] + sample[1]) / 2;
+  capture.blockSquares += (uint32_t)(mono * mono);
+  if (++capture.blockFrames == AUDIO_CAPTURE_BLOCK_FRAMES) closeEnvelopeBlock();
+
+  if (capture.wav){
+    memcpy(capture.wavBuffer + capture.wavLength, bytes, 4);
+    capture.wavLength += 4;
+    if (capture.wavLength == sizeof(capture.wavBuffer)){
+      capture.wavBytes += capture.wav.write(capture.wavBuffer, capture.wavLength);
+      capture.wavLength = 0;
+    }
+  }
+#else
+  (void)sample;
+  (void)rate;
+#endif
+}
+
+void AudioCaptureBegin(){
+#ifdef AUDIO_CAPTURE
+  capture.rate = 0;
+  if (!capture.active) return;
+  capture.samplesStarted++;
+  capture.hash = FNV_OFFSET;
+  capture.sampleFrames = 0;
+  capture.blockSquares = 0;
+  capture.blockFrames = 0;
+  capture.envelopeLength = 0;
+#endif
+}
+
+void AudioCaptureDecodeMicros(uint32_t micros){
+#ifdef AUDIO_CAPTURE
+  if (capture.active) capture.decodeMicros += micros;
+#else
+  (void)micros;
+#endif
+}
+
+void SetupAudioCapture(AsyncWebServer* server){
+#ifdef AUDIO_CAPTURE
+  server->on("/capture/stop", HTTP_POST, [](AsyncWebServerRequest* request){
+    if (!capture.active){
+      request->send(409, "text/plain", "no capture running");
+      return;
+    }
+    capture.active = false;
+    capture.endMicros = micros();
+    closeEnvelopeBlock();
+    if (capture.wav){
+      capture.wavBytes += capture.wav.write(capture.wavBuffer, capture.wavLength);
+      writeWavHeader();
+      capture.wav.close();
+    }
+    uint32_t elapsed = capture.endMicros - capture.startMicros;
+    AsyncResponseStream* response = request->beginResponseStream("application/json");
+    response->printf_P(PSTR("{\"session\":\"%s\",\"frames\":%u,\"samples_started\":%u,\"hash\":\"%08x\",\"sample_frames\":%u,\"rate\":%u,\"elapsed_ms\":%u,\"decode_ms\":%u,\"cpu_percent\":%u,"),
+      capture.name, capture.frames, capture.samplesStarted, capture.hash, capture.sampleFrames, capture.rate, elapsed / 1000, capture.decodeMicros / 1000,
+      elapsed ? (uint32_t)((uint64_t)capture.decodeMicros * 100 / elapsed) : 0);
+    response->printf_P(PSTR("\"lead_min_us\":%d,\"lead_max_us\":%d,\"underruns\":%u,\"envelope_frames\":%u,\"envelope\":["),
+      capture.leadMin, capture.leadMax, metricCounters[MET_AUDIO_UNDERRUNS] - capture.underrunsAtStart, AUDIO_CAPTURE_BLOCK_FRAMES);
+    for (uint16_t i = 0; i < capture.envelopeLength; i++) response->printf_P(i ? PSTR(",%u") : PSTR("%u"), capture.envelope[i]);
+    response->print("]}");
+    request->send(response);
+  });
+  server->on("/capture.wav", HTTP_GET, [](AsyncWebServerRequest* request){
+    if (capture.active || !SD.exists(AUDIO_CAPTURE_WAV_PATH)){
+      request->send(404, "text/plain", "no finished wav capture");
+      return;
+    }
+    request->send(SDFS, AUDIO_CAPTURE_WAV_PATH, "audio/wav");
+  });
+  server->on("/capture", HTTP_GET, [](AsyncWebServerRequest* request){
+    char json[64];
+    snprintf(json, sizeof(json), "{\"active\":%s,\"frames\":%u}", capture.active ? "true" : "false", capture.frames);
+    request->send(200, "application/json", json);
+  });
+  server->on("/capture", HTTP_POST, [](AsyncWebServerRequest* request){
+    if (capture.active){
+      request->send(409, "text/plain", "capture already running");
+      return;
+    }
+    if (!request->hasParam("session")){
+      request->send(400, "text/plain", "session parameter needed");
+      return;
+    }
+    strlcpy(capture.name, request->getParam("session")->value().c_str(), sizeof(capture.name));
+    capture.frames = 0;
+    capture.samplesStarted = 0;
+    capture.hash = FNV_OFFSET;
+    capture.sampleFrames = 0;
+    capture.decodeMicros = 0;
+    capture.rate = 0;
+    capture.leadValid = false;
+    capture.leadMin = 0;
+    capture.leadMax = 0;
+    capture.blockSquares = 0;
+    capture.blockFrames = 0;
+    capture.envelopeLength = 0;
+    capture.wavLength = 0;
+    capture.wavBytes = 0;
+    if (request->hasParam("wav") && request->getParam("wav")->value() == "1"){
+      if (SD.exists(AUDIO_CAPTURE_WAV_PATH)) SD.remove(AUDIO_CAPTURE_WAV_PATH);
+      //not FILE_WRITE, in append mode the header could not be patched at offset 0
+      capture.wav = SDFS.open(AUDIO_CAPTURE_WAV_PATH, "w+");
+      //room for the header, written when the session stops
+      uint8_t header[44] = {0};
+      if (capture.wav) capture.wav.write(header, sizeof(header));
+    }
+    capture.underrunsAtStart = metricCounters[MET_AUDIO_UNDERRUNS];
+    capture.startMicros = micros();
+    capture.active = true;
+    request->send(200, "text/plain", "capturing");
+  });
+#else
+  (void)server;
+#endif
+}
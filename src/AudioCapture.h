@@ -0,0 +1,38 @@
+#ifndef AUDIOCAPTURE_H_
+#define AUDIOCAPTURE_H_
+
+#include <Arduino.h>
+
+//Golden-audio capture: fingerprints every sample the decoders hand to the I2S output, so a
+//decoder, buffering or DSP change can be checked against known good output without
+//listening to it. Only in the d1_mini_capture environment (-DAUDIO_CAPTURE).
+//
+//  POST /capture?session=dial_770[&wav=1]   starts a session, wav=1 also writes /capture.wav
+//  GET /capture                             {"active":true,"frames":123456}
+//  POST /capture/stop                       ends it and answers with the fingerprint of the
+//                                           last sample the session started (the ones before
+//                                           it were cut off by a key at a timing dependent point):
+//    hash, sample_frames  fnv-1a over its frames as 16 bit stereo wav bytes
+//    envelope             its rms per AUDIO_CAPTURE_BLOCK_FRAMES frames, for tolerant compares
+//  and with the timing of the whole session:
+//    decode_ms            time spent in decoder->loop(), cpu_percent of the session
+//    lead_min/max_us      how far ahead of its play time each frame was delivered once the DMA
+//                         buffers filled; the spread is the delivery jitter, near 0 an underrun
+//    underruns
+//  GET /capture.wav                         all samples of the last wav=1 session
+//tools/golden_audio.py runs scripted dial sessions and compares them with golden_audio.json.
+//The capture itself costs a few cycles per frame, wav=1 a sector write every 128 frames.
+#define AUDIO_CAPTURE_BLOCK_FRAMES 4096 //~93ms at 44.1kHz
+#define AUDIO_CAPTURE_ENVELOPE 512
+#define AUDIO_CAPTURE_NAME_MAX 32
+#define AUDIO_CAPTURE_WAV_PATH "/capture.wav"
+
+//per frame, so the caller only calls it in capture builds
+void AudioCaptureSample(const int16_t sample[2], uint32_t rate);
+void AudioCaptureBegin(); //the output starts a new sample, its timing starts over
+void AudioCaptureDecodeMicros(uint32_t micros);
+
+class AsyncWebServer;
+void SetupAudioCapture(AsyncWebServer* server);
+
+#endif
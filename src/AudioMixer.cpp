@@ -0,0 +1,327 @@
+#include "AudioMixer.h"
+
+#define VOICE_MASK (MIXER_VOICE_FRAMES - 1)
+
+//both 16 bit halves of a and b added at once, each clipped to int16 on its own
+static inline uint32_t addSaturate16x2(uint32_t a, uint32_t b){
+  //add the low 15 bits of both halves without a carry between them, then fix the top bits
+  uint32_t sum = ((a & 0x7FFF7FFF) + (b & 0x7FFF7FFF)) ^ ((a ^ b) & 0x80008000);
+  //a half overflowed when a and b have the same sign and the sum has the other one
+  uint32_t overflow = ~(a ^ b) & (a ^ sum) & 0x80008000;
+  if (!overflow) return sum;
+  uint32_t mask = (overflow >> 15) * 0xFFFF;
+  uint32_t limit = 0x7FFF7FFF + ((a >> 15) & 0x00010001); //0x7FFF or 0x8000 by the sign of a
+  return (sum & ~mask) | (limit & mask);
+}
+
+static inline uint32_t scale16x2(uint32_t frame, uint16_t gain){
+  int32_t left = ((int16_t)frame * gain) >> 8;
+  int32_t right = ((int16_t)(frame >> 16) * gain) >> 8;
+  return (uint16_t)left | ((uint32_t)right << 16);
+}
+
+//the gain checks are out of the loops, unity gain is a plain copy or add
+static void mixVoice(uint32_t* mix, const uint32_t* in, uint16_t gain, bool first){
+  if (first){
+    if (gain == MIXER_GAIN_UNITY) memcpy(mix, in, MIXER_BLOCK_FRAMES * sizeof(uint32_t));
+    else for (uint16_t i = 0; i < MIXER_BLOCK_FRAMES; i++) mix[i] = scale16x2(in[i], gain);
+  }
+  else {
+    if (gain == MIXER_GAIN_UNITY) for (uint16_t i = 0; i < MIXER_BLOCK_FRAMES; i++) mix[i] = addSaturate16x2(mix[i], in[i]);
+    else for (uint16_t i = 0; i < MIXER_BLOCK_FRAMES; i++) mix[i] = addSaturate16x2(mix[i], scale16x2(in[i], gain));
+  }
+}
+
+#ifdef MIXER_BENCH
+static uint32_t benchRandom(){
+  static uint32_t state = 2463534242u; //xorshift32
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return state;
+}
+
+static uint32_t addSaturateReference(uint32_t a, uint32_t b){
+  int32_t left = constrain((int32_t)(int16_t)a + (int16_t)b, -32768, 32767);
+  int32_t right = constrain((int32_t)(int16_t)(a >> 16) + (int16_t)(b >> 16), -32768, 32767);
+  return (uint16_t)left | ((uint32_t)(uint16_t)right << 16);
+}
+
+static uint32_t benchMix(uint32_t* mix, const uint32_t* in, const uint32_t* other, uint16_t gain, bool first){
+  uint32_t total = 0;
+  for (uint16_t i = 0; i < MIXER_BENCH_BLOCKS; i++){
+    memcpy(mix, other, MIXER_BLOCK_FRAMES * sizeof(uint32_t)); //what the voices before it left
+    uint32_t start = ESP.getCycleCount();
+    mixVoice(mix, in, gain, first);
+    total += ESP.getCycleCount() - start;
+  }
+  return total / MIXER_BENCH_BLOCKS;
+}
+
+void AudioMixerBench(Print& out){
+  static const uint16_t edges[] = {0x0000, 0x0001, 0x3FFF, 0x4000, 0x7FFE, 0x7FFF, 0x8000, 0x8001, 0xC000, 0xFFFF};
+  const uint8_t count = sizeof(edges) / sizeof(edges[0]);
+  uint32_t checked = 0, wrong = 0;
+  for (uint32_t i = 0; i < (uint32_t)count * count * count * count; i++){
+    uint32_t a = edges[i % count] | (uint32_t)edges[i / count % count] << 16;
+    uint32_t b = edges[i / count / count % count] | (uint32_t)edges[i / count / count / count] << 16;
+    if (addSaturate16x2(a, b) != addSaturateReference(a, b) && wrong++ == 0) out.printf_P(PSTR("first wrong: %08x + %08x\n"), a, b);
+    checked++;
+  }
+  for (uint32_t i = 0; i < MIXER_BENCH_PAIRS; i++){
+    uint32_t a = benchRandom(), b = benchRandom();
+    if (addSaturate16x2(a, b) != addSaturateReference(a, b) && wrong++ == 0) out.printf_P(PSTR("first wrong: %08x + %08x\n"), a, b);
+    checked++;
+    if ((i & 0xFFFF) == 0) yield();
+  }
+  out.printf_P(PSTR("addSaturate16x2: %u pairs, %u wrong\n"), checked, wrong);
+
+  //full scale random frames: a quarter of the unity gain adds clip, far more than real audio
+  static uint32_t in[MIXER_BLOCK_FRAMES], other[MIXER_BLOCK_FRAMES], mix[MIXER_BLOCK_FRAMES];
+  for (uint16_t i = 0; i < MIXER_BLOCK_FRAMES; i++){
+    in[i] = benchRandom();
+    other[i] = benchRandom();
+  }
+  out.printf_P(PSTR("cycles per voice per block of %u frames:\n"), MIXER_BLOCK_FRAMES);
+  out.printf_P(PSTR("  first voice, unity gain    %u\n"), benchMix(mix, in, other, MIXER_GAIN_UNITY, true));
+  out.printf_P(PSTR("  first voice, gain 0.5      %u\n"), benchMix(mix, in, other, MIXER_GAIN_UNITY / 2, true));
+  out.printf_P(PSTR("  further voice, unity gain  %u\n"), benchMix(mix, in, other, MIXER_GAIN_UNITY, false));
+  out.printf_P(PSTR("  further voice, gain 0.5    %u\n"), benchMix(mix, in, other, MIXER_GAIN_UNITY / 2, false));
+}
+#endif
+
+bool MixerVoice::SetRate(int hz)
+{
+  hertz = hz;
+  _mixer->_voiceRate(this, hz);
+  return true;
+}
+
+bool MixerVoice::SetGain(float f)
+{
+  _gain = constrain((int)(f * MIXER_GAIN_UNITY), 0, MIXER_GAIN_UNITY);
+  return true;
+}
+
+bool MixerVoice::begin()
+{
+  //what is left of a previous sample is dropped, the new one starts right away
+  _head = _tail = _count = 0;
+  _phase = 0;
+  _framesIn = _framesMixed = 0;
+  _soundPending = false;
+  _state = VOICE_RUNNING;
+  _mixer->_voiceStarted(this);
+  return true;
+}
+
+bool MixerVoice::ConsumeSample(int16_t sample[2])
+{
+  if (_state != VOICE_RUNNING) return false;
+  int16_t frame[2] = {sample[LEFTCHANNEL], sample[RIGHTCHANNEL]};
+  MakeSampleStereo16(frame);
+  //the frames this input frame covers at the rate of the mixer
+  uint32_t frames = 1;
+  if (_step != 0x10000) frames = _phase < 0x10000 ? (0x10000 - _phase + _step - 1) / _step : 0;
+  if (MIXER_VOICE_FRAMES - _count < frames){
+    _mixer->pump();
+    if (MIXER_VOICE_FRAMES - _count < frames) return false;
+  }
+  uint32_t packed = (uint16_t)frame[LEFTCHANNEL] | ((uint32_t)(uint16_t)frame[RIGHTCHANNEL] << 16);
+  for (uint32_t i = 0; i < frames; i++){
+    _frames[_head] = packed;
+    _head = (_head + 1) & VOICE_MASK;
+  }
+  if (_watching && packed && frames) _found(_framesIn);
+  _count += frames;
+  _framesIn += frames;
+  _phase = _phase + frames * _step - 0x10000;
+  return true;
+}
+
+uint16_t MixerVoice::ConsumeSamples(int16_t *samples, uint16_t count)
+{
+#ifdef AUDIO_PER_SAMPLE
+  //frame by frame as before the block path, the whole chain is compared, see PhoneAudio.h
+  return AudioOutput::ConsumeSamples(samples, count);
+#else
+  if (_step != 0x10000 || bps != 16 || channels != 2) return AudioOutput::ConsumeSamples(samples, count);
+  if (_state != VOICE_RUNNING) return 0;
+  if (MIXER_VOICE_FRAMES - _count < count) _mixer->pump();
+  //a 16 bit stereo frame is a packed word already
+  uint16_t frames = min((uint16_t)(MIXER_VOICE_FRAMES - _count), count);
+  uint16_t first = min(frames, (uint16_t)(MIXER_VOICE_FRAMES - _head));
+  memcpy(_frames + _head, samples, first * sizeof(uint32_t));
+  memcpy(_frames, samples + 2 * first, (frames - first) * sizeof(uint32_t));
+  for (uint16_t i = 0; i < frames && _watching; i++){
+    if (samples[2 * i] || samples[2 * i + 1]) _found(_framesIn + i);
+  }
+  _head = (_head + frames) & VOICE_MASK;
+  _count += frames;
+  _framesIn += frames;
+  return frames;
+#endif
+}
+
+void MixerVoice::_found(uint32_t frame)
+{
+  _watching = false;
+  _soundPending = true;
+  _soundFrame = frame;
+}
+
+bool MixerVoice::stop()
+{
+  if (_state == VOICE_RUNNING) _state = _count ? VOICE_DRAINING : VOICE_IDLE;
+  _mixer->pump();
+  return true;
+}
+
+bool MixerVoice::loop()
+{
+  _mixer->pump();
+  return true;
+}
+
+bool MixerVoice::isPlaying()
+{
+  return _state != VOICE_IDLE;
+}
+
+uint32_t MixerVoice::framesSinceBegin()
+{
+  return _framesIn;
+}
+
+AudioMixer::AudioMixer(AudioOutput* output) : _output(output)
+{
+  memset(&_stats, 0, sizeof(_stats));
+  for (uint8_t i = 0; i < MIXER_VOICES; i++){
+    _voices[i]._mixer = this;
+    _voices[i].SetBitsPerSample(16);
+    _voices[i].SetChannels(2);
+    _voices[i].SetGain(1.0);
+  }
+}
+
+MixerVoice* AudioMixer::getVoice(uint8_t index)
+{
+  return index < MIXER_VOICES ? &_voices[index] : NULL;
+}
+
+bool AudioMixer::isPlaying()
+{
+  if (_outPos < _outLen) return true;
+  for (uint8_t i = 0; i < MIXER_VOICES; i++){
+    if (_voices[i]._state != MixerVoice::VOICE_IDLE) return true;
+  }
+  return false;
+}
+
+const MixerStats* AudioMixer::getStats()
+{
+  return &_stats;
+}
+
+void AudioMixer::setSoundCallback(void (*callback)(uint16_t framesAfter))
+{
+  _soundCallback = callback;
+}
+
+void AudioMixer::_voiceStarted(MixerVoice* voice)
+{
+  if (voice == &_voices[0]){
+    //a frame of the previous sample still on its way out is not the sound of this one
+    voice->_watching = _soundCallback != NULL;
+    _soundAt = MIXER_NO_SOUND;
+  }
+  _updateStep(voice);
+  if (_outputRunning) return;
+  if (_rate) _output->SetRate(_rate);
+  _output->SetBitsPerSample(16);
+  _output->SetChannels(2);
+  _outputRunning = _output->begin();
+}
+
+void AudioMixer::_voiceRate(MixerVoice* voice, int hz)
+{
+  //voice 0 sets the rate, another voice only while it plays alone
+  bool primary = true;
+  for (uint8_t i = 0; i < MIXER_VOICES && voice != &_voices[0]; i++){
+    if (&_voices[i] != voice && _voices[i]._state != MixerVoice::VOICE_IDLE) primary = false;
+  }
+  if (!primary || hz == _rate){
+    _updateStep(voice);
+    return;
+  }
+  _rate = hz;
+  if (_outputRunning) _output->SetRate(hz);
+  for (uint8_t i = 0; i < MIXER_VOICES; i++) _updateStep(&_voices[i]);
+}
+
+void AudioMixer::_updateStep(MixerVoice* voice)
+{
+  voice->_step = voice->hertz && _rate ? ((uint32_t)voice->hertz << 16) / _rate : 0x10000;
+}
+
+bool AudioMixer::_mixBlock()
+{
+  bool any = false;
+  for (uint8_t i = 0; i < MIXER_VOICES; i++){
+    MixerVoice& voice = _voices[i];
+    //a playing voice that has no block yet holds up the others
+    if (voice._state == MixerVoice::VOICE_RUNNING && voice._count < MIXER_BLOCK_FRAMES) return false;
+    any |= voice._state != MixerVoice::VOICE_IDLE;
+  }
+  if (!any) return false;
+
+  uint32_t start = ESP.getCycleCount();
+  uint8_t mixed = 0;
+  for (uint8_t i = 0; i < MIXER_VOICES; i++){
+    MixerVoice& voice = _voices[i];
+    if (voice._state == MixerVoice::VOICE_IDLE) continue;
+    //the end of a stopped voice
+    for (uint16_t f = voice._count; f < MIXER_BLOCK_FRAMES; f++) voice._frames[(voice._tail + f) & VOICE_MASK] = 0;
+    if (voice._count < MIXER_BLOCK_FRAMES) voice._count = MIXER_BLOCK_FRAMES;
+    mixVoice(_mix, voice._frames + voice._tail, voice._gain, mixed == 0);
+    if (voice._soundPending && voice._soundFrame < voice._framesMixed + MIXER_BLOCK_FRAMES){
+      voice._soundPending = false;
+      _soundAt = voice._soundFrame - voice._framesMixed;
+    }
+    voice._framesMixed += MIXER_BLOCK_FRAMES;
+    voice._tail = (voice._tail + MIXER_BLOCK_FRAMES) & VOICE_MASK;
+    voice._count -= MIXER_BLOCK_FRAMES;
+    if (voice._state == MixerVoice::VOICE_DRAINING && !voice._count) voice._state = MixerVoice::VOICE_IDLE;
+    mixed++;
+  }
+  uint32_t cycles = ESP.getCycleCount() - start;
+  _stats.blocks++;
+  _stats.voiceBlocks += mixed;
+  _stats.mixCycles += cycles;
+  if (cycles > _stats.worstBlockCycles) _stats.worstBlockCycles = cycles;
+  _outPos = 0;
+  _outLen = MIXER_BLOCK_FRAMES;
+  return true;
+}
+
+void AudioMixer::pump()
+{
+  while (true){
+    if (_outPos < _outLen){
+      uint16_t from = _outPos;
+      _outPos += _output->ConsumeSamples((int16_t*)(_mix + _outPos), _outLen - _outPos);
+      if (_soundAt >= from && _soundAt < _outPos){
+        uint16_t framesAfter = _outPos - _soundAt - 1;
+        _soundAt = MIXER_NO_SOUND;
+        _soundCallback(framesAfter);
+      }
+      if (_outPos < _outLen) return;
+    }
+    if (!_mixBlock()) break;
+  }
+  //keeps the I2S driver running on silence, see PhoneAudioOutput::stop()
+  if (_outputRunning && !isPlaying()){
+    _outputRunning = false;
+    _output->stop();
+  }
+}
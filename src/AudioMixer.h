@@ -0,0 +1,111 @@
+#ifndef AUDIOMIXER_H_
+#define AUDIOMIXER_H_
+
+#include <Arduino.h>
+#include "AudioOutput.h"
+
+//Mixes up to MIXER_VOICES generators into one output, e.g. a key click over a sample.
+//Every generator gets a MixerVoice as its AudioOutput. The voices buffer their frames packed
+//as one 32 bit word (left in the low half), and the mixer adds a block of every voice at
+//a time with a saturating add of both 16 bit halves at once, no unpacking per sample.
+//The gain of a voice is Q8 and at most unity, so only the adds can clip.
+//
+//The output runs at the rate of voice 0 (or of the only voice playing), the other voices
+//are resampled to it by repeating or skipping frames, good enough for clicks and tones.
+//A block is mixed once every playing voice has one, a stopped voice is padded with silence.
+//
+//The first non-silent frame of every sample on voice 0 is followed through the mix, and the
+//sound callback reports it once the output took it. Key-to-audio latency is measured on it,
+//a click on another voice that reaches the output first does not end the measurement.
+#define MIXER_VOICES 2
+#define MIXER_BLOCK_FRAMES 64 //1.5ms at 44.1kHz
+#define MIXER_VOICE_FRAMES (2 * MIXER_BLOCK_FRAMES) //power of 2, blocks never wrap
+#define MIXER_GAIN_UNITY 256
+#define MIXER_NO_SOUND 0xFFFF
+
+class AudioMixer;
+
+class MixerVoice : public AudioOutput
+{
+public:
+  virtual bool SetRate(int hz) override;
+  virtual bool SetGain(float f) override;
+  virtual bool begin() override;
+  virtual bool ConsumeSample(int16_t sample[2]) override;
+  //16 bit stereo at the rate of the mixer is copied as is, anything else frame by frame
+  virtual uint16_t ConsumeSamples(int16_t *samples, uint16_t count) override;
+  virtual bool stop() override;
+  virtual bool loop() override;
+  bool isPlaying();
+  //frames the generator handed over since begin(), for where a decoder is in its file
+  uint32_t framesSinceBegin();
+
+protected:
+  friend class AudioMixer;
+  void _found(uint32_t frame);
+  enum VoiceState{ VOICE_IDLE = 0, VOICE_RUNNING, VOICE_DRAINING };
+
+  AudioMixer* _mixer = NULL;
+  VoiceState _state = VOICE_IDLE;
+  bool _watching = false; //looking for the first non-silent frame since begin()
+  bool _soundPending = false; //found, not mixed yet
+  uint32_t _soundFrame = 0; //its frame number since begin()
+  uint32_t _framesIn = 0; //frames buffered since begin()
+  uint32_t _framesMixed = 0;
+  uint16_t _gain = MIXER_GAIN_UNITY;
+  uint32_t _step = 0x10000; //Q16 input frames per output frame
+  uint32_t _phase = 0;
+  uint16_t _head = 0; //next frame written
+  uint16_t _tail = 0; //first frame of the next block mixed, always block aligned
+  uint16_t _count = 0;
+  uint32_t _frames[MIXER_VOICE_FRAMES];
+};
+
+struct MixerStats{
+  uint32_t blocks;
+  uint32_t voiceBlocks; //sum of the voices in every block
+  uint64_t mixCycles; //cpu cycles of the mixing only, not of the output
+  uint32_t worstBlockCycles;
+  uint32_t starved; //passes the output wanted a block but a playing voice had none
+};
+
+class AudioMixer
+{
+public:
+  AudioMixer(AudioOutput* output);
+  MixerVoice* getVoice(uint8_t index);
+  //mixes and hands blocks to the output while it takes them, also done from the voices
+  void pump();
+  bool isPlaying();
+  const MixerStats* getStats();
+  //called when the output took the first non-silent frame of a sample on voice 0, with the
+  //number of frames it took after that one in the same call
+  void setSoundCallback(void (*callback)(uint16_t framesAfter));
+
+protected:
+  friend class MixerVoice;
+  void _voiceStarted(MixerVoice* voice);
+  void _voiceRate(MixerVoice* voice, int hz);
+  void _updateStep(MixerVoice* voice);
+  bool _mixBlock();
+
+  AudioOutput* _output;
+  bool _outputRunning = false;
+  uint16_t _rate = 0;
+  uint16_t _outPos = 0;
+  uint16_t _outLen = 0;
+  uint16_t _soundAt = MIXER_NO_SOUND; //frame of _mix the callback waits for
+  void (*_soundCallback)(uint16_t framesAfter) = NULL;
+  uint32_t _mix[MIXER_BLOCK_FRAMES];
+  MixerVoice _voices[MIXER_VOICES];
+  MixerStats _stats;
+};
+
+//-DMIXER_BENCH: checks the saturating add against plain int32 arithmetic on the edge cases and
+//MIXER_BENCH_PAIRS random pairs, then times mixing a block of random frames for the first voice
+//(copy or scale) and for every further voice (saturating add), both at unity and lower gain.
+#define MIXER_BENCH_PAIRS 1000000
+#define MIXER_BENCH_BLOCKS 1000
+void AudioMixerBench(Print& out);
+
+#endif
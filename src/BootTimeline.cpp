@@ -0,0 +1,34 @@
+#include "BootTimeline.h"
+
+static BootPhase phases[BOOT_TIMELINE_MAX_PHASES];
+static uint8_t phaseCount = 0;
+
+void BootMark(const char* phase){
+  if (phaseCount >= BOOT_TIMELINE_MAX_PHASES) return;
+  phases[phaseCount].cycles = ESP.getCycleCount();
+  phases[phaseCount].micros = micros();
+  phases[phaseCount].name = phase;
+  phaseCount++;
+}
+
+uint32_t BootMillis(){
+  return phaseCount ? phases[phaseCount - 1].micros / 1000 : 0;
+}
+
+void BootTimelinePrint(Print& out){
+  out.println(F("Boot timeline (phase, ms since power-on, duration ms, cycles):"));
+  //the cycle counter starts with the cpu, so the first phase also counts from power-on
+  uint32_t previousCycles = 0;
+  uint32_t previousMicros = 0;
+  uint32_t cyclesPerMicro = ESP.getCpuFreqMHz();
+  for (uint8_t i = 0; i < phaseCount; i++){
+    uint32_t cycles = phases[i].cycles - previousCycles;
+    //long phases (key holds, updates) can outrun the cycle counter, fall back to micros
+    uint32_t duration = phases[i].micros - previousMicros;
+    if (duration < 0xFFFFFFFFUL / cyclesPerMicro) duration = cycles / cyclesPerMicro;
+    out.printf("  %-10s %6u.%03u %6u.%03u %10u\n", phases[i].name,
+      phases[i].micros / 1000, phases[i].micros % 1000, duration / 1000, duration % 1000, cycles);
+    previousCycles = phases[i].cycles;
+    previousMicros = phases[i].micros;
+  }
+}
@@ -0,0 +1,21 @@
+#ifndef BOOTTIMELINE_H_
+#define BOOTTIMELINE_H_
+
+#include <Arduino.h>
+
+//Records how long every step of setup() takes, so we can see where the time between
+//power-on and the first dial tone goes. Timestamps are cpu cycles (80MHz: 12.5ns/cycle),
+//the counter wraps after ~53s which is far beyond any boot.
+#define BOOT_TIMELINE_MAX_PHASES 12
+
+struct BootPhase{
+  const char* name;
+  uint32_t cycles; //ESP.getCycleCount() at the end of the phase
+  uint32_t micros; //micros() since power-on at the end of the phase
+};
+
+void BootMark(const char* phase); //pass a string literal, only the pointer is stored
+uint32_t BootMillis(); //power-on to the last recorded phase
+void BootTimelinePrint(Print& out);
+
+#endif
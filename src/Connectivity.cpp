@@ -0,0 +1,187 @@
+#include "Connectivity.h"
+#include <time.h>
+#include "FSOperations.h"
+#include "Log.h"
+//the WiFiManager headers define globals, they may only be included in this file
+#include "WiFiManager/defines.h"
+#include "WiFiManager/Credentials.h"
+#include "WiFiManager/dynamicParams.h"
+
+static ESPAsync_WiFiManager_Lite* ESPAsync_WiFiManager = NULL;
+static volatile bool ntpSynced = false;
+
+#if USING_CUSTOMS_STYLE
+const char NewCustomsStyle[] PROGMEM =
+  "<style>div,input{padding:5px;font-size:1em;}input{width:95%;}body{text-align: center;}"\
+  "button{background-color:blue;color:white;line-height:2.4rem;font-size:1.2rem;width:100%;}fieldset{border-radius:0.3rem;margin:0px;}</style>";
+#endif
+
+//called by the SNTP client, only sets a flag, the work is done in the next slice
+static void ntpCallback(){
+  ntpSynced = true;
+}
+
+void ConnectivityManager::begin(const char* timezone, void (*onTimeSynced)()){
+  _timezone = timezone;
+  _onTimeSynced = onTimeSynced;
+  if (!SD.exists("/WiFiSecrets.txt")){
+    Serial.println("No WiFi credentials found, starting Ledafoon Accesspoint");
+    startPortal();
+    return;
+  }
+  _secrets = RecoverWiFiSecrets();
+  WiFi.mode(WIFI_STA); // explicitly set mode, esp defaults to STA+AP
+  WiFi.persistent(false);
+  WiFi.setAutoReconnect(false); //reconnects are paced by our own backoff
+  _gotIPHandler = WiFi.onStationModeGotIP([this](const WiFiEventStationModeGotIP&){
+    _backoffMillis = WIFI_BACKOFF_MIN_MILLIS;
+  });
+  _disconnectedHandler = WiFi.onStationModeDisconnected([this](const WiFiEventStationModeDisconnected& event){
+    _lastDisconnectReason = event.reason;
+  });
+  _connect();
+}
+
+void ConnectivityManager::startPortal(){
+  Serial.print(F("\nStarting ESPAsync_WiFi using "));
+  Serial.print(FS_Name);
+  Serial.print(F(" on "));
+  Serial.println(ARDUINO_BOARD);
+  Serial.println(ESP_ASYNC_WIFI_MANAGER_LITE_VERSION);
+  if (!ESPAsync_WiFiManager) ESPAsync_WiFiManager = new ESPAsync_WiFiManager_Lite();
+  String AP_SSID = "Ledafoon";
+  String AP_PWD  = "Leda12345";
+  // Set customized AP SSID and PWD
+  ESPAsync_WiFiManager->setConfigPortal(AP_SSID, AP_PWD);
+  ESPAsync_WiFiManager->setConfigPortalChannel(0);
+#if USING_CUSTOMS_STYLE
+  ESPAsync_WiFiManager->setCustomsStyle(NewCustomsStyle);
+#endif
+#if USING_CUSTOMS_HEAD_ELEMENT
+  ESPAsync_WiFiManager->setCustomsHeadElement(PSTR("<style>html{filter: invert(10%);}</style>"));
+#endif
+#if USING_CORS_FEATURE
+  ESPAsync_WiFiManager->setCORSHeader(PSTR("Your Access-Control-Allow-Origin"));
+#endif
+  // Set customized DHCP HostName
+  ESPAsync_WiFiManager->begin(HOST_NAME);
+  _state = CONN_PORTAL;
+  _stateMillis = millis();
+}
+
+void ConnectivityManager::_connect(){
+  WiFi.begin(_secrets.SSID, _secrets.Pass);
+  _state = CONN_CONNECTING;
+  _stateMillis = millis();
+}
+
+void ConnectivityManager::_backoff(){
+  WiFi.disconnect();
+  _retries++;
+  _state = CONN_BACKOFF;
+  _stateMillis = millis();
+  LOG_WARN("WiFi not connected (reason %u), retrying in %u s", _lastDisconnectReason, _backoffMillis / 1000);
+}
+
+void ConnectivityManager::_runPortal(){
+  ESPAsync_WiFiManager->run();
+  if (WiFi.status() != WL_CONNECTED) return;
+  _secrets.SSID = ESPAsync_WiFiManager->getWiFiSSID(0);
+  _secrets.Pass = ESPAsync_WiFiManager->getWiFiPW(0);
+  Serial.print("SSID: ");
+  Serial.println(_secrets.SSID);
+  StoreSettings(&_secrets);
+  Serial.println("Wifi information stored, rebooting...\n");
+  _state = CONN_PORTAL_DONE;
+  _stateMillis = millis();
+}
+
+void ConnectivityManager::run(){
+  uint32_t start = micros();
+  unsigned long elapsed = millis() - _stateMillis;
+  switch (_state){
+    case CONN_OFF:
+      break;
+
+    case CONN_CONNECTING:
+      if (WiFi.status() == WL_CONNECTED){
+        LOG_INFO("WiFi connected, IP: %s", WiFi.localIP().toString().c_str());
+        _state = CONN_CONNECTED;
+        _stateMillis = millis();
+        if (!_ntpStarted){
+          //the SNTP client keeps the time in sync by itself from now on
+          settimeofday_cb(ntpCallback);
+          configTime(_timezone, NTP_SERVER);
+          _ntpStarted = true;
+        }
+        else if (ntpSynced) _state = CONN_SYNCED;
+      }
+      else if (elapsed > WIFI_CONNECT_TIMEOUT_MILLIS || WiFi.status() == WL_CONNECT_FAILED || WiFi.status() == WL_NO_SSID_AVAIL){
+        _backoff();
+      }
+      break;
+
+    case CONN_BACKOFF:
+      if (elapsed >= _backoffMillis){
+        _backoffMillis = min(_backoffMillis * 2, (uint32_t)WIFI_BACKOFF_MAX_MILLIS);
+        _connect();
+      }
+      break;
+
+    case CONN_CONNECTED:
+    case CONN_SYNCED:
+      if (WiFi.status() != WL_CONNECTED){
+        LOG_WARN("WiFi connection lost");
+        _backoff();
+        break;
+      }
+      if (_state == CONN_CONNECTED && ntpSynced){
+        _state = CONN_SYNCED;
+        if (_onTimeSynced) _onTimeSynced();
+      }
+      break;
+
+    case CONN_PORTAL:
+      _runPortal();
+      break;
+
+    case CONN_PORTAL_DONE:
+      ESPAsync_WiFiManager->run();
+      if (elapsed > WIFI_PORTAL_RESTART_MILLIS) ESP.restart();
+      break;
+  }
+  uint32_t slice = micros() - start;
+  if (slice > _worstSliceMicros) _worstSliceMicros = slice;
+}
+
+ConnectivityState ConnectivityManager::getState(){
+  return _state;
+}
+
+bool ConnectivityManager::isActive(){
+  return _state != CONN_OFF;
+}
+
+bool ConnectivityManager::isConnected(){
+  return _state == CONN_CONNECTED || _state == CONN_SYNCED;
+}
+
+bool ConnectivityManager::isPortal(){
+  return _state == CONN_PORTAL || _state == CONN_PORTAL_DONE;
+}
+
+bool ConnectivityManager::isTimeSynced(){
+  return ntpSynced;
+}
+
+uint32_t ConnectivityManager::getWorstSliceMicros(){
+  return _worstSliceMicros;
+}
+
+uint32_t ConnectivityManager::getRetries(){
+  return _retries;
+}
+
+void ConnectivityManager::resetWorstSlice(){
+  _worstSliceMicros = 0;
+}
@@ -0,0 +1,62 @@
+#ifndef CONNECTIVITY_H_
+#define CONNECTIVITY_H_
+
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+#include "datatypes.h"
+
+//WiFi station connect with backoff, NTP time sync and the WiFiManager config portal as one
+//state machine. run() is called from loop() and never waits, one call is one small slice.
+#define WIFI_CONNECT_TIMEOUT_MILLIS 15000
+#define WIFI_BACKOFF_MIN_MILLIS 2000
+#define WIFI_BACKOFF_MAX_MILLIS 300000 //5 minutes between attempts when the network is gone for long
+#define WIFI_PORTAL_RESTART_MILLIS 2000 //time to let the portal answer the browser before rebooting
+#define NTP_SERVER "be.pool.ntp.org"
+
+enum ConnectivityState{
+  CONN_OFF = 0,
+  CONN_CONNECTING,
+  CONN_BACKOFF,
+  CONN_CONNECTED, //waiting for the first NTP answer
+  CONN_SYNCED,
+  CONN_PORTAL,
+  CONN_PORTAL_DONE
+};
+
+class ConnectivityManager
+{
+public:
+  //starts the station connection, or the config portal when no credentials are stored
+  void begin(const char* timezone, void (*onTimeSynced)());
+  void startPortal();
+  void run();
+
+  ConnectivityState getState();
+  bool isActive();
+  bool isConnected();
+  bool isPortal();
+  bool isTimeSynced();
+  uint32_t getWorstSliceMicros();
+  uint32_t getRetries();
+  void resetWorstSlice();
+
+protected:
+  void _connect();
+  void _backoff();
+  void _runPortal();
+
+  ConnectivityState _state = CONN_OFF;
+  const char* _timezone = NULL;
+  void (*_onTimeSynced)() = NULL;
+  WiFiSecrets _secrets;
+  WiFiEventHandler _gotIPHandler;
+  WiFiEventHandler _disconnectedHandler;
+  unsigned long _stateMillis = 0;
+  uint32_t _backoffMillis = WIFI_BACKOFF_MIN_MILLIS;
+  uint32_t _retries = 0;
+  uint32_t _worstSliceMicros = 0;
+  uint8_t _lastDisconnectReason = 0;
+  bool _ntpStarted = false;
+};
+
+#endif
@@ -0,0 +1,68 @@
+#include "DeltaSigma.h"
+#include <i2s.h>
+
+//a word with n ones spread as evenly as they go, index 0..DELTASIGMA_LEVELS
+static uint32_t patterns[DELTASIGMA_LEVELS + 1];
+
+DeltaSigmaOutput::DeltaSigmaOutput() : AudioOutputI2S()
+{
+  for (uint8_t ones = 0; ones <= DELTASIGMA_LEVELS; ones++){
+    uint32_t word = 0;
+    for (uint8_t bit = 0; bit < 32; bit++){
+      if ((bit + 1) * ones / 32 > bit * ones / 32) word |= 1UL << bit;
+    }
+    patterns[ones] = word;
+  }
+}
+
+bool DeltaSigmaOutput::begin()
+{
+  _error1 = 0;
+  _error2 = 0;
+  return AudioOutputI2S::begin();
+}
+
+int DeltaSigmaOutput::AdjustI2SRate(int hz)
+{
+  return hz * DELTASIGMA_WORDS;
+}
+
+bool DeltaSigmaOutput::ConsumeSample(int16_t sample[2])
+{
+  int16_t frame[2] = {sample[LEFTCHANNEL], sample[RIGHTCHANNEL]};
+  MakeSampleStereo16(frame);
+  frame[LEFTCHANNEL] = Amplify(frame[LEFTCHANNEL]);
+  frame[RIGHTCHANNEL] = Amplify(frame[RIGHTCHANNEL]);
+  return writeFrames(frame, 1) == 1;
+}
+
+uint16_t DeltaSigmaOutput::writeFrames(const int16_t *frames, uint16_t count)
+{
+  //a frame is never split, the loop state would not match what was sent
+  count = min((uint32_t)count, (uint32_t)i2s_available() / DELTASIGMA_WORDS);
+  uint32_t words[DELTASIGMA_CHUNK_FRAMES * DELTASIGMA_WORDS];
+  int32_t error1 = _error1, error2 = _error2;
+  uint16_t written = 0;
+  while (written < count){
+    uint16_t chunk = min((uint16_t)(count - written), (uint16_t)DELTASIGMA_CHUNK_FRAMES);
+    uint32_t *out = words;
+    for (const int16_t *frame = frames + 2 * written; frame < frames + 2 * (written + chunk); frame += 2){
+      //mono, at 7/8 of full scale so the loop never needs more than 0..32 ones
+      int32_t level = 32768 + (((frame[LEFTCHANNEL] + frame[RIGHTCHANNEL]) * 7) >> 4);
+      for (uint8_t w = 0; w < DELTASIGMA_WORDS; w++){
+        //(1 - z^-1)^2 shapes the quantization error, one level is 65536 / DELTASIGMA_LEVELS
+        int32_t wanted = level + 2 * error1 - error2;
+        int32_t ones = constrain((wanted + 1024) >> 11, 0, DELTASIGMA_LEVELS);
+        error2 = error1;
+        error1 = wanted - (ones << 11);
+        *out++ = patterns[ones];
+      }
+    }
+    uint16_t sent = i2s_write_buffer_nb((int16_t *)words, chunk * DELTASIGMA_WORDS);
+    written += sent / DELTASIGMA_WORDS;
+    if (sent < chunk * DELTASIGMA_WORDS) break;
+  }
+  _error1 = error1;
+  _error2 = error2;
+  return written;
+}
@@ -0,0 +1,41 @@
+#ifndef DELTASIGMA_H_
+#define DELTASIGMA_H_
+
+#include <Arduino.h>
+#include "AudioOutputI2S.h"
+
+//I2S output for phones without a DAC, the speaker (through an RC filter or a transistor) on
+//the I2S data pin. Built with -DAUDIO_NO_DAC in place of AudioOutputI2S.
+//
+//AudioOutputI2SNoDAC of the library runs a first-order modulator bit by bit, 32 or more
+//loop passes per sample. This one decides a whole 32 bit word at a time: a second-order
+//error feedback loop quantizes the sample to 0..32 ones, and the word comes from a table
+//of those counts with the ones spread evenly, so the ripple of the pattern sits at the bit
+//rate and above. DELTASIGMA_OVERSAMPLE / 32 words go out per sample, each with its own
+//pass through the loop, which moves the shaped noise further up.
+//tools/deltasigma_bench.py compares the in-band SNR of both on the host.
+#ifndef DELTASIGMA_OVERSAMPLE
+#define DELTASIGMA_OVERSAMPLE 64 //bits per sample, a multiple of 32
+#endif
+#define DELTASIGMA_WORDS (DELTASIGMA_OVERSAMPLE / 32)
+#define DELTASIGMA_LEVELS 32 //ones in a full scale word
+#define DELTASIGMA_CHUNK_FRAMES 32 //frames modulated on the stack at a time
+
+class DeltaSigmaOutput : public AudioOutputI2S
+{
+public:
+  DeltaSigmaOutput();
+  virtual bool begin() override;
+  virtual bool ConsumeSample(int16_t sample[2]) override;
+  //16 bit stereo frames, gain already applied. Returns the frames queued, only whole frames.
+  uint16_t writeFrames(const int16_t *frames, uint16_t count);
+
+protected:
+  //the I2S clock runs DELTASIGMA_WORDS words per sample
+  virtual int AdjustI2SRate(int hz) override;
+
+  int32_t _error1 = 0;
+  int32_t _error2 = 0;
+};
+
+#endif
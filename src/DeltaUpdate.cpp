@@ -0,0 +1,211 @@
+#include "DeltaUpdate.h"
+#include <CRC32.h>
+#include <Updater.h>
+
+enum DeltaOp{
+  DELTA_OP_END = 0,
+  DELTA_OP_COPY,
+  DELTA_OP_ADD,
+  DELTA_OP_INSERT
+};
+
+//all state of one patch run, the windows are the only buffers
+struct DeltaContext{
+  File patch;
+  uint8_t input[DELTA_INPUT_WINDOW];
+  uint16_t inputPos;
+  uint16_t inputLen;
+  uint32_t flash[DELTA_FLASH_WINDOW / 4]; //flashRead needs 4 byte alignment
+  uint32_t flashStart;
+  bool flashValid;
+  uint32_t oldSize;
+  uint8_t output[DELTA_OUTPUT_WINDOW];
+  uint16_t outputLen;
+  uint32_t written;
+  uint32_t newSize;
+  uint32_t newCRC;
+  CRC32 crc;
+  bool error;
+  DeltaResult result;
+  FirmwareProgressCallback progress;
+};
+
+static bool readPatch(DeltaContext* ctx, uint8_t* byte){
+  if (ctx->inputPos == ctx->inputLen){
+    int len = ctx->patch.read(ctx->input, DELTA_INPUT_WINDOW);
+    if (len <= 0) return false;
+    ctx->inputLen = len;
+    ctx->inputPos = 0;
+  }
+  *byte = ctx->input[ctx->inputPos++];
+  return true;
+}
+
+static bool readVarint(DeltaContext* ctx, uint32_t* value){
+  uint8_t byte;
+  *value = 0;
+  for (uint8_t shift = 0; shift < 35; shift += 7){
+    if (!readPatch(ctx, &byte)) return false;
+    *value |= (uint32_t)(byte & 0x7F) << shift;
+    if (!(byte & 0x80)) return true;
+  }
+  return false;
+}
+
+static uint8_t readOld(DeltaContext* ctx, uint32_t offset){
+  if (!ctx->flashValid || offset < ctx->flashStart || offset >= ctx->flashStart + DELTA_FLASH_WINDOW){
+    ctx->flashStart = offset & ~(DELTA_FLASH_WINDOW - 1);
+    ctx->flashValid = ESP.flashRead(ctx->flashStart, ctx->flash, DELTA_FLASH_WINDOW);
+    if (!ctx->flashValid){
+      ctx->error = true;
+      ctx->result = DELTA_READ_ERROR;
+      return 0;
+    }
+  }
+  return ((uint8_t*)ctx->flash)[offset - ctx->flashStart];
+}
+
+//the window that completes the image is only written once the patch ended and the crc matches,
+//so a failed run always leaves an incomplete image that Update.end(false) drops
+static void flushOutput(DeltaContext* ctx){
+  if (!ctx->outputLen) return;
+  ctx->crc.update(ctx->output, ctx->outputLen);
+  if (ctx->written + ctx->outputLen == ctx->newSize && ctx->crc.finalize() != ctx->newCRC){
+    ctx->error = true;
+    ctx->result = DELTA_CRC_MISMATCH;
+    ctx->outputLen = 0;
+    return;
+  }
+  if (Update.write(ctx->output, ctx->outputLen) != ctx->outputLen){
+    ctx->error = true;
+    ctx->result = DELTA_WRITE_ERROR;
+  }
+  ctx->written += ctx->outputLen;
+  ctx->outputLen = 0;
+  if (ctx->progress) ctx->progress(ctx->written, ctx->newSize);
+  yield();
+}
+
+static void writeNew(DeltaContext* ctx, uint8_t byte){
+  ctx->output[ctx->outputLen++] = byte;
+  if (ctx->outputLen == DELTA_OUTPUT_WINDOW && ctx->written + ctx->outputLen < ctx->newSize) flushOutput(ctx);
+}
+
+static bool checkRange(DeltaContext* ctx, uint32_t src, uint32_t len, bool fromOld){
+  bool ok = ctx->written + ctx->outputLen + len <= ctx->newSize && (!fromOld || (src <= ctx->oldSize && len <= ctx->oldSize - src));
+  if (!ok){
+    ctx->error = true;
+    ctx->result = DELTA_BAD_PATCH;
+  }
+  return ok;
+}
+
+static bool runOperation(DeltaContext* ctx, uint8_t op){
+  uint32_t src = 0, len = 0;
+  uint8_t byte;
+  switch (op){
+    case DELTA_OP_COPY:
+      if (!readVarint(ctx, &src) || !readVarint(ctx, &len) || !checkRange(ctx, src, len, true)) break;
+      for (uint32_t i = 0; i < len && !ctx->error; i++) writeNew(ctx, readOld(ctx, src + i));
+      return !ctx->error;
+
+    case DELTA_OP_ADD:
+      if (!readVarint(ctx, &src) || !readVarint(ctx, &len) || !checkRange(ctx, src, len, true)) break;
+      for (uint32_t done = 0; done < len && !ctx->error;){
+        uint32_t token;
+        if (!readVarint(ctx, &token)) break;
+        uint32_t run = token >> 1;
+        if (run == 0 || run > len - done) break;
+        for (uint32_t i = 0; i < run; i++){
+          uint8_t difference = 0;
+          if ((token & 1) && !readPatch(ctx, &difference)) return false;
+          writeNew(ctx, readOld(ctx, src + done + i) + difference);
+        }
+        done += run;
+        if (done == len) return !ctx->error;
+      }
+      break;
+
+    case DELTA_OP_INSERT:
+      if (!readVarint(ctx, &len) || !checkRange(ctx, 0, len, false)) break;
+      for (uint32_t i = 0; i < len && !ctx->error; i++){
+        if (!readPatch(ctx, &byte)) return false;
+        writeNew(ctx, byte);
+      }
+      return !ctx->error;
+  }
+  if (!ctx->error){
+    ctx->error = true;
+    ctx->result = DELTA_BAD_PATCH;
+  }
+  return false;
+}
+
+static void toHex(const uint8_t* bytes, uint8_t len, char* hex){
+  for (uint8_t i = 0; i < len; i++) sprintf(&hex[i * 2], "%02x", bytes[i]);
+}
+
+DeltaResult ApplyDeltaFromSD(const char* patchPath, FirmwareProgressCallback progress, FirmwareUpdateStats* stats){
+  DeltaContext* ctx = new DeltaContext();
+  ctx->patch = SD.open(patchPath, FILE_READ);
+  if (!ctx->patch){
+    delete ctx;
+    return DELTA_NOT_FOUND;
+  }
+  ctx->progress = progress;
+  ctx->result = DELTA_OK;
+
+  uint8_t header[DELTA_HEADER_SIZE];
+  char oldMD5[33], newMD5[33];
+  DeltaResult result = DELTA_OK;
+  if (ctx->patch.read(header, DELTA_HEADER_SIZE) != DELTA_HEADER_SIZE || memcmp(header, "LDF1", 4) != 0){
+    result = DELTA_BAD_HEADER;
+  }
+  else {
+    memcpy(&ctx->oldSize, &header[4], 4);
+    toHex(&header[8], 16, oldMD5);
+    memcpy(&ctx->newSize, &header[24], 4);
+    toHex(&header[28], 16, newMD5);
+    memcpy(&ctx->newCRC, &header[44], 4);
+    if (ctx->oldSize != ESP.getSketchSize() || ESP.getSketchMD5() != oldMD5) result = DELTA_WRONG_BASE;
+    else if (!Update.begin(ctx->newSize, U_FLASH)) result = DELTA_BEGIN_ERROR;
+  }
+
+  uint32_t startMillis = millis();
+  if (result == DELTA_OK){
+    //the updater hashes what it writes, end() refuses the image if it differs from the new md5
+    Update.setMD5(newMD5);
+    uint8_t op = 0xFF;
+    while (readPatch(ctx, &op) && op != DELTA_OP_END && runOperation(ctx, op));
+    if (!ctx->error && op == DELTA_OP_END) flushOutput(ctx);
+    if (ctx->error) result = ctx->result;
+    else if (op != DELTA_OP_END || ctx->written != ctx->newSize) result = DELTA_BAD_PATCH;
+    else if (!Update.end()) result = (Update.getError() == UPDATE_ERROR_MD5) ? DELTA_MD5_MISMATCH : DELTA_WRITE_ERROR;
+    //a failed run is dropped, so a retry or a full update can begin() again
+    if (result != DELTA_OK) Update.end(false);
+  }
+  if (stats){
+    stats->bytes = ctx->written;
+    stats->durationMillis = millis() - startMillis;
+    stats->bytesPerSecond = stats->durationMillis ? (uint32_t)((uint64_t)ctx->written * 1000 / stats->durationMillis) : 0;
+  }
+  ctx->patch.close();
+  delete ctx;
+  return result;
+}
+
+const char* DeltaResultString(DeltaResult result){
+  switch (result){
+    case DELTA_OK: return "ok";
+    case DELTA_NOT_FOUND: return "patch not found";
+    case DELTA_BAD_HEADER: return "not a delta patch";
+    case DELTA_WRONG_BASE: return "patch is for another firmware version";
+    case DELTA_BAD_PATCH: return "patch is corrupt";
+    case DELTA_BEGIN_ERROR: return "not enough space for update";
+    case DELTA_READ_ERROR: return "flash read error";
+    case DELTA_WRITE_ERROR: return "flash write error";
+    case DELTA_CRC_MISMATCH: return "crc32 mismatch";
+    case DELTA_MD5_MISMATCH: return "md5 mismatch";
+  }
+  return "unknown";
+}
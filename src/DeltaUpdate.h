@@ -0,0 +1,43 @@
+#ifndef DELTAUPDATE_H_
+#define DELTAUPDATE_H_
+
+#include <Arduino.h>
+#include <SD.h>
+#include "FirmwareUpdate.h"
+
+//Delta firmware updates: the new image is rebuilt from the running image in flash and a
+//patch made by tools/make_delta.py, so only the changes travel over the soft-AP or SD card.
+//
+//Patch layout (little endian):
+//  "LDF1", uint32 old size, 16 byte old md5, uint32 new size, 16 byte new md5, uint32 new crc32
+//  then operations, numbers are LEB128 varints:
+//  0x01 COPY   src len          copy len bytes of the old image from src
+//  0x02 ADD    src len tokens   old image bytes plus a difference, the difference is sent as
+//                               tokens n<<1 (n zero bytes) and n<<1|1 followed by n bytes
+//  0x03 INSERT len bytes        new bytes
+//  0x00 END
+#define DELTA_PATH "/firmware.dlt"
+#define DELTA_DONE_PATH "/firmware.dlt.bak"
+#define DELTA_HEADER_SIZE 48
+//RAM used while patching, on top of the 4k sector buffer of the updater
+#define DELTA_INPUT_WINDOW 256
+#define DELTA_FLASH_WINDOW 256
+#define DELTA_OUTPUT_WINDOW 512
+
+enum DeltaResult{
+  DELTA_OK = 0,
+  DELTA_NOT_FOUND,
+  DELTA_BAD_HEADER,
+  DELTA_WRONG_BASE, //patch was made for another firmware than the one running
+  DELTA_BAD_PATCH,
+  DELTA_BEGIN_ERROR,
+  DELTA_READ_ERROR,
+  DELTA_WRITE_ERROR,
+  DELTA_CRC_MISMATCH,
+  DELTA_MD5_MISMATCH
+};
+
+DeltaResult ApplyDeltaFromSD(const char* patchPath, FirmwareProgressCallback progress, FirmwareUpdateStats* stats);
+const char* DeltaResultString(DeltaResult result);
+
+#endif
@@ -28,3 +28,33 @@ WiFiSecrets RecoverWiFiSecrets(){
   return secrets;
 }
 
+
+//SPI clocks to try, fastest first. 40MHz is the maximum the ESP8266 SPI can do.
+static const uint8_t sdSpeedsMHz[] = {40, 26, 20, 10, 4};
+
+//reads the first sector of the first file twice, a marginal clock shows up as different data
+static bool SDReadTest(){
+  File root = SD.open("/");
+  if (!root) return false;
+  File file = root.openNextFile();
+  while (file && file.isDirectory()){
+    file.close();
+    file = root.openNextFile();
+  }
+  root.close();
+  if (!file) return true; //empty card, nothing to compare
+  uint8_t first[512], second[512];
+  int len = file.read(first, sizeof(first));
+  file.seek(0);
+  bool ok = len > 0 && file.read(second, sizeof(second)) == len && memcmp(first, second, len) == 0;
+  file.close();
+  return ok;
+}
+
+uint8_t CalibrateSDSpeed(uint8_t csPin){
+  for (uint8_t mhz : sdSpeedsMHz){
+    if (SD.begin(csPin, SD_SCK_MHZ(mhz)) && SDReadTest()) return mhz;
+    SD.end();
+  }
+  return 0;
+}
@@ -6,5 +6,7 @@
 
 void StoreSettings(WiFiSecrets* settings);
 WiFiSecrets RecoverWiFiSecrets();
+//Starts the SD card at the fastest clock (MHz) that reads back consistently, returns it or 0 if none works
+uint8_t CalibrateSDSpeed(uint8_t csPin);
 
 #endif
\ No newline at end of file
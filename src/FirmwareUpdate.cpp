@@ -0,0 +1,157 @@
+#include "FirmwareUpdate.h"
+#include <ArduinoJson.h>
+#include <CRC32.h>
+#include <Updater.h>
+
+bool ReadFirmwareManifest(const char* path, FirmwareManifest* manifest){
+  File file = SD.open(path, FILE_READ);
+  if (!file) return false;
+  StaticJsonDocument<256> doc;
+  DeserializationError error = deserializeJson(doc, file);
+  file.close();
+  if (error) return false;
+  strlcpy(manifest->version, doc["version"] | "", sizeof(manifest->version));
+  strlcpy(manifest->md5, doc["md5"] | "", sizeof(manifest->md5));
+  manifest->size = doc["size"] | 0;
+  manifest->crc32 = doc["crc32"] | 0;
+  return manifest->size > 0 && strlen(manifest->md5) == 32;
+}
+
+bool WriteFirmwareManifest(const char* path, const FirmwareManifest* manifest){
+  if (SD.exists(path)) SD.remove(path);
+  File file = SD.open(path, FILE_WRITE);
+  if (!file) return false;
+  StaticJsonDocument<256> doc;
+  doc["version"] = manifest->version;
+  doc["size"] = manifest->size;
+  doc["crc32"] = manifest->crc32;
+  doc["md5"] = manifest->md5;
+  bool ok = serializeJson(doc, file) > 0;
+  file.close();
+  return ok;
+}
+
+FirmwareUpdateResult BackupRunningFirmware(const char* version){
+  FirmwareManifest manifest;
+  strlcpy(manifest.version, version, sizeof(manifest.version));
+  manifest.size = ESP.getSketchSize();
+  strlcpy(manifest.md5, ESP.getSketchMD5().c_str(), sizeof(manifest.md5));
+
+  //flashRead wants a 4 byte aligned buffer
+  uint32_t* block = (uint32_t*)malloc(FIRMWARE_BLOCK_SIZE);
+  if (!block) return FW_NO_MEMORY;
+  if (SD.exists(FIRMWARE_ROLLBACK_PATH)) SD.remove(FIRMWARE_ROLLBACK_PATH);
+  File backup = SD.open(FIRMWARE_ROLLBACK_PATH, FILE_WRITE);
+  if (!backup){
+    free(block);
+    return FW_BACKUP_ERROR;
+  }
+  CRC32 crc;
+  FirmwareUpdateResult result = FW_OK;
+  //the sketch starts at offset 0 of the flash
+  for (uint32_t offset = 0; offset < manifest.size; offset += FIRMWARE_BLOCK_SIZE){
+    size_t len = min((uint32_t)FIRMWARE_BLOCK_SIZE, manifest.size - offset);
+    if (!ESP.flashRead(offset, block, (len + 3) & ~3)){
+      result = FW_READ_ERROR;
+      break;
+    }
+    crc.update((uint8_t*)block, len);
+    if (backup.write((uint8_t*)block, len) != len){
+      result = FW_BACKUP_ERROR;
+      break;
+    }
+    yield();
+  }
+  backup.close();
+  free(block);
+  manifest.crc32 = crc.finalize();
+  if (result == FW_OK && !WriteFirmwareManifest(FIRMWARE_ROLLBACK_MANIFEST_PATH, &manifest)){
+    result = FW_BACKUP_ERROR;
+  }
+  if (result != FW_OK) SD.remove(FIRMWARE_ROLLBACK_PATH);
+  return result;
+}
+
+FirmwareUpdateResult FlashFirmwareFromSD(const char* binPath, const char* manifestPath, FirmwareProgressCallback progress, FirmwareUpdateStats* stats){
+  FirmwareManifest manifest;
+  if (!SD.exists(binPath)) return FW_NOT_FOUND;
+  if (!SD.exists(manifestPath)) return FW_NO_MANIFEST;
+  if (!ReadFirmwareManifest(manifestPath, &manifest)) return FW_BAD_MANIFEST;
+
+  File firmware = SD.open(binPath, FILE_READ);
+  if (!firmware) return FW_NOT_FOUND;
+  if (firmware.size() != manifest.size){
+    firmware.close();
+    return FW_SIZE_MISMATCH;
+  }
+  uint8_t* block = (uint8_t*)malloc(FIRMWARE_BLOCK_SIZE);
+  if (!block){
+    firmware.close();
+    return FW_NO_MEMORY;
+  }
+  if (!Update.begin(manifest.size, U_FLASH)){
+    free(block);
+    firmware.close();
+    return FW_BEGIN_ERROR;
+  }
+  //the updater hashes everything it writes, end() fails when it does not match this md5
+  Update.setMD5(manifest.md5);
+
+  CRC32 crc;
+  FirmwareUpdateResult result = FW_OK;
+  uint32_t written = 0;
+  uint32_t startMillis = millis();
+  while (written < manifest.size){
+    size_t len = min((uint32_t)FIRMWARE_BLOCK_SIZE, manifest.size - written);
+    if (firmware.read(block, len) != (int)len){
+      result = FW_READ_ERROR;
+      break;
+    }
+    crc.update(block, len);
+    //the last block only goes to the updater when the crc matches, so a mismatch leaves the image incomplete
+    if (written + len == manifest.size && crc.finalize() != manifest.crc32){
+      result = FW_CRC_MISMATCH;
+      break;
+    }
+    if (Update.write(block, len) != len){
+      result = FW_WRITE_ERROR;
+      break;
+    }
+    written += len;
+    if (progress) progress(written, manifest.size);
+    yield();
+  }
+  firmware.close();
+  free(block);
+
+  //an incomplete or failed update is dropped, so a retry or a rollback can begin() again
+  if (result != FW_OK) Update.end(false);
+  //only commit the new image when every check passed, otherwise the old image keeps booting
+  if (result == FW_OK && !Update.end()){
+    result = (Update.getError() == UPDATE_ERROR_MD5) ? FW_MD5_MISMATCH : FW_WRITE_ERROR;
+  }
+  if (stats){
+    stats->bytes = written;
+    stats->durationMillis = millis() - startMillis;
+    stats->bytesPerSecond = stats->durationMillis ? (uint32_t)((uint64_t)written * 1000 / stats->durationMillis) : 0;
+  }
+  return result;
+}
+
+const char* FirmwareUpdateResultString(FirmwareUpdateResult result){
+  switch (result){
+    case FW_OK: return "ok";
+    case FW_NOT_FOUND: return "firmware not found";
+    case FW_NO_MANIFEST: return "manifest not found";
+    case FW_BAD_MANIFEST: return "manifest unreadable";
+    case FW_SIZE_MISMATCH: return "size does not match manifest";
+    case FW_NO_MEMORY: return "out of memory";
+    case FW_BEGIN_ERROR: return "not enough space for update";
+    case FW_READ_ERROR: return "read error";
+    case FW_WRITE_ERROR: return "flash write error";
+    case FW_CRC_MISMATCH: return "crc32 mismatch";
+    case FW_MD5_MISMATCH: return "md5 mismatch";
+    case FW_BACKUP_ERROR: return "backup of running firmware failed";
+  }
+  return "unknown";
+}
@@ -0,0 +1,61 @@
+#ifndef FIRMWAREUPDATE_H_
+#define FIRMWAREUPDATE_H_
+
+#include <Arduino.h>
+#include <SD.h>
+
+//Files used by the SD card update. The manifest is a small json file next to the firmware
+//made with tools/make_manifest.py: {"version":"1.0.1","size":123456,"md5":"...","crc32":305419896}
+#define FIRMWARE_PATH "/firmware.bin"
+#define FIRMWARE_MANIFEST_PATH "/firmware.json"
+#define FIRMWARE_DONE_PATH "/firmware.bak"
+#define FIRMWARE_DONE_MANIFEST_PATH "/firmware.bak.json"
+//copy of the image that was running before the last update, used to roll back
+#define FIRMWARE_ROLLBACK_PATH "/firmware.prv"
+#define FIRMWARE_ROLLBACK_MANIFEST_PATH "/firmware.prv.json"
+
+//Flash is erased and written per 4k sector, reading the SD card in the same block size
+//keeps every flash write sector aligned and is a multiple of the 512 byte SD sector.
+#define FIRMWARE_BLOCK_SIZE 4096
+
+enum FirmwareUpdateResult{
+  FW_OK = 0,
+  FW_NOT_FOUND,
+  FW_NO_MANIFEST,
+  FW_BAD_MANIFEST,
+  FW_SIZE_MISMATCH,
+  FW_NO_MEMORY,
+  FW_BEGIN_ERROR,
+  FW_READ_ERROR,
+  FW_WRITE_ERROR,
+  FW_CRC_MISMATCH,
+  FW_MD5_MISMATCH,
+  FW_BACKUP_ERROR
+};
+
+struct FirmwareManifest{
+  char version[16];
+  uint32_t size;
+  uint32_t crc32;
+  char md5[33];
+};
+
+struct FirmwareUpdateStats{
+  uint32_t bytes;
+  uint32_t durationMillis;
+  uint32_t bytesPerSecond;
+};
+
+typedef void (*FirmwareProgressCallback)(size_t currSize, size_t totalSize);
+
+bool ReadFirmwareManifest(const char* path, FirmwareManifest* manifest);
+bool WriteFirmwareManifest(const char* path, const FirmwareManifest* manifest);
+//Copies the running sketch to FIRMWARE_ROLLBACK_PATH so a bad (but valid) update can be undone
+FirmwareUpdateResult BackupRunningFirmware(const char* version);
+//Streams an image from the SD card into the OTA partition, checks size, CRC32 and MD5 against
+//the manifest and only commits (Update.end) when everything matches. The running image is
+//untouched on any failure.
+FirmwareUpdateResult FlashFirmwareFromSD(const char* binPath, const char* manifestPath, FirmwareProgressCallback progress, FirmwareUpdateStats* stats);
+const char* FirmwareUpdateResultString(FirmwareUpdateResult result);
+
+#endif
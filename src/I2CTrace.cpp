@@ -0,0 +1,141 @@
+#include "I2CTrace.h"
+#include <SD.h>
+#include <ESPAsyncWebServer.h>
+
+#ifdef I2C_TRACE
+static I2CTraceRecord traceRing[I2C_TRACE_SIZE];
+#endif
+static uint32_t traceTotal = 0; //records ever added, the ring holds the last I2C_TRACE_SIZE
+
+void I2CTraceAdd(uint32_t startCycles, uint8_t address, uint8_t mask, uint8_t result, uint8_t op){
+#ifdef I2C_TRACE
+  uint32_t duration = ESP.getCycleCount() - startCycles;
+  I2CTraceRecord& record = traceRing[traceTotal % I2C_TRACE_SIZE];
+  record.cycles = startCycles;
+  record.millis = millis();
+  record.durationCycles = duration > 0xFFFF ? 0xFFFF : duration;
+  record.address = address;
+  record.mask = mask;
+  record.result = result;
+  record.op = op;
+  record.reserved = 0;
+  traceTotal++;
+#else
+  (void)startCycles; (void)address; (void)mask; (void)result; (void)op;
+#endif
+}
+
+uint16_t I2CTraceCount(){
+  return traceTotal < I2C_TRACE_SIZE ? traceTotal : I2C_TRACE_SIZE;
+}
+
+#ifdef I2C_TRACE
+static const I2CTraceRecord& oldestRecord(uint16_t i){
+  uint32_t first = traceTotal - I2CTraceCount();
+  return traceRing[(first + i) % I2C_TRACE_SIZE];
+}
+#endif
+
+void I2CTraceDump(Print& out){
+#ifdef I2C_TRACE
+  out.println(F("cycles millis duration addr mask result op"));
+  for (uint16_t i = 0; i < I2CTraceCount(); i++){
+    const I2CTraceRecord& r = oldestRecord(i);
+    out.printf("%u %u %u 0x%02x 0x%02x 0x%02x %u\n", r.cycles, r.millis, r.durationCycles, r.address, r.mask, r.result, r.op);
+  }
+#else
+  out.println(F("I2C tracing not compiled in, build with -DI2C_TRACE"));
+#endif
+}
+
+void SetupI2CTrace(AsyncWebServer* server){
+#ifdef I2C_TRACE
+  server->on("/i2ctrace", HTTP_GET, [](AsyncWebServerRequest* request){
+    //snapshot the ring oldest first, the loop keeps recording while the response goes out
+    uint16_t count = I2CTraceCount();
+    AsyncResponseStream* response = request->beginResponseStream("application/octet-stream", count * sizeof(I2CTraceRecord));
+    for (uint16_t i = 0; i < count; i++) response->write((const uint8_t*)&oldestRecord(i), sizeof(I2CTraceRecord));
+    request->send(response);
+  });
+#else
+  (void)server;
+#endif
+}
+
+#ifdef I2C_TRACE_REPLAY
+static File replayFile;
+static I2CTraceRecord replayRecord;
+static bool replayValid = false;
+static uint32_t replayMismatches = 0;
+static uint32_t replayMillis = 0;
+static uint64_t replayBusCycles = 0;
+
+static bool replayRead(){
+  replayValid = replayFile && replayFile.read((uint8_t*)&replayRecord, sizeof(replayRecord)) == sizeof(replayRecord);
+  return replayValid;
+}
+#endif
+
+bool I2CReplayLoad(const char* path){
+#ifdef I2C_TRACE_REPLAY
+  replayFile = SD.open(path, FILE_READ);
+  replayMismatches = 0;
+  replayBusCycles = 0;
+  return replayRead();
+#else
+  (void)path;
+  return false;
+#endif
+}
+
+bool I2CReplayNext(uint8_t address, uint8_t mask, uint8_t* result){
+#ifdef I2C_TRACE_REPLAY
+  //traffic to other devices only moves the clock
+  while (replayValid && replayRecord.address != address){
+    replayMillis = replayRecord.millis;
+    replayRead();
+  }
+  if (!replayValid) return false;
+  if (replayRecord.mask != mask) replayMismatches++;
+  *result = replayRecord.result;
+  replayMillis = replayRecord.millis;
+  replayBusCycles += replayRecord.durationCycles;
+  replayRead();
+  return true;
+#else
+  (void)address; (void)mask; (void)result;
+  return false;
+#endif
+}
+
+uint32_t I2CReplayMillis(){
+#ifdef I2C_TRACE_REPLAY
+  return replayMillis;
+#else
+  return millis();
+#endif
+}
+
+bool I2CReplayDone(){
+#ifdef I2C_TRACE_REPLAY
+  return !replayValid;
+#else
+  return true;
+#endif
+}
+
+uint32_t I2CReplayMaskMismatches(){
+#ifdef I2C_TRACE_REPLAY
+  return replayMismatches;
+#else
+  return 0;
+#endif
+}
+
+uint64_t I2CReplayBusCycles(){
+#ifdef I2C_TRACE_REPLAY
+  return replayBusCycles;
+#else
+  return 0;
+#endif
+}
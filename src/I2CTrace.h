@@ -0,0 +1,58 @@
+#ifndef I2CTRACE_H_
+#define I2CTRACE_H_
+
+#include <Arduino.h>
+
+//Optional recorder for the I2C traffic of the keypad and the GPIO expander.
+//  -DI2C_TRACE          record every transaction in a ring buffer, dump with GET /i2ctrace
+//                       (binary, save it as /i2ctrace.bin on the SD card) or I2CTraceDump()
+//  -DI2C_TRACE_REPLAY   PhoneKeypad reads from /i2ctrace.bin instead of the bus, with the
+//                       recorded clock, so a field capture decodes exactly like it did live.
+//See the d1_mini_i2ctrace and d1_mini_i2creplay environments in platformio.ini.
+#ifndef I2C_TRACE_SIZE
+#define I2C_TRACE_SIZE 128 //records of 16 bytes
+#endif
+#define I2C_TRACE_PATH "/i2ctrace.bin"
+
+enum I2CTraceOp{
+  I2C_OP_KEYPAD_READ = 0, //mask written, result read back
+  I2C_OP_EXPANDER_READ,
+  I2C_OP_EXPANDER_WRITE,
+  I2C_OP_ERROR = 0x80 //or'ed in when the transaction failed
+};
+
+struct I2CTraceRecord{
+  uint32_t cycles; //ESP.getCycleCount() at the start of the transaction
+  uint32_t millis;
+  uint16_t durationCycles; //saturates at 65535 (0.8ms at 80MHz)
+  uint8_t address;
+  uint8_t mask;
+  uint8_t result;
+  uint8_t op;
+  uint16_t reserved;
+};
+
+#ifdef I2C_TRACE
+  #define I2C_TRACE_START() uint32_t i2cTraceStart = ESP.getCycleCount()
+  #define I2C_TRACE_RECORD(address, mask, result, op) I2CTraceAdd(i2cTraceStart, address, mask, result, op)
+#else
+  #define I2C_TRACE_START()
+  #define I2C_TRACE_RECORD(address, mask, result, op)
+#endif
+
+void I2CTraceAdd(uint32_t startCycles, uint8_t address, uint8_t mask, uint8_t result, uint8_t op);
+uint16_t I2CTraceCount();
+void I2CTraceDump(Print& out);
+class AsyncWebServer;
+void SetupI2CTrace(AsyncWebServer* server);
+
+//replay side
+bool I2CReplayLoad(const char* path);
+//next recorded transaction for address, false when the trace is exhausted
+bool I2CReplayNext(uint8_t address, uint8_t mask, uint8_t* result);
+uint32_t I2CReplayMillis();
+bool I2CReplayDone();
+uint32_t I2CReplayMaskMismatches();
+uint64_t I2CReplayBusCycles(); //recorded bus time of the keypad transactions replayed so far
+
+#endif
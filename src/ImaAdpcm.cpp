@@ -0,0 +1,51 @@
+#include "ImaAdpcm.h"
+
+const uint16_t imaStepTable[IMA_STEP_INDEX_MAX + 1] PROGMEM = {
+  7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+  50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+  337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+  2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+  15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+
+const int8_t imaIndexTable[16] = {
+  -1, -1, -1, -1, 2, 4, 6, 8,
+  -1, -1, -1, -1, 2, 4, 6, 8
+};
+
+//successive approximation of the difference in step, step/2 and step/4, the predictor follows
+//with the same sum the decoder builds, so rounding errors never accumulate
+uint8_t ImaAdpcmEncoder::encode(int16_t sample)
+{
+  int32_t step = pgm_read_word(&imaStepTable[stepIndex]);
+  int32_t diff = sample - predictor;
+  uint8_t nibble = 0;
+  if (diff < 0){
+    nibble = 8;
+    diff = -diff;
+  }
+  int32_t delta = step >> 3;
+  if (diff >= step){
+    nibble |= 4;
+    diff -= step;
+    delta += step;
+  }
+  step >>= 1;
+  if (diff >= step){
+    nibble |= 2;
+    diff -= step;
+    delta += step;
+  }
+  step >>= 1;
+  if (diff >= step){
+    nibble |= 1;
+    delta += step;
+  }
+  int32_t next = predictor + ((nibble & 8) ? -delta : delta);
+  if (next > 32767) next = 32767;
+  else if (next < -32768) next = -32768;
+  predictor = next;
+  int8_t index = stepIndex + imaIndexTable[nibble];
+  stepIndex = index < 0 ? 0 : (index > IMA_STEP_INDEX_MAX ? IMA_STEP_INDEX_MAX : index);
+  return nibble;
+}
@@ -0,0 +1,21 @@
+#ifndef IMAADPCM_H_
+#define IMAADPCM_H_
+
+#include <Arduino.h>
+
+//IMA-ADPCM as used in WAV files (format 0x11): 4 bits per sample, the step size adapts from
+//the table below. Decoding lives in WavGenerator, the encoder is used for voice messages.
+#define IMA_STEP_INDEX_MAX 88
+
+extern const uint16_t imaStepTable[IMA_STEP_INDEX_MAX + 1] PROGMEM;
+extern const int8_t imaIndexTable[16];
+
+//fixed-point encoder for one channel, the reconstruction is bit-exact with the decoder
+struct ImaAdpcmEncoder{
+  int16_t predictor = 0;
+  uint8_t stepIndex = 0;
+
+  uint8_t encode(int16_t sample);
+};
+
+#endif
@@ -0,0 +1,243 @@
+#include "IvrMenu.h"
+#include <SD.h>
+#include <ArduinoJson.h>
+#include <CRC32.h>
+#include "Log.h"
+
+#define MENU_TABLE_TMP_PATH "/menu.tmp"
+
+static const MenuAction noAction = {MENU_NONE, 0, 0};
+
+//Runs twice over the same menus in the same order: the first pass writes the records and
+//hands out string offsets, the second writes the strings at exactly those offsets.
+struct MenuCompiler{
+  JsonObjectConst menus;
+  File out;
+  bool writeStrings;
+  uint32_t stringBytes;
+  bool ok;
+
+  uint16_t string(const char *name){
+    size_t len = strlen(name);
+    if (!len || len >= MENU_NAME_MAX || stringBytes + len + 1 >= MENU_NO_STRING){
+      LOG_ERROR("menu.json: bad name '%s'", name);
+      ok = false;
+      return MENU_NO_STRING;
+    }
+    if (writeStrings) out.write((const uint8_t *)name, len + 1);
+    uint16_t offset = stringBytes;
+    stringBytes += len + 1;
+    return offset;
+  }
+
+  int menuIndex(const char *name){
+    int index = 0;
+    for (JsonPairConst menu : menus){
+      if (strcmp(menu.key().c_str(), name) == 0) return index;
+      index++;
+    }
+    LOG_ERROR("menu.json: no menu '%s'", name);
+    ok = false;
+    return -1;
+  }
+
+  MenuAction action(JsonVariantConst definition){
+    MenuAction action = noAction;
+    if (definition.isNull()) return action;
+    if (definition["play"].is<const char *>()){
+      action.type = MENU_PLAY;
+      action.arg = string(definition["play"]);
+    }
+    else if (definition["goto"].is<const char *>()){
+      action.type = MENU_GOTO;
+      action.arg = menuIndex(definition["goto"]);
+    }
+    else if (definition.containsKey("record")){
+      action.type = MENU_RECORD;
+      action.arg = definition["record"].is<const char *>() ? string(definition["record"]) : MENU_NO_STRING;
+    }
+    else if (definition.containsKey("dial")){
+      action.type = MENU_DIAL;
+    }
+    else {
+      LOG_ERROR("menu.json: unknown action");
+      ok = false;
+    }
+    return action;
+  }
+
+  void menu(JsonObjectConst definition){
+    MenuRecord record;
+    memset(&record, 0, sizeof(record));
+    record.prompt = definition["prompt"].is<const char *>() ? string(definition["prompt"]) : MENU_NO_STRING;
+    JsonObjectConst keys = definition["keys"];
+    for (JsonPairConst key : keys){
+      if (strlen(key.key().c_str()) != 1 || !strchr(MENU_KEY_CHARS, key.key().c_str()[0])){
+        LOG_ERROR("menu.json: no key '%s' on a phone", key.key().c_str());
+        ok = false;
+      }
+    }
+    for (uint8_t slot = 0; slot < MENU_KEY_COUNT; slot++){
+      char key[2] = {MENU_KEY_CHARS[slot], 0};
+      record.keys[slot] = action(keys[key]);
+    }
+    record.timeoutSeconds = definition["timeout"] | 0;
+    record.onTimeout = action(definition["onTimeout"]);
+    if (!writeStrings) out.write((const uint8_t *)&record, sizeof(record));
+  }
+};
+
+bool IvrMenu::_compile(uint32_t sourceCrc)
+{
+  File json = SD.open(MENU_JSON_PATH, FILE_READ);
+  if (!json) return false;
+  //the document only lives during the compile, the rest of the boot has the heap back
+  size_t capacity = json.size() * 2 + 1024;
+  if (capacity + 4096 > ESP.getMaxFreeBlockSize()){
+    LOG_ERROR("menu.json: %u bytes is too big to compile", json.size());
+    json.close();
+    return false;
+  }
+  DynamicJsonDocument doc(capacity);
+  DeserializationError error = deserializeJson(doc, json);
+  json.close();
+  if (error){
+    LOG_ERROR("menu.json: %s", error.c_str());
+    return false;
+  }
+
+  MenuCompiler compiler;
+  compiler.menus = doc["menus"];
+  compiler.ok = true;
+  size_t count = compiler.menus.size();
+  if (!count || count > MENU_MAX_MENUS){
+    LOG_ERROR("menu.json: %u menus", count);
+    return false;
+  }
+  int startMenu = doc["start"].is<const char *>() ? compiler.menuIndex(doc["start"]) : 0;
+  if (startMenu < 0) return false;
+
+  MenuTableHeader header;
+  memcpy(header.magic, "LDM1", 4);
+  header.sourceCrc = sourceCrc;
+  header.menuCount = count;
+  header.startMenu = startMenu;
+  header.stringsOffset = sizeof(MenuTableHeader) + count * sizeof(MenuRecord);
+  compiler.out = LittleFS.open(MENU_TABLE_TMP_PATH, "w");
+  if (!compiler.out) return false;
+  compiler.out.write((const uint8_t *)&header, sizeof(header));
+  for (int pass = 0; pass < 2 && compiler.ok; pass++){
+    compiler.writeStrings = pass == 1;
+    compiler.stringBytes = 0;
+    for (JsonPairConst menu : compiler.menus) compiler.menu(menu.value());
+  }
+  size_t size = compiler.out.size();
+  compiler.out.close();
+  if (!compiler.ok || size != header.stringsOffset + compiler.stringBytes){
+    LittleFS.remove(MENU_TABLE_TMP_PATH);
+    return false;
+  }
+  LittleFS.remove(MENU_TABLE_PATH);
+  if (!LittleFS.rename(MENU_TABLE_TMP_PATH, MENU_TABLE_PATH)) return false;
+  LOG_INFO("Compiled %u menus into a %u byte table", count, size);
+  return true;
+}
+
+bool IvrMenu::_openTable(uint32_t sourceCrc)
+{
+  _table = LittleFS.open(MENU_TABLE_PATH, "r");
+  if (!_table) return false;
+  if (_table.read((uint8_t *)&_header, sizeof(_header)) == sizeof(_header) &&
+      memcmp(_header.magic, "LDM1", 4) == 0 && _header.sourceCrc == sourceCrc && _header.menuCount &&
+      _header.startMenu < _header.menuCount &&
+      _header.stringsOffset == sizeof(MenuTableHeader) + _header.menuCount * sizeof(MenuRecord) &&
+      _table.size() >= _header.stringsOffset) return true;
+  _table.close();
+  return false;
+}
+
+bool IvrMenu::begin()
+{
+  _active = false;
+  File json = SD.open(MENU_JSON_PATH, FILE_READ);
+  if (!json) return false;
+  CRC32 crc;
+  uint8_t buffer[256];
+  int len;
+  while ((len = json.read(buffer, sizeof(buffer))) > 0) crc.update(buffer, len);
+  json.close();
+  uint32_t sourceCrc = crc.finalize();
+
+  if (!LittleFS.begin()){
+    LOG_ERROR("LittleFS not available, no menus");
+    return false;
+  }
+  if (!_openTable(sourceCrc) && !(_compile(sourceCrc) && _openTable(sourceCrc))) return false;
+  _active = true;
+  return true;
+}
+
+bool IvrMenu::isActive()
+{
+  return _active;
+}
+
+MenuAction IvrMenu::start(uint32_t nowMillis)
+{
+  return enter(_header.startMenu, nowMillis);
+}
+
+MenuAction IvrMenu::enter(uint16_t menu, uint32_t nowMillis)
+{
+  if (!_active || menu >= _header.menuCount) return noAction;
+  if (!_table.seek(sizeof(MenuTableHeader) + menu * sizeof(MenuRecord)) ||
+      _table.read((uint8_t *)&_current, sizeof(_current)) != sizeof(_current)){
+    LOG_ERROR("Cannot read menu %u", menu);
+    return noAction;
+  }
+  _menu = menu;
+  _lastEventMillis = nowMillis;
+  if (_current.prompt == MENU_NO_STRING) return noAction;
+  MenuAction prompt = {MENU_PLAY, 0, _current.prompt};
+  return prompt;
+}
+
+MenuAction IvrMenu::key(char c, uint32_t nowMillis)
+{
+  const char *slot = c ? strchr(MENU_KEY_CHARS, c) : NULL;
+  if (!_active || !slot) return noAction;
+  _lastEventMillis = nowMillis;
+  return _current.keys[slot - MENU_KEY_CHARS];
+}
+
+MenuAction IvrMenu::poll(uint32_t nowMillis, bool audioBusy)
+{
+  if (!_active || !_current.timeoutSeconds) return noAction;
+  if (audioBusy){
+    _lastEventMillis = nowMillis;
+    return noAction;
+  }
+  if (nowMillis - _lastEventMillis < _current.timeoutSeconds * 1000UL) return noAction;
+  _lastEventMillis = nowMillis;
+  return _current.onTimeout;
+}
+
+bool IvrMenu::getString(uint16_t offset, char *name, size_t size)
+{
+  name[0] = '\0';
+  if (!_active || offset == MENU_NO_STRING || !_table.seek(_header.stringsOffset + offset)) return false;
+  int len = _table.read((uint8_t *)name, min(size - 1, (size_t)MENU_NAME_MAX));
+  if (len <= 0) return false;
+  name[len] = '\0';
+  return name[0] != '\0';
+}
+
+uint16_t IvrMenu::getMenu()
+{
+  return _menu;
+}
+
+uint16_t IvrMenu::getMenuCount()
+{
+  return _active ? _header.menuCount : 0;
+}
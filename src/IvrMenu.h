@@ -0,0 +1,99 @@
+#ifndef IVRMENU_H_
+#define IVRMENU_H_
+
+#include <Arduino.h>
+#include <LittleFS.h>
+
+//Voice menus from /menu.json on the SD card. Without the file the phone dials as it always did.
+//
+//  {
+//    "start": "main",
+//    "menus": {
+//      "main": {
+//        "prompt": "welcome",                 sample played when the menu is entered
+//        "timeout": 10,                       seconds without a key before onTimeout runs
+//        "onTimeout": {"goto": "main"},
+//        "keys": {
+//          "1": {"play": "history"},          play /history.wav or .mp3, stay in the menu
+//          "2": {"goto": "games"},            enter another menu
+//          "9": {"record": "leavemessage"},   voice message after the (optional) greeting
+//          "0": {"dial": true}                free dialing of sample numbers as without menus
+//        }
+//      }
+//    }
+//  }
+//
+//At boot the JSON is compiled into a flat table in LittleFS (MENU_TABLE_PATH), and only
+//recompiled when the crc of menu.json changes. At runtime the menu being used is the only
+//record in RAM: a key is an array lookup in it, entering a menu one read from flash, so
+//the size of the menu tree costs no heap once the phone is up.
+
+#define MENU_JSON_PATH "/menu.json" //on the SD card
+#define MENU_TABLE_PATH "/menu.bin" //in LittleFS
+#define MENU_KEY_CHARS "0123456789*#ABCD" //slot of every key in a menu record
+#define MENU_KEY_COUNT 16
+#define MENU_MAX_MENUS 255
+#define MENU_NAME_MAX 24 //sample and menu names, with the terminating 0
+#define MENU_NO_STRING 0xFFFF
+
+enum MenuActionType{
+  MENU_NONE = 0,
+  MENU_PLAY, //arg: sample name
+  MENU_GOTO, //arg: menu index
+  MENU_RECORD, //arg: greeting sample name or MENU_NO_STRING
+  MENU_DIAL
+};
+
+struct MenuAction{
+  uint8_t type;
+  uint8_t reserved;
+  uint16_t arg;
+};
+
+//one state of the table, the file holds a MenuTableHeader, the records and the strings
+struct MenuRecord{
+  MenuAction keys[MENU_KEY_COUNT];
+  MenuAction onTimeout;
+  uint16_t prompt; //sample name or MENU_NO_STRING
+  uint16_t timeoutSeconds; //0: no timeout
+};
+
+struct MenuTableHeader{
+  char magic[4]; //"LDM1"
+  uint32_t sourceCrc; //crc32 of the menu.json this table was compiled from
+  uint16_t menuCount;
+  uint16_t startMenu;
+  uint32_t stringsOffset;
+};
+
+class IvrMenu
+{
+public:
+  //compiles menu.json when needed and opens the table, false when there are no menus
+  bool begin();
+  bool isActive();
+  //enters the start menu, or a menu of the table. Returns MENU_PLAY of its prompt.
+  MenuAction start(uint32_t nowMillis);
+  MenuAction enter(uint16_t menu, uint32_t nowMillis);
+  MenuAction key(char c, uint32_t nowMillis);
+  //onTimeout of the current menu once its timeout has passed, MENU_NONE otherwise.
+  //The timeout counts from the last key or from the end of the sample that played.
+  MenuAction poll(uint32_t nowMillis, bool audioBusy);
+  //sample name of a MENU_PLAY/MENU_RECORD arg or a prompt, false for MENU_NO_STRING
+  bool getString(uint16_t offset, char *name, size_t size);
+  uint16_t getMenu();
+  uint16_t getMenuCount();
+
+protected:
+  bool _compile(uint32_t sourceCrc);
+  bool _openTable(uint32_t sourceCrc);
+
+  bool _active = false;
+  File _table;
+  MenuTableHeader _header;
+  MenuRecord _current;
+  uint16_t _menu = 0;
+  uint32_t _lastEventMillis = 0;
+};
+
+#endif
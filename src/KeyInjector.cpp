@@ -0,0 +1,157 @@
+#include "KeyInjector.h"
+#include <ESPAsyncWebServer.h>
+
+enum InjectedEventType{
+  INJECT_KEY = 0,
+  INJECT_HOOK
+};
+
+enum InjectedEventState{
+  INJECT_FREE = 0,
+  INJECT_QUEUED,
+  INJECT_APPLIED,
+  INJECT_DONE,
+  INJECT_NO_AUDIO,
+  INJECT_DROPPED //the key never reached the keypad code in loop()
+};
+
+struct InjectedEvent{
+  uint32_t id;
+  uint8_t type;
+  uint8_t state;
+  int8_t value; //key character or InjectedHook
+  uint32_t appliedMicros;
+  uint32_t latencyMicros;
+};
+
+//one ring for queue and results, a slot is reused once KEYINJECT_QUEUE_SIZE newer events exist
+static InjectedEvent events[KEYINJECT_QUEUE_SIZE];
+static uint32_t nextId = 1;
+static uint32_t nextToApply = 1;
+static InjectedHook injectedHook = HOOK_REAL;
+static PhoneKeypad* injectKeypad = NULL;
+static uint32_t landingId = 0; //key event handed to the keypad, until the next poll
+
+static InjectedEvent* eventById(uint32_t id){
+  InjectedEvent* event = &events[id % KEYINJECT_QUEUE_SIZE];
+  return (event->id == id && event->state != INJECT_FREE) ? event : NULL;
+}
+
+#ifdef KEY_INJECT
+static const char* eventStateString(uint8_t state){
+  switch (state){
+    case INJECT_QUEUED: return "queued";
+    case INJECT_APPLIED: return "applied";
+    case INJECT_DONE: return "done";
+    case INJECT_NO_AUDIO: return "no_audio";
+    case INJECT_DROPPED: return "dropped";
+  }
+  return "unknown";
+}
+
+static void onInjectPost(AsyncWebServerRequest* request){
+  //an event that was not applied yet would be overwritten
+  if (nextId - nextToApply >= KEYINJECT_QUEUE_SIZE){
+    request->send(503, "text/plain", "queue full");
+    return;
+  }
+  InjectedEvent* event = &events[nextId % KEYINJECT_QUEUE_SIZE];
+  if (request->hasParam("key")){
+    String key = request->getParam("key")->value();
+    if (key.length() != 1){
+      request->send(400, "text/plain", "key must be one character");
+      return;
+    }
+    event->type = INJECT_KEY;
+    event->value = (int8_t)key[0];
+  }
+  else if (request->hasParam("hook")){
+    String hook = request->getParam("hook")->value();
+    event->type = INJECT_HOOK;
+    if (hook == "up") event->value = HOOK_UP;
+    else if (hook == "down") event->value = HOOK_DOWN;
+    else if (hook == "real") event->value = HOOK_REAL;
+    else {
+      request->send(400, "text/plain", "hook must be up, down or real");
+      return;
+    }
+  }
+  else {
+    request->send(400, "text/plain", "key or hook parameter needed");
+    return;
+  }
+  event->id = nextId++;
+  event->state = INJECT_QUEUED;
+  event->latencyMicros = 0;
+  char json[24];
+  snprintf(json, sizeof(json), "{\"id\":%u}", event->id);
+  request->send(200, "application/json", json);
+}
+
+static void onInjectGet(AsyncWebServerRequest* request){
+  if (!request->hasParam("id")){
+    request->send(400, "text/plain", "id parameter needed");
+    return;
+  }
+  InjectedEvent* event = eventById(strtoul(request->getParam("id")->value().c_str(), NULL, 10));
+  if (!event){
+    request->send(404, "text/plain", "unknown or expired id");
+    return;
+  }
+  char json[80];
+  snprintf(json, sizeof(json), "{\"id\":%u,\"state\":\"%s\",\"latency_us\":%u}", event->id, eventStateString(event->state), event->latencyMicros);
+  request->send(200, "application/json", json);
+}
+
+#endif
+
+void SetupKeyInjection(AsyncWebServer* server, PhoneKeypad* keypad){
+#ifdef KEY_INJECT
+  injectKeypad = keypad;
+  server->on("/inject", HTTP_POST, onInjectPost);
+  server->on("/inject", HTTP_GET, onInjectGet);
+#else
+  (void)server;
+  (void)keypad;
+#endif
+}
+
+bool KeyInjectPoll(uint32_t* eventMicros){
+  //a key the loop did not read, with the horn down or while recording, must not turn up later
+  if (landingId){
+    InjectedEvent* landing = eventById(landingId);
+    if (injectKeypad->dropInjectedChar() && landing) landing->state = INJECT_DROPPED;
+    landingId = 0;
+  }
+  if (nextToApply == nextId) return false;
+  InjectedEvent* event = &events[nextToApply % KEYINJECT_QUEUE_SIZE];
+  nextToApply++;
+  //the previous event is answered now, whatever it started has had its chance
+  InjectedEvent* previous = eventById(event->id - 1);
+  if (previous && previous->state == INJECT_APPLIED) previous->state = INJECT_NO_AUDIO;
+
+  if (event->type == INJECT_KEY){
+    if (!injectKeypad || !injectKeypad->injectChar((char)event->value)){
+      event->state = INJECT_DROPPED;
+      return false;
+    }
+    landingId = event->id;
+  }
+  else injectedHook = (InjectedHook)event->value;
+  event->appliedMicros = micros();
+  event->state = INJECT_APPLIED;
+  *eventMicros = event->appliedMicros;
+  return true;
+}
+
+InjectedHook GetInjectedHook(){
+  return injectedHook;
+}
+
+void KeyInjectAudioStarted(uint32_t eventMicros, uint32_t audioMicros){
+  if (nextToApply == 1) return;
+  InjectedEvent* event = eventById(nextToApply - 1);
+  if (!event || event->state != INJECT_APPLIED || event->appliedMicros != eventMicros) return;
+  event->latencyMicros = audioMicros - eventMicros;
+  event->state = INJECT_DONE;
+}
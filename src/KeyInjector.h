@@ -0,0 +1,36 @@
+#ifndef KEYINJECTOR_H_
+#define KEYINJECTOR_H_
+
+#include <Arduino.h>
+#include "PhoneKeypad.h"
+
+//Remote key and hook events for automated latency and load tests.
+//
+//  POST /inject?key=5               press a key, answers {"id":12}
+//  POST /inject?hook=up|down|real   lift or hang up the horn, real gives the hook back to the switch
+//  GET  /inject?id=12               {"id":12,"state":"done","latency_us":41250}
+//
+//Events are queued and applied from loop() through the same keyChange path as the keypad
+//interrupt, keys without the keypad debounce, so they can come at any rate.
+//state is "queued", "applied" (no audio yet), "done", "no_audio" or "dropped" (not in the
+//key map, or the loop did not read it: horn down or recording).
+//tools/key_driver.py replays dialing scripts against it.
+//Anyone on the network could dial the maintenance codes this way, so the endpoint only exists
+//in builds with -DKEY_INJECT (d1_mini_keyinject and the test environments that drive it).
+#define KEYINJECT_QUEUE_SIZE 32
+
+enum InjectedHook{
+  HOOK_REAL = -1,
+  HOOK_DOWN = 0,
+  HOOK_UP = 1
+};
+
+class AsyncWebServer;
+void SetupKeyInjection(AsyncWebServer* server, PhoneKeypad* keypad);
+//applies the next queued event, returns true and its timestamp when the caller should handle a keyChange
+bool KeyInjectPoll(uint32_t* eventMicros);
+InjectedHook GetInjectedHook();
+//to be called when the first audible sample of a play started by the event at eventMicros is output
+void KeyInjectAudioStarted(uint32_t eventMicros, uint32_t audioMicros);
+
+#endif
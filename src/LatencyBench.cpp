@@ -0,0 +1,78 @@
+#include "LatencyBench.h"
+#include <ESPAsyncWebServer.h>
+
+static const char* const phaseNames[LAT_PHASE_COUNT] = {"scan", "open", "id3", "sync", "i2s"};
+
+static uint32_t presses[LATENCY_BENCH_PRESSES][LAT_PHASE_COUNT];
+static uint32_t pressTotal = 0;
+static uint32_t current[LAT_PHASE_COUNT];
+static uint32_t lastMarkMicros = 0;
+static bool active = false;
+
+void LatencyStart(uint32_t keyMicros){
+  memset(current, 0, sizeof(current));
+  lastMarkMicros = keyMicros;
+  active = true;
+}
+
+void LatencyMark(LatencyPhase phase){
+  if (!active) return;
+  uint32_t now = micros();
+  current[phase] += now - lastMarkMicros;
+  lastMarkMicros = now;
+}
+
+void LatencyFinish(uint32_t bufferedMicros){
+  if (!active) return;
+  LatencyMark(LAT_SYNC);
+  current[LAT_I2S] = bufferedMicros;
+  memcpy(presses[pressTotal % LATENCY_BENCH_PRESSES], current, sizeof(current));
+  pressTotal++;
+  active = false;
+}
+
+uint16_t LatencyPressCount(){
+  return pressTotal < LATENCY_BENCH_PRESSES ? pressTotal : LATENCY_BENCH_PRESSES;
+}
+
+//phase LAT_PHASE_COUNT is the total
+static uint32_t pressValue(uint16_t press, uint8_t phase){
+  if (phase < LAT_PHASE_COUNT) return presses[press][phase];
+  uint32_t total = 0;
+  for (uint8_t i = 0; i < LAT_PHASE_COUNT; i++) total += presses[press][i];
+  return total;
+}
+
+static void printMillis(Print& out, uint32_t micros){
+  out.printf("%6u.%u", micros / 1000, micros % 1000 / 100);
+}
+
+void LatencyReport(Print& out){
+  uint16_t count = LatencyPressCount();
+  out.printf("key to sound, last %u of %u presses, ms\n", count, pressTotal);
+  if (!count) return;
+  out.printf("%-6s%8s%8s%8s%8s\n", "phase", "p50", "p95", "p99", "max");
+  uint32_t sorted[LATENCY_BENCH_PRESSES];
+  for (uint8_t phase = 0; phase <= LAT_PHASE_COUNT; phase++){
+    //insertion sort, 64 values
+    for (uint16_t i = 0; i < count; i++){
+      uint32_t value = pressValue(i, phase);
+      uint16_t j = i;
+      for (; j > 0 && sorted[j - 1] > value; j--) sorted[j] = sorted[j - 1];
+      sorted[j] = value;
+    }
+    out.printf("%-6s", phase < LAT_PHASE_COUNT ? phaseNames[phase] : "total");
+    static const uint8_t percentiles[] = {50, 95, 99};
+    for (uint8_t p : percentiles) printMillis(out, sorted[(p * (count - 1) + 50) / 100]);
+    printMillis(out, sorted[count - 1]);
+    out.println();
+  }
+}
+
+void SetupLatencyBench(AsyncWebServer* server){
+  server->on("/latency", HTTP_GET, [](AsyncWebServerRequest* request){
+    AsyncResponseStream* response = request->beginResponseStream("text/plain");
+    LatencyReport(*response);
+    request->send(response);
+  });
+}
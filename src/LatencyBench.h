@@ -0,0 +1,34 @@
+#ifndef LATENCYBENCH_H_
+#define LATENCYBENCH_H_
+
+#include <Arduino.h>
+
+//Splits the time from a key interrupt to the first audible sound into phases and keeps
+//the last LATENCY_BENCH_PRESSES presses for percentiles.
+//  GET /latency     p50/p95/p99 per phase in ms
+//
+//A mark charges the time since the previous mark to its phase, so the phases always add
+//up to the total and work done twice (a digit that is replaced by a longer number) is
+//charged to the phase it belongs to. Drive it with tools/key_driver.py for scripted presses.
+#define LATENCY_BENCH_PRESSES 64
+
+enum LatencyPhase{
+  LAT_SCAN = 0, //interrupt until the keypad has been read over I2C
+  LAT_OPEN,     //sample lookup and SD open
+  LAT_ID3,      //decoder start and ID3 tag parse, until the first audio data is read
+  LAT_SYNC,     //frame sync and decode up to the first non-silent sample
+  LAT_I2S,      //samples queued in the DMA buffers ahead of that sample
+  LAT_PHASE_COUNT
+};
+
+void LatencyStart(uint32_t keyMicros);
+void LatencyMark(LatencyPhase phase);
+//first non-silent sample handed to the I2S output, bufferedMicros of audio still ahead of it
+void LatencyFinish(uint32_t bufferedMicros);
+uint16_t LatencyPressCount();
+void LatencyReport(Print& out);
+
+class AsyncWebServer;
+void SetupLatencyBench(AsyncWebServer* server);
+
+#endif
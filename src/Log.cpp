@@ -0,0 +1,120 @@
+#include "Log.h"
+#ifdef LOG_TO_SD
+#include <SD.h>
+#endif
+
+//indices run freely and are masked on access, head - tail is the number of bytes waiting
+static char ring[LOG_BUFFER_SIZE];
+static volatile uint32_t head = 0;
+static volatile uint32_t serialTail = 0;
+#ifdef LOG_TO_SD
+static volatile uint32_t sdTail = 0;
+#endif
+static LogStats stats;
+LogPrint LogOutput;
+
+static uint32_t slowestTail(){
+#ifdef LOG_TO_SD
+  return (int32_t)(sdTail - serialTail) < 0 ? sdTail : serialTail;
+#else
+  return serialTail;
+#endif
+}
+
+void LogWrite(const char* text, size_t len){
+  uint32_t used = head - slowestTail();
+  if (len > LOG_BUFFER_SIZE - used){
+    stats.dropped++;
+    return;
+  }
+  uint32_t at = head;
+  for (size_t i = 0; i < len; i++) ring[(at + i) & (LOG_BUFFER_SIZE - 1)] = text[i];
+  //publish only once the bytes are in
+  head = at + len;
+  stats.messages++;
+  if (used + len > stats.highWater) stats.highWater = used + len;
+}
+
+void LogPrintf_P(PGM_P format, ...){
+  char line[LOG_LINE_MAX];
+  int prefix = snprintf(line, sizeof(line), "%u ", (unsigned)millis());
+  va_list args;
+  va_start(args, format);
+  int len = vsnprintf_P(line + prefix, sizeof(line) - prefix, format, args);
+  va_end(args);
+  if (len < 0) return;
+  len += prefix;
+  if (len >= (int)sizeof(line)){
+    stats.truncated++;
+    len = sizeof(line) - 1;
+    line[len - 1] = '\n';
+  }
+  LogWrite(line, len);
+}
+
+//the waiting bytes from tail on, in at most two pieces because of the wrap
+static size_t contiguous(uint32_t tail, const char** start){
+  uint32_t offset = tail & (LOG_BUFFER_SIZE - 1);
+  *start = ring + offset;
+  return min((uint32_t)(head - tail), (uint32_t)(LOG_BUFFER_SIZE - offset));
+}
+
+#ifdef LOG_TO_SD
+static void pumpSD(){
+  const char* start;
+  size_t len = contiguous(sdTail, &start);
+  if (!len) return;
+  File file = SD.open(LOG_SD_PATH, FILE_WRITE);
+  if (!file) return;
+  while (len){
+    file.write((const uint8_t*)start, len);
+    sdTail += len;
+    len = contiguous(sdTail, &start);
+  }
+  file.close();
+}
+#endif
+
+void LogPump(bool audioBusy){
+  const char* start;
+  size_t len = contiguous(serialTail, &start);
+  if (len){
+    //only what fits in the UART fifo, Serial.write() would wait for the rest
+    size_t room = Serial.availableForWrite();
+    if (room) serialTail += Serial.write((const uint8_t*)start, min(len, room));
+  }
+#ifdef LOG_TO_SD
+  if (!audioBusy) pumpSD();
+#else
+  (void)audioBusy;
+#endif
+}
+
+void LogFlush(){
+  const char* start;
+  size_t len;
+  while ((len = contiguous(serialTail, &start))) serialTail += Serial.write((const uint8_t*)start, len);
+  Serial.flush();
+#ifdef LOG_TO_SD
+  pumpSD();
+#endif
+}
+
+uint32_t LogPendingBytes(){
+  return head - slowestTail();
+}
+
+const LogStats* GetLogStats(){
+  return &stats;
+}
+
+size_t LogPrint::write(uint8_t c)
+{
+  if (c == '\r') return 1;
+  _line[_length++] = c;
+  if (c == '\n' || _length == sizeof(_line)){
+    LogWrite(_line, _length);
+    _length = 0;
+  }
+  return 1;
+}
@@ -0,0 +1,76 @@
+#ifndef LOG_H_
+#define LOG_H_
+
+#include <Arduino.h>
+
+//Buffered logging. Messages are formatted into a RAM ring and LogPump() drains it from
+//loop() at the rate the UART takes them, so a print never waits for 74880 baud.
+//A message that does not fit is dropped whole and counted.
+//
+//Levels below LOG_LEVEL are compiled out, set it with -DLOG_LEVEL=LOG_LEVEL_DEBUG.
+//With -DLOG_TO_SD the log is also appended to /log.txt, only while no sample plays.
+#define LOG_LEVEL_NONE  0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN  2
+#define LOG_LEVEL_INFO  3
+#define LOG_LEVEL_DEBUG 4
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+#define LOG_BUFFER_SIZE 2048 //power of two
+#define LOG_LINE_MAX 128 //longer messages are cut
+#define LOG_SD_PATH "/log.txt"
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(fmt, ...) LogPrintf_P(PSTR("E " fmt "\n"), ##__VA_ARGS__)
+#else
+#define LOG_ERROR(fmt, ...)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOG_WARN(fmt, ...) LogPrintf_P(PSTR("W " fmt "\n"), ##__VA_ARGS__)
+#else
+#define LOG_WARN(fmt, ...)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(fmt, ...) LogPrintf_P(PSTR("I " fmt "\n"), ##__VA_ARGS__)
+#else
+#define LOG_INFO(fmt, ...)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(fmt, ...) LogPrintf_P(PSTR("D " fmt "\n"), ##__VA_ARGS__)
+#else
+#define LOG_DEBUG(fmt, ...)
+#endif
+
+struct LogStats{
+  uint32_t messages;
+  uint32_t dropped;
+  uint32_t truncated;
+  uint16_t highWater; //most bytes ever waiting in the ring
+};
+
+void LogPrintf_P(PGM_P format, ...) __attribute__((format(printf, 1, 2)));
+void LogWrite(const char* text, size_t len);
+//drains what the UART can take without blocking, call from loop()
+void LogPump(bool audioBusy);
+uint32_t LogPendingBytes();
+//blocks until everything is out, for right before a reset
+void LogFlush();
+const LogStats* GetLogStats();
+
+//Print that ends up in the log one line at a time, for libraries that want a Print (audioLogger)
+class LogPrint : public Print
+{
+public:
+  virtual size_t write(uint8_t c) override;
+
+protected:
+  char _line[LOG_LINE_MAX];
+  uint8_t _length = 0;
+};
+
+extern LogPrint LogOutput;
+
+#endif
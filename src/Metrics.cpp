@@ -0,0 +1,91 @@
+#include "Metrics.h"
+#include <ESPAsyncWebServer.h>
+
+volatile uint32_t metricCounters[MET_COUNTER_COUNT];
+MetricHistogramData metricHistograms[MET_HISTOGRAM_COUNT];
+
+struct MetricInfo{
+  const char* name;
+  const char* help;
+};
+
+static const MetricInfo counterInfo[MET_COUNTER_COUNT] = {
+  {"ledafoon_audio_underruns_total", "I2S DMA ran empty while a sample was playing"},
+  {"ledafoon_audio_frames_total", "Stereo sample frames handed to the I2S output"},
+  {"ledafoon_samples_started_total", "Samples started from the SD card"},
+  {"ledafoon_key_events_total", "Keypad interrupts"}
+};
+
+struct HistogramInfo{
+  const char* name;
+  const char* help;
+  uint8_t bucketCount;
+  uint32_t bounds[METRIC_MAX_BUCKETS];
+};
+
+static const HistogramInfo histogramInfo[MET_HISTOGRAM_COUNT] = {
+  {"ledafoon_key_to_audio_ms", "Time from key interrupt to the first audible sample", 9, {10, 20, 30, 50, 75, 100, 150, 250, 500}},
+  {"ledafoon_sd_read_us", "Duration of one SD read by the decoder", 8, {50, 100, 250, 500, 1000, 2500, 5000, 10000}},
+  {"ledafoon_loop_us", "Duration of one loop() pass", 9, {50, 100, 250, 500, 1000, 2500, 5000, 10000, 50000}},
+  {"ledafoon_record_write_us", "Duration of one SD sector write of a voice message", 9, {500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000}}
+};
+
+struct GaugeInfo{
+  const char* name;
+  const char* help;
+  uint32_t (*fn)();
+};
+
+static GaugeInfo gauges[METRIC_MAX_GAUGES];
+static uint8_t gaugeCount = 0;
+
+void MetricObserve(MetricHistogram histogram, uint32_t value){
+  const HistogramInfo& info = histogramInfo[histogram];
+  MetricHistogramData& data = metricHistograms[histogram];
+  uint8_t i = 0;
+  while (i < info.bucketCount && value > info.bounds[i]) i++;
+  data.buckets[i]++;
+  data.sum += value;
+  data.count++;
+}
+
+void MetricAddGauge(const char* name, const char* help, uint32_t (*fn)()){
+  if (gaugeCount >= METRIC_MAX_GAUGES) return;
+  gauges[gaugeCount].name = name;
+  gauges[gaugeCount].help = help;
+  gauges[gaugeCount].fn = fn;
+  gaugeCount++;
+}
+
+static void printHeader(AsyncResponseStream* response, const char* name, const char* help, const char* type){
+  response->printf("# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+static void onMetrics(AsyncWebServerRequest* request){
+  AsyncResponseStream* response = request->beginResponseStream("text/plain; version=0.0.4");
+  for (uint8_t i = 0; i < MET_COUNTER_COUNT; i++){
+    printHeader(response, counterInfo[i].name, counterInfo[i].help, "counter");
+    response->printf("%s %u\n", counterInfo[i].name, metricCounters[i]);
+  }
+  for (uint8_t i = 0; i < gaugeCount; i++){
+    printHeader(response, gauges[i].name, gauges[i].help, "gauge");
+    response->printf("%s %u\n", gauges[i].name, gauges[i].fn());
+  }
+  for (uint8_t h = 0; h < MET_HISTOGRAM_COUNT; h++){
+    const HistogramInfo& info = histogramInfo[h];
+    //copy first, the loop keeps observing while we format
+    MetricHistogramData data = metricHistograms[h];
+    printHeader(response, info.name, info.help, "histogram");
+    uint32_t cumulative = 0;
+    for (uint8_t i = 0; i < info.bucketCount; i++){
+      cumulative += data.buckets[i];
+      response->printf("%s_bucket{le=\"%u\"} %u\n", info.name, info.bounds[i], cumulative);
+    }
+    response->printf("%s_bucket{le=\"+Inf\"} %u\n%s_sum %u\n%s_count %u\n", info.name, data.count, info.name, data.sum, info.name, data.count);
+  }
+  request->send(response);
+}
+
+void SetupMetrics(AsyncWebServer* server){
+  server->on("/metrics", HTTP_GET, onMetrics);
+}
@@ -0,0 +1,49 @@
+#ifndef METRICS_H_
+#define METRICS_H_
+
+#include <Arduino.h>
+
+//Fixed registry of counters, gauges and histograms, served as Prometheus text on /metrics.
+//Updating a metric is an add or a short bucket search on a static array, no allocations,
+//so it can be used from loop() and from interrupts.
+
+enum MetricCounter{
+  MET_AUDIO_UNDERRUNS = 0,
+  MET_AUDIO_FRAMES,
+  MET_SAMPLES_STARTED,
+  MET_KEY_EVENTS,
+  MET_COUNTER_COUNT
+};
+
+enum MetricHistogram{
+  MET_KEY_TO_AUDIO_MS = 0,
+  MET_SD_READ_US,
+  MET_LOOP_US,
+  MET_RECORD_WRITE_US,
+  MET_HISTOGRAM_COUNT
+};
+
+#define METRIC_MAX_BUCKETS 10
+#define METRIC_MAX_GAUGES 28
+
+struct MetricHistogramData{
+  uint32_t buckets[METRIC_MAX_BUCKETS + 1]; //last one is +Inf
+  uint32_t sum;
+  uint32_t count;
+};
+
+extern volatile uint32_t metricCounters[MET_COUNTER_COUNT];
+extern MetricHistogramData metricHistograms[MET_HISTOGRAM_COUNT];
+
+inline void IRAM_ATTR MetricInc(MetricCounter counter, uint32_t amount = 1){
+  metricCounters[counter] += amount;
+}
+void MetricObserve(MetricHistogram histogram, uint32_t value);
+
+//gauges are read when /metrics is collected, fn returns the current value
+void MetricAddGauge(const char* name, const char* help, uint32_t (*fn)());
+
+class AsyncWebServer;
+void SetupMetrics(AsyncWebServer* server);
+
+#endif
@@ -0,0 +1,145 @@
+#include "MicSource.h"
+
+extern "C" {
+#include "user_interface.h"
+}
+
+uint16_t MicSource::getQueued()
+{
+  return _head - _tail;
+}
+
+uint32_t MicSource::getOverruns()
+{
+  return _overruns;
+}
+
+static AdcMicSource *activeAdc = NULL;
+
+static void IRAM_ATTR onAdcTimer()
+{
+  activeAdc->sample();
+}
+
+bool AdcMicSource::begin(uint32_t sampleRate)
+{
+  _head = 0;
+  _tail = 0;
+  _overruns = 0;
+  _dcKnown = false;
+  activeAdc = this;
+  timer1_attachInterrupt(onAdcTimer);
+  //timer1 runs from the 80MHz APB clock whatever the cpu clock is
+  timer1_enable(TIM_DIV16, TIM_EDGE, TIM_LOOP);
+  timer1_write(APB_CLK_FREQ / 16 / sampleRate);
+  return true;
+}
+
+void IRAM_ATTR AdcMicSource::sample()
+{
+  uint32_t head = _head;
+  if (head - _tail >= MIC_RING_SAMPLES){
+    _overruns++;
+    return;
+  }
+  _ring[head & (MIC_RING_SAMPLES - 1)] = system_adc_read();
+  _head = head + 1;
+}
+
+uint16_t AdcMicSource::read(int16_t *samples, uint16_t max)
+{
+  uint16_t count = 0;
+  while (count < max && _tail != _head){
+    //10 bit ADC to 16 bit
+    int32_t x = (int32_t)_ring[_tail & (MIC_RING_SAMPLES - 1)] << 6;
+    _tail = _tail + 1;
+    if (!_dcKnown){
+      _dc = x << 8;
+      _dcKnown = true;
+    }
+    int32_t y = x - (_dc >> 8);
+    _dc += y;
+    samples[count++] = y > 32767 ? 32767 : (y < -32768 ? -32768 : y);
+  }
+  return count;
+}
+
+void AdcMicSource::end()
+{
+  timer1_disable();
+  timer1_detachInterrupt();
+  activeAdc = NULL;
+}
+
+FileMicSource::FileMicSource(const char *path)
+{
+  _path = path;
+}
+
+bool FileMicSource::begin(uint32_t sampleRate)
+{
+  _file = SD.open(_path, FILE_READ);
+  if (!_file) return false;
+  uint8_t header[16];
+  if (_file.read(header, 12) != 12 || memcmp(header, "RIFF", 4) != 0 || memcmp(header + 8, "WAVE", 4) != 0){
+    _file.close();
+    return false;
+  }
+  bool pcm = false;
+  while (_file.read(header, 8) == 8){
+    uint32_t size = header[4] | (header[5] << 8) | (header[6] << 16) | ((uint32_t)header[7] << 24);
+    if (memcmp(header, "data", 4) == 0){
+      _dataLeft = size;
+      break;
+    }
+    if (memcmp(header, "fmt ", 4) == 0 && size >= 16 && _file.read(header, 16) == 16){
+      //format 1, one channel, the recording rate, 16 bit
+      pcm = (header[0] | header[1] << 8) == 1 && (header[2] | header[3] << 8) == 1 &&
+        (header[4] | header[5] << 8 | (uint32_t)header[6] << 16) == sampleRate && (header[14] | header[15] << 8) == 16;
+      size -= 16;
+    }
+    _file.seek(size + (size & 1), SeekCur);
+  }
+  if (!pcm || !_dataLeft){
+    _file.close();
+    return false;
+  }
+  _head = 0;
+  _tail = 0;
+  _overruns = 0;
+  _sampleRate = sampleRate;
+  _startMicros = micros();
+  return true;
+}
+
+uint16_t FileMicSource::read(int16_t *samples, uint16_t max)
+{
+  //samples a real mic would have delivered by now
+  _head = (uint64_t)(micros() - _startMicros) * _sampleRate / 1000000;
+  uint32_t queued = _head - _tail;
+  if (queued > MIC_RING_SAMPLES){
+    uint32_t lost = queued - MIC_RING_SAMPLES;
+    _overruns += lost;
+    _tail += lost;
+    lost = min(lost * 2, _dataLeft);
+    _file.seek(lost, SeekCur);
+    _dataLeft -= lost;
+    queued = MIC_RING_SAMPLES;
+  }
+  uint16_t count = min(queued, min((uint32_t)max, _dataLeft / 2));
+  if (!count) return 0;
+  count = _file.read((uint8_t *)samples, count * 2) / 2; //little endian, like the cpu
+  _tail += count;
+  _dataLeft -= count * 2;
+  return count;
+}
+
+void FileMicSource::end()
+{
+  if (_file) _file.close();
+}
+
+bool FileMicSource::isDone()
+{
+  return _dataLeft < 2;
+}
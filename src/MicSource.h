@@ -0,0 +1,67 @@
+#ifndef MICSOURCE_H_
+#define MICSOURCE_H_
+
+#include <Arduino.h>
+#include <SD.h>
+
+//Microphone input for voice messages, 16 bit mono. Samples are collected in the background
+//and fetched from loop() with read(), the queue is what covers a slow SD write.
+#define MIC_RING_SAMPLES 2048 //power of two, 256ms at 8kHz
+
+class MicSource
+{
+public:
+  virtual ~MicSource() {}
+  virtual bool begin(uint32_t sampleRate) = 0;
+  //copies up to max of the samples that arrived since the last call
+  virtual uint16_t read(int16_t *samples, uint16_t max) = 0;
+  virtual void end() = 0;
+  virtual bool isDone() { return false; } //nothing more will arrive
+  uint16_t getQueued(); //samples waiting to be read
+  uint32_t getOverruns(); //samples lost because the queue was full
+
+protected:
+  volatile uint32_t _head = 0;
+  volatile uint32_t _tail = 0;
+  volatile uint32_t _overruns = 0;
+};
+
+//Electret preamp on A0, sampled by a timer1 interrupt. The I2S receiver can not be used,
+//its pins are the SPI pins of the SD card. The ADC only reads this fast with the WiFi off.
+//The preamp bias is removed with a one-pole high-pass (about 5Hz at 8kHz).
+class AdcMicSource : public MicSource
+{
+public:
+  virtual bool begin(uint32_t sampleRate) override;
+  virtual uint16_t read(int16_t *samples, uint16_t max) override;
+  virtual void end() override;
+
+  void IRAM_ATTR sample(); //from the timer interrupt
+
+protected:
+  volatile uint16_t _ring[MIC_RING_SAMPLES];
+  int32_t _dc = 0; //bias of the preamp, 8 fraction bits
+  bool _dcKnown = false;
+};
+
+//Stand-in for the microphone that takes a 16 bit mono WAV from the SD card at the pace of
+//the sample rate, so the encoder and SD writes see the same timing as with a real mic.
+//Samples that a real queue could not have held count as overruns and are skipped.
+class FileMicSource : public MicSource
+{
+public:
+  FileMicSource(const char *path);
+  virtual bool begin(uint32_t sampleRate) override;
+  virtual uint16_t read(int16_t *samples, uint16_t max) override;
+  virtual void end() override;
+  virtual bool isDone() override;
+
+protected:
+  const char *_path;
+  File _file;
+  uint32_t _sampleRate = 0;
+  uint32_t _startMicros = 0;
+  uint32_t _dataLeft = 0; //bytes of samples left in the file
+};
+
+#endif
@@ -0,0 +1,228 @@
+#include "PhoneAudio.h"
+#include <i2s.h>
+#include "Metrics.h"
+#include "LatencyBench.h"
+#include "AllocGate.h"
+#include "AudioCapture.h"
+
+static volatile bool i2sPlaying = false;
+
+//called from the I2S interrupt every time a DMA buffer has been sent
+static void IRAM_ATTR i2sBufferDone(){
+  if (i2sPlaying && i2s_is_empty()) MetricInc(MET_AUDIO_UNDERRUNS);
+}
+
+static uint32_t queuedFrames(){
+  return PHONEAUDIO_DMA_SAMPLES - min((uint32_t)i2s_available() / PHONEAUDIO_WORDS_PER_FRAME, (uint32_t)PHONEAUDIO_DMA_SAMPLES);
+}
+
+PhoneAudioOutput::PhoneAudioOutput() : PhoneAudioBase()
+{
+}
+
+bool PhoneAudioOutput::begin()
+{
+  if (!PhoneAudioBase::begin()) return false;
+  //the I2S driver is set up again on every begin(), so is its callback
+  i2s_set_callback(i2sBufferDone);
+  AudioCaptureBegin();
+  _startSample();
+  return true;
+}
+
+bool PhoneAudioOutput::ConsumeSample(int16_t sample[2])
+{
+  if (!_room() || !PhoneAudioBase::ConsumeSample(sample)) return false;
+  i2sPlaying = true;
+  MetricInc(MET_AUDIO_FRAMES);
+  _adapt(1);
+#ifdef AUDIO_CAPTURE
+  //what the I2S driver was given: mono goes out on both channels
+  int16_t frame[2] = {sample[LEFTCHANNEL], channels == 1 ? sample[LEFTCHANNEL] : sample[RIGHTCHANNEL]};
+  AudioCaptureSample(frame, hertz);
+#endif
+  return true;
+}
+
+uint16_t PhoneAudioOutput::ConsumeSamples(int16_t *samples, uint16_t count)
+{
+  uint32_t start = ESP.getCycleCount();
+#if defined(AUDIO_PER_SAMPLE) || defined(AUDIO_NO_DAC_REFERENCE)
+  uint16_t written = AudioOutput::ConsumeSamples(samples, count);
+#else
+  //anything but 16 bit stereo needs the conversions of ConsumeSample()
+  if (bps != 16 || channels != 2) return AudioOutput::ConsumeSamples(samples, count);
+  count = min((uint32_t)count, _room());
+  uint16_t written = 0;
+  if (gainF2P6 == (1 << 6)){
+    written = _writeBlock(samples, count);
+  }
+  else {
+    int16_t scaled[PHONEAUDIO_GAIN_FRAMES * 2];
+    while (written < count){
+      uint16_t frames = min((uint16_t)(count - written), (uint16_t)PHONEAUDIO_GAIN_FRAMES);
+      const int16_t* in = samples + 2 * written;
+      for (uint16_t i = 0; i < 2 * frames; i++) scaled[i] = Amplify(in[i]);
+      uint16_t done = _writeBlock(scaled, frames);
+      written += done;
+      if (done < frames) break;
+    }
+  }
+  if (written){
+    i2sPlaying = true;
+    MetricInc(MET_AUDIO_FRAMES, written);
+    _adapt(written);
+  }
+#ifdef AUDIO_CAPTURE
+  for (uint16_t i = 0; i < written; i++) AudioCaptureSample(samples + 2 * i, hertz);
+#endif
+#endif
+  _blockCycles += ESP.getCycleCount() - start;
+  _blockFrames += written;
+  return written;
+}
+
+void PhoneAudioOutput::soundQueued(uint32_t framesAfter)
+{
+  if (!_latencyArmed) return;
+  //everything queued ahead of that frame plays before it
+  uint32_t queued = queuedFrames();
+  _audioStarted(queued > framesAfter ? queued - framesAfter - 1 : 0);
+}
+
+void PhoneAudioOutput::_audioStarted(uint32_t queuedFrames)
+{
+  _latencyArmed = false;
+  uint32_t now = micros();
+  MetricObserve(MET_KEY_TO_AUDIO_MS, (now - _latencyStartMicros) / 1000);
+  LatencyFinish(hertz ? (uint64_t)queuedFrames * 1000000 / hertz : 0);
+  AllocGateClose();
+  if (_audioStartCallback) _audioStartCallback(_latencyStartMicros, now);
+}
+
+//16 bit stereo straight into the DMA ring, through the modulator without a DAC
+uint16_t PhoneAudioOutput::_writeBlock(int16_t *frames, uint16_t count)
+{
+#ifdef AUDIO_NO_DAC
+  return writeFrames(frames, count);
+#else
+  return i2s_write_buffer_nb(frames, count);
+#endif
+}
+
+uint32_t PhoneAudioOutput::_room()
+{
+  uint32_t depth = (uint32_t)_buffers * PHONEAUDIO_DMA_BUFFER_FRAMES;
+  uint32_t queued = queuedFrames();
+  return queued < depth ? depth - queued : 0;
+}
+
+//called with the frames just queued
+void PhoneAudioOutput::_adapt(uint16_t frames)
+{
+  _sampleFrames += frames;
+#ifndef AUDIO_STATIC_DEPTH
+  uint32_t underruns = metricCounters[MET_AUDIO_UNDERRUNS];
+  bool longPlay = _sampleFrames >= (uint32_t)hertz * PHONEAUDIO_LONG_PLAY_MILLIS / 1000;
+  if (underruns != _underrunsSeen){
+    _underrunsSeen = underruns;
+    _sampleUnderran = true;
+    if (_buffers < PHONEAUDIO_DMA_BUFFERS) _buffers++;
+    if (!longPlay && _startBuffers < _buffers) _startBuffers = _buffers;
+  }
+  if (longPlay) _buffers = PHONEAUDIO_DMA_BUFFERS;
+#endif
+}
+
+void PhoneAudioOutput::_startSample()
+{
+#ifndef AUDIO_STATIC_DEPTH
+  if (_sampleUnderran) _cleanSamples = 0;
+  else if (_sampleFrames && ++_cleanSamples >= PHONEAUDIO_SHRINK_AFTER){
+    _cleanSamples = 0;
+    if (_startBuffers > PHONEAUDIO_MIN_BUFFERS) _startBuffers--;
+  }
+  _underrunsSeen = metricCounters[MET_AUDIO_UNDERRUNS];
+#endif
+  _sampleUnderran = false;
+  _sampleFrames = 0;
+  _buffers = _startBuffers;
+}
+
+uint32_t PhoneAudioOutput::getDepthFrames()
+{
+  return (uint32_t)_buffers * PHONEAUDIO_DMA_BUFFER_FRAMES;
+}
+
+uint32_t PhoneAudioOutput::getStartDepthFrames()
+{
+  return (uint32_t)_startBuffers * PHONEAUDIO_DMA_BUFFER_FRAMES;
+}
+
+uint32_t PhoneAudioOutput::getCyclesPerSecond()
+{
+  return _blockFrames ? _blockCycles * PHONEAUDIO_CYCLES_RATE / _blockFrames : 0;
+}
+
+bool PhoneAudioOutput::stop()
+{
+  i2sPlaying = false;
+  _latencyArmed = false;
+  //what is queued still plays, the driver zeroes buffers it runs out of. Only as much
+  //silence as a new sample starts with, it plays before that sample.
+  int16_t silence[2] = {0, 0};
+  _buffers = _startBuffers;
+  while (i2sOn && _room() && PhoneAudioBase::ConsumeSample(silence)) {}
+  return true;
+}
+
+bool PhoneAudioOutput::shutdown()
+{
+  i2sPlaying = false;
+  _latencyArmed = false;
+  return PhoneAudioBase::stop();
+}
+
+void PhoneAudioOutput::armLatency(uint32_t startMicros)
+{
+  _latencyStartMicros = startMicros;
+  _latencyArmed = true;
+  _startSample();
+}
+
+void PhoneAudioOutput::setAudioStartCallback(void (*callback)(uint32_t startMicros, uint32_t audioMicros))
+{
+  _audioStartCallback = callback;
+}
+
+bool PhoneFileSource::open(const char *filename)
+{
+  //SDFS allocates the file object on every open, of the same size as the one the
+  //previous close() freed, so it reuses that block
+  AllocGatePause();
+  bool opened = AudioFileSourceSD::open(filename);
+  AllocGateResume();
+  return opened;
+}
+
+uint32_t PhoneFileSource::read(void *data, uint32_t len)
+{
+  uint32_t start = micros();
+  uint32_t read = AudioFileSourceSD::read(data, len);
+  MetricObserve(MET_SD_READ_US, micros() - start);
+  return read;
+}
+
+PhoneID3Source::PhoneID3Source(AudioFileSource *src) : AudioFileSourceID3(src)
+{
+}
+
+uint32_t PhoneID3Source::read(void *data, uint32_t len)
+{
+  uint32_t read = AudioFileSourceID3::read(data, len);
+  if (_firstRead){
+    _firstRead = false;
+    LatencyMark(LAT_ID3);
+  }
+  return read;
+}
@@ -0,0 +1,122 @@
+#ifndef PHONEAUDIO_H_
+#define PHONEAUDIO_H_
+
+#include <Arduino.h>
+#include "AudioFileSourceSD.h"
+#include "AudioFileSourceID3.h"
+#include "AudioOutputI2S.h"
+#include "AudioOutputI2SNoDAC.h"
+#include "DeltaSigma.h"
+
+//the backend on the I2S pins: a DAC, or a speaker on the data pin (-DAUDIO_NO_DAC, or the
+//library's modulator to compare against with -DAUDIO_NO_DAC_REFERENCE)
+#if defined(AUDIO_NO_DAC)
+typedef DeltaSigmaOutput PhoneAudioBase;
+#define PHONEAUDIO_WORDS_PER_FRAME DELTASIGMA_WORDS
+#elif defined(AUDIO_NO_DAC_REFERENCE)
+typedef AudioOutputI2SNoDAC PhoneAudioBase;
+#define PHONEAUDIO_WORDS_PER_FRAME 1 //its default 32x oversampling
+#else
+typedef AudioOutputI2S PhoneAudioBase;
+#define PHONEAUDIO_WORDS_PER_FRAME 1
+#endif
+
+//samples the ESP8266 I2S driver can queue (SLC_BUF_CNT * SLC_BUF_LEN in core i2s.cpp)
+#define PHONEAUDIO_DMA_BUFFERS 8
+#define PHONEAUDIO_DMA_BUFFER_FRAMES (64 / PHONEAUDIO_WORDS_PER_FRAME)
+#define PHONEAUDIO_DMA_SAMPLES (PHONEAUDIO_DMA_BUFFERS * PHONEAUDIO_DMA_BUFFER_FRAMES)
+//adaptive depth, in DMA buffers kept filled ahead of the one playing
+#define PHONEAUDIO_MIN_BUFFERS 2 //1.5ms at 44.1kHz each
+#define PHONEAUDIO_LONG_PLAY_MILLIS 3000 //a sample playing this long gets all buffers
+#define PHONEAUDIO_SHRINK_AFTER 8 //samples in a row without underrun before the start depth shrinks
+#define PHONEAUDIO_GAIN_FRAMES 32 //frames scaled on the stack at a time when the gain is not unity
+#define PHONEAUDIO_CYCLES_RATE 44100 //output cost is reported per second of audio at this rate
+
+//I2S output of the phone. Same as AudioOutputI2S, but keeps the audio metrics: frames,
+//DMA underruns and the time from a key press to the first audible sample.
+//ConsumeSamples() copies blocks of 16 bit stereo frames into the DMA buffers with
+//i2s_write_buffer_nb() instead of one virtual call, gain and DMA write per frame. Built with
+//-DAUDIO_PER_SAMPLE this and MixerVoice go frame by frame as before. getCyclesPerSecond() is
+//the output alone, ledafoon_audio_chain_cycles_per_second in main.cpp the decoders, mixer and
+//output together, which is what the block path has to be compared on.
+//
+//The DMA ring of the core is fixed, but how much of it is filled is not: what is queued
+//plays before a new sample, so a deep queue makes every key press late, a shallow one
+//underruns when loop() stalls on the SD card or I2C. A sample starts at the start depth,
+//goes one buffer deeper on every underrun and to the full ring once it has played for
+//PHONEAUDIO_LONG_PLAY_MILLIS. Underruns early in a sample raise the start depth for the
+//next ones, PHONEAUDIO_SHRINK_AFTER clean samples lower it again. -DAUDIO_STATIC_DEPTH=n
+//keeps n buffers always, to compare against.
+class PhoneAudioOutput : public PhoneAudioBase
+{
+public:
+  PhoneAudioOutput();
+  virtual bool begin() override;
+  virtual bool ConsumeSample(int16_t sample[2]) override;
+  virtual uint16_t ConsumeSamples(int16_t *samples, uint16_t count) override;
+  //keeps the I2S driver running on silence, so the next begin() does not reallocate its DMA buffers
+  virtual bool stop() override;
+  //releases the I2S driver
+  bool shutdown();
+
+  //soundQueued() closes a key-to-audio measurement started at startMicros, and the next
+  //frames are a new sample for the adaptive depth
+  void armLatency(uint32_t startMicros);
+  //the first non-silent frame of the armed sample is in the DMA ring, framesAfter frames
+  //behind it. Reported by the mixer, so a key click mixed over it does not count.
+  void soundQueued(uint32_t framesAfter);
+  //called with the armed start time and the time of the first audible sample
+  void setAudioStartCallback(void (*callback)(uint32_t startMicros, uint32_t audioMicros));
+  //cpu cycles ConsumeSamples() takes for a second of audio at PHONEAUDIO_CYCLES_RATE
+  uint32_t getCyclesPerSecond();
+  //frames kept queued in the DMA ring now and at the start of a sample
+  uint32_t getDepthFrames();
+  uint32_t getStartDepthFrames();
+
+protected:
+  void _audioStarted(uint32_t queuedFrames);
+  uint16_t _writeBlock(int16_t *frames, uint16_t count);
+  uint32_t _room();
+  void _adapt(uint16_t frames);
+  void _startSample();
+
+#ifdef AUDIO_STATIC_DEPTH
+  uint8_t _buffers = AUDIO_STATIC_DEPTH;
+  uint8_t _startBuffers = AUDIO_STATIC_DEPTH;
+#else
+  uint8_t _buffers = PHONEAUDIO_DMA_BUFFERS / 2;
+  uint8_t _startBuffers = PHONEAUDIO_DMA_BUFFERS / 2;
+#endif
+  uint8_t _cleanSamples = 0;
+  bool _sampleUnderran = false;
+  uint32_t _underrunsSeen = 0;
+  uint32_t _sampleFrames = 0;
+
+  uint64_t _blockCycles = 0;
+  uint32_t _blockFrames = 0;
+  bool _latencyArmed = false;
+  uint32_t _latencyStartMicros = 0;
+  void (*_audioStartCallback)(uint32_t startMicros, uint32_t audioMicros) = NULL;
+};
+
+//SD source that times every read for the sd_read_us histogram
+class PhoneFileSource : public AudioFileSourceSD
+{
+public:
+  virtual bool open(const char *filename) override;
+  virtual uint32_t read(void *data, uint32_t len) override;
+};
+
+//ID3 source that marks the end of the tag parse for the latency benchmark. The library's
+//parser cannot be rewound, main.cpp constructs one in place for every sample, see OpenSample().
+class PhoneID3Source : public AudioFileSourceID3
+{
+public:
+  PhoneID3Source(AudioFileSource *src);
+  virtual uint32_t read(void *data, uint32_t len) override;
+
+protected:
+  bool _firstRead = true;
+};
+
+#endif
@@ -6,6 +6,7 @@
 
 
 #include "PhoneKeypad.h"
+#include "I2CTrace.h"
 
 
 PhoneKeypad::PhoneKeypad(const uint8_t deviceAddress, TwoWire *wire)
@@ -64,20 +65,34 @@ uint8_t PhoneKeypad::getDebounce()
 uint8_t PhoneKeypad::readKey()
 {
   //check if debounce conditions met for another read
-  if (_mode == I2C_KEYPAD_5x3) _lastKey =  _readKey5x3();
-  if (_mode == I2C_KEYPAD_6x2) _lastKey = _readKey6x2();
-  if (_mode == I2C_KEYPAD_8x1) _lastKey = _readKey8x1();
+  bool injected = _injectedKey != I2C_KEYPAD_NOKEY;
+  if (injected)
+  {
+    _lastKey = _injectedKey;
+    _injectedKey = I2C_KEYPAD_NOKEY;
+  }
+  else if (_mode == I2C_KEYPAD_NONE) _lastKey = I2C_KEYPAD_NOKEY;
+  else if (_mode == I2C_KEYPAD_5x3) _lastKey = _readKey5x3();
+  else if (_mode == I2C_KEYPAD_6x2) _lastKey = _readKey6x2();
+  else if (_mode == I2C_KEYPAD_8x1) _lastKey = _readKey8x1();
   else _lastKey = _readKey4x4();
   if (_lastKey==I2C_KEYPAD_NOKEY){
     _isPressed = false;
     return _lastKey;
   }
-  if(millis()-_lastPressMillis<_debounceTimeMillis) return I2C_KEYPAD_BOUNCE;
+  //  an injected key has no contact that could bounce
+  if(!injected && _millis()-_lastPressMillis<_debounceTimeMillis) return I2C_KEYPAD_BOUNCE;
   if (_latestCharsDepth && _lastKey<16){
-    _lastPressMillis=millis();
-    _latestChars += _keyMap[_lastKey];
+    _lastPressMillis=_millis();
+    //  drop the oldest char when full
+    if (_latestCharsLength == _latestCharsDepth)
+    {
+      memmove(_latestChars, _latestChars + 1, _latestCharsLength);
+      _latestCharsLength--;
+    }
+    _latestChars[_latestCharsLength++] = _keyMap[_lastKey];
+    _latestChars[_latestCharsLength] = '\0';
     _isPressed = true;
-    if (_latestChars.length()>_latestCharsDepth) _latestChars.remove(0,1);
   }
   return _lastKey;
 }
@@ -103,6 +118,35 @@ bool PhoneKeypad::isConnected()
 }
 
 
+uint32_t PhoneKeypad::getI2CErrors()
+{
+  return _i2cErrors;
+}
+
+
+bool PhoneKeypad::injectChar(char c)
+{
+  if (_keyMap == NULL) return false;
+  for (uint8_t i = 0; i < 16; i++)
+  {
+    if (_keyMap[i] == c)
+    {
+      _injectedKey = i;
+      return true;
+    }
+  }
+  return false;
+}
+
+
+bool PhoneKeypad::dropInjectedChar()
+{
+  if (_injectedKey == I2C_KEYPAD_NOKEY) return false;
+  _injectedKey = I2C_KEYPAD_NOKEY;
+  return true;
+}
+
+
 char PhoneKeypad::getChar()
 { 
   return _keyMap[_lastKey]; 
@@ -111,7 +155,8 @@ char PhoneKeypad::getChar()
 
 void PhoneKeypad::setLatestCharsDepth(uint8_t depth)
 {
-    _latestCharsDepth = depth;
+    _latestCharsDepth = min(depth, (uint8_t)I2C_KEYPAD_MAX_LATEST_CHARS);
+    clearLatestChars();
 }
 
 uint8_t PhoneKeypad::getLatestCharsDepth()
@@ -119,20 +164,21 @@ uint8_t PhoneKeypad::getLatestCharsDepth()
     return _latestCharsDepth;
 }
 
-String PhoneKeypad::getLatestChars(){
+const char* PhoneKeypad::getLatestChars(){
     return _latestChars;
 }
 
 uint8_t PhoneKeypad::getLatestCharsLength(){
-  return (uint8_t)_latestChars.length();
+  return _latestCharsLength;
 }
 
 void PhoneKeypad::clearLatestChars(){
-  _latestChars="";
+  _latestChars[0] = '\0';
+  _latestCharsLength = 0;
 }
 
 uint16_t PhoneKeypad::getPressLengthMillis(){
-  return (uint16_t)(millis()-_lastPressMillis);
+  return (uint16_t)(_millis()-_lastPressMillis);
 }
 
 
@@ -144,7 +190,8 @@ void PhoneKeypad::loadKeyMap(char * keyMap)
 
 void PhoneKeypad::setKeyPadMode(uint8_t mode)
 {
-  if ((mode == I2C_KEYPAD_5x3) || 
+  if ((mode == I2C_KEYPAD_NONE) ||
+      (mode == I2C_KEYPAD_5x3) || 
       (mode == I2C_KEYPAD_6x2) ||
       (mode == I2C_KEYPAD_8x1))
   {
@@ -167,18 +214,46 @@ uint8_t PhoneKeypad::getKeyPadMode()
 //
 uint8_t PhoneKeypad::_read(uint8_t mask)
 {
+#ifdef I2C_TRACE_REPLAY
+  //  the recorded bus answers instead of the keypad
+  uint8_t replayed;
+  if (!I2CReplayNext(_address, mask, &replayed)) return 0xFF;
+  return replayed;
+#else
   //  improve the odds that IO will not interrupted.
   yield();
 
+  I2C_TRACE_START();
   _wire->beginTransmission(_address);
   _wire->write(mask);
   if (_wire->endTransmission() != 0)
   {
     //  set communication error
+    _i2cErrors++;
+    I2C_TRACE_RECORD(_address, mask, 0xFF, I2C_OP_KEYPAD_READ | I2C_OP_ERROR);
     return 0xFF;
   }
-  _wire->requestFrom(_address, (uint8_t)1);
-  return _wire->read();
+  if (_wire->requestFrom(_address, (uint8_t)1) != 1)
+  {
+    _i2cErrors++;
+    I2C_TRACE_RECORD(_address, mask, 0xFF, I2C_OP_KEYPAD_READ | I2C_OP_ERROR);
+    return 0xFF;
+  }
+  uint8_t result = _wire->read();
+  I2C_TRACE_RECORD(_address, mask, result, I2C_OP_KEYPAD_READ);
+  return result;
+#endif
+}
+
+
+//  the debounce clock, follows the recorded time when replaying a trace
+uint32_t PhoneKeypad::_millis()
+{
+#ifdef I2C_TRACE_REPLAY
+  return I2CReplayMillis();
+#else
+  return millis();
+#endif
 }
 
 
@@ -21,6 +21,11 @@
 #define I2C_KEYPAD_5x3            53
 #define I2C_KEYPAD_6x2            62
 #define I2C_KEYPAD_8x1            81
+//  no matrix on the expander, only injected keys (e.g. digits of a rotary dial)
+#define I2C_KEYPAD_NONE           0
+
+//  longest history of typed chars, the buffer is part of the object
+#define I2C_KEYPAD_MAX_LATEST_CHARS  20
 
 
 class PhoneKeypad
@@ -44,13 +49,22 @@ public:
   bool    isPressed();
   bool    isConnected();
 
+  //  number of failed I2C transactions since boot
+  uint32_t getI2CErrors();
+
+  //  synthetic key for remote testing, the next readKey() returns it
+  //  instead of scanning the keypad, never as a bounce. Returns false if c is not in the KeyMap.
+  bool    injectChar(char c);
+  //  drops an injected key no readKey() took, returns true if there was one
+  bool    dropInjectedChar();
+
   //  get 'translated' keys
   //  user must load KeyMap, there is no check.
   void    loadKeyMap(char * keyMap);   //  char[19]
   char getChar();
   void setLatestCharsDepth(uint8_t depth);
   uint8_t getLatestCharsDepth();
-  String getLatestChars();
+  const char* getLatestChars();
   uint8_t getLatestCharsLength();
   void clearLatestChars();
   
@@ -68,6 +82,9 @@ protected:
   uint8_t _lastKey;
   uint8_t _mode;
   uint8_t _read(uint8_t mask);
+  uint32_t _millis();
+  uint32_t _i2cErrors = 0;
+  uint8_t _injectedKey = I2C_KEYPAD_NOKEY;
   uint8_t _readKey4x4();
   uint8_t _debounceTimeMillis;
   long _lastPressMillis;
@@ -81,7 +98,8 @@ protected:
 
   char *  _keyMap = NULL;
   uint8_t _latestCharsDepth = 0;
-  String _latestChars = "";
+  char _latestChars[I2C_KEYPAD_MAX_LATEST_CHARS + 1] = "";
+  uint8_t _latestCharsLength = 0;
 };
 
 
@@ -0,0 +1,129 @@
+#include "PowerGovernor.h"
+#include <ESP8266WiFi.h>
+extern "C" {
+#include "user_interface.h"
+#include "gpio.h"
+}
+
+static volatile uint32_t wokeMicros = 0;
+
+static void wakeCallback(){
+  wokeMicros = micros();
+}
+
+void PowerGovernor::begin(uint8_t wakePin, void (*wakeIsr)(), void (*onClockChange)(uint8_t mhz), void (*onSleep)())
+{
+  _wakePin = wakePin;
+  _wakeIsr = wakeIsr;
+  _onClockChange = onClockChange;
+  _onSleep = onSleep;
+  _stateTicks = system_get_rtc_time();
+  _setClock(POWER_NORMAL_MHZ);
+}
+
+//adds the time since the last call to the current state
+void PowerGovernor::_account()
+{
+  uint32_t now = system_get_rtc_time();
+  //calibration is the length of an RTC tick in us, 12 bit fraction
+  _stateMicros[_state] += ((uint64_t)(now - _stateTicks) * system_rtc_clock_cali_proc()) >> 12;
+  _stateTicks = now;
+}
+
+void PowerGovernor::_setClock(uint8_t mhz)
+{
+  if (system_get_cpu_freq() == mhz) return;
+  uint32_t start = micros();
+  system_update_cpu_freq(mhz);
+  if (_onClockChange) _onClockChange(mhz);
+  uint32_t took = micros() - start;
+  if (took > _worstTransitionMicros) _worstTransitionMicros = took;
+}
+
+void PowerGovernor::_enter(PowerState state)
+{
+  if (state == _state) return;
+  _account();
+  _state = state;
+  _transitions++;
+  _setClock(state == POWER_BOOST ? POWER_BOOST_MHZ : POWER_NORMAL_MHZ);
+}
+
+void PowerGovernor::_lightSleep()
+{
+  if (_onSleep) _onSleep();
+  //forced light sleep needs the radio off, the caller made sure nothing uses it
+  wifi_set_opmode_current(NULL_MODE);
+  wifi_fpm_set_sleep_type(LIGHT_SLEEP_T);
+  wifi_fpm_open();
+  gpio_pin_wakeup_enable(GPIO_ID_PIN(_wakePin), GPIO_PIN_INTR_LOLEVEL);
+  wifi_fpm_set_wakeup_cb(wakeCallback);
+  wokeMicros = 0;
+  wifi_fpm_do_sleep(0xFFFFFFF); //until the pin wakes us
+  delay(10); //the sleep starts once the cpu yields
+  gpio_pin_wakeup_disable();
+  wifi_fpm_close();
+  if (_wakeIsr) attachInterrupt(digitalPinToInterrupt(_wakePin), _wakeIsr, FALLING);
+  _sleeps++;
+  _wakeMicros = micros();
+  if (wokeMicros){
+    uint32_t took = _wakeMicros - wokeMicros;
+    if (took > _worstTransitionMicros) _worstTransitionMicros = took;
+  }
+}
+
+bool PowerGovernor::run(bool audioBusy, bool networkBusy, bool hookDown, bool canSleep)
+{
+  unsigned long now = millis();
+  if (hookDown && !_hookWasDown) _hookDownMillis = now;
+  _hookWasDown = hookDown;
+
+  if (audioBusy || networkBusy) _enter(POWER_BOOST);
+  else if (hookDown && now - _hookDownMillis >= POWER_IDLE_AFTER_MILLIS) _enter(POWER_IDLE);
+  else _enter(POWER_NORMAL);
+
+  if (_state != POWER_IDLE){
+    _account();
+    return false;
+  }
+  if (!canSleep || digitalRead(_wakePin) == LOW){
+    //a change is still waiting to be read, or the radio is needed
+    delay(POWER_IDLE_DELAY_MILLIS);
+    _account();
+    return false;
+  }
+  _account();
+  _lightSleep();
+  _account();
+  return true;
+}
+
+PowerState PowerGovernor::getState()
+{
+  return _state;
+}
+
+uint32_t PowerGovernor::getStateMillis(PowerState state)
+{
+  return _stateMicros[state] / 1000;
+}
+
+uint32_t PowerGovernor::getTransitions()
+{
+  return _transitions;
+}
+
+uint32_t PowerGovernor::getWorstTransitionMicros()
+{
+  return _worstTransitionMicros;
+}
+
+uint32_t PowerGovernor::getSleeps()
+{
+  return _sleeps;
+}
+
+uint32_t PowerGovernor::getWakeMicros()
+{
+  return _wakeMicros;
+}
@@ -0,0 +1,66 @@
+#ifndef POWERGOVERNOR_H_
+#define POWERGOVERNOR_H_
+
+#include <Arduino.h>
+
+//Picks the cpu clock and sleep mode from what the phone is doing, once per loop() pass.
+//  POWER_BOOST   160MHz while a sample decodes or a network transfer runs
+//  POWER_NORMAL  80MHz with the horn up and nothing playing
+//  POWER_IDLE    horn down: forced light sleep until the keypad/hook interrupt pulls the
+//                wake pin low, or when WiFi is in use 80MHz with a short delay per pass so
+//                the modem can sleep instead of polling flat out
+//Time in every state is measured on the RTC clock, which keeps running during light sleep.
+//
+//The bit-banged I2C timing is computed for the compile-time F_CPU, so the clock change
+//callback has to rescale Wire.setClock().
+#define POWER_BOOST_MHZ 160
+#define POWER_NORMAL_MHZ 80
+#define POWER_IDLE_DELAY_MILLIS 20
+#define POWER_IDLE_AFTER_MILLIS 2000 //horn down this long before going idle
+
+enum PowerState{
+  POWER_NORMAL = 0,
+  POWER_BOOST,
+  POWER_IDLE,
+  POWER_STATE_COUNT
+};
+
+class PowerGovernor
+{
+public:
+  //wakeIsr is attached again after a light sleep, the wakeup reconfigures the pin interrupt.
+  //onSleep runs right before a light sleep, to stop peripherals that would keep the cpu busy.
+  void begin(uint8_t wakePin, void (*wakeIsr)(), void (*onClockChange)(uint8_t mhz), void (*onSleep)());
+  //call at the end of loop(). canSleep: no WiFi and nothing (LED, log) waiting on a timer.
+  //Returns true when the phone just woke from light sleep.
+  bool run(bool audioBusy, bool networkBusy, bool hookDown, bool canSleep);
+
+  PowerState getState();
+  uint32_t getStateMillis(PowerState state);
+  uint32_t getTransitions();
+  uint32_t getWorstTransitionMicros(); //clock switch, or wake interrupt until loop() runs again
+  uint32_t getSleeps();
+  uint32_t getWakeMicros(); //micros() when the last light sleep ended
+
+protected:
+  void _enter(PowerState state);
+  void _setClock(uint8_t mhz);
+  void _lightSleep();
+  void _account();
+
+  PowerState _state = POWER_NORMAL;
+  uint8_t _wakePin = 0;
+  void (*_wakeIsr)() = NULL;
+  void (*_onClockChange)(uint8_t mhz) = NULL;
+  void (*_onSleep)() = NULL;
+  uint32_t _stateTicks = 0; //RTC clock when the time was last accounted
+  uint64_t _stateMicros[POWER_STATE_COUNT] = {0};
+  uint32_t _transitions = 0;
+  uint32_t _worstTransitionMicros = 0;
+  uint32_t _sleeps = 0;
+  uint32_t _wakeMicros = 0;
+  unsigned long _hookDownMillis = 0;
+  bool _hookWasDown = false;
+};
+
+#endif
@@ -1,32 +1,5 @@
 #include "RTCRAM.h"
 
-/* void BackupStateToRTCRAM(DeepsleepSettings settings){
-  uint8_t byteBuffer[DEEPSLEEPBACKUPLENGTH+4];
-  memcpy(&byteBuffer[0], &settings.sleptFor, sizeof(int));
-  memcpy(&byteBuffer[4], &settings.deepSleepTimer, sizeof(int));
-  memcpy(&byteBuffer[8], &settings.maxDeepSleepWithoutSync, sizeof(int));
-  uint32_t checksum = calculateChecksum(byteBuffer, DEEPSLEEPBACKUPLENGTH+4);
-  memcpy(&byteBuffer[DEEPSLEEPBACKUPLENGTH], &checksum, sizeof(int));
-  WriteToRTCRAM (DEEPSLEEPSETTINGSADDRESS, byteBuffer, DEEPSLEEPBACKUPLENGTH+4);
-}
-
-DeepsleepSettings ReadDeepsleepStateFromRTCRAM(){
-  uint8_t byteBuffer[DEEPSLEEPBACKUPLENGTH+4];
-  DeepsleepSettings	 settings;
-  if(ReadFromRTCRAMAndCheck(DEEPSLEEPSETTINGSADDRESS,byteBuffer, DEEPSLEEPBACKUPLENGTH+4)){
-    memcpy(&settings.sleptFor, &byteBuffer[0], sizeof(int));
-    memcpy(&settings.deepSleepTimer, &byteBuffer[4], sizeof(int));
-    memcpy(&settings.maxDeepSleepWithoutSync,&byteBuffer[8], sizeof(int));
-  }
-  else{
-    //Serial.println("Error reading deepsleep settings, putting defaults (sleptFor 0 deepSleepTimer 0)");
-    settings.sleptFor = 0;
-    settings.deepSleepTimer = 0;
-  }
-  return settings;
-} */
-
-
 uint32_t calculateChecksum(uint8_t byteBuffer[], uint8_t bufferSize){
   CRC32 crc;
   size_t numBytes = bufferSize - 4; // deduct last byte of the byte buffer, the checsum will be stored here
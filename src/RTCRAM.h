@@ -4,19 +4,76 @@
 extern "C" {
   #include "user_interface.h" //for being able to access the RTC RAM
 }
+#include <type_traits>
 #include <CRC32.h>    //to check if the data saved in RTC RAM is valid or gobbledeegook
 #include "datatypes.h"
 
-//number of bytes to be saved in RTC memory, excluding 4 byte CRC
-//We will insert the variables that need to be retained here. in the current conscept 112 bytes. (28 buckets of 4);
-//For good working of the functions the length should alwas be a multipe of 4.
-#define DEEPSLEEPBACKUPLENGTH 12 //3 ints
-#define DEEPSLEEPSETTINGSADDRESS 100 //place where the information should be written in RTC RAM, every place is a bucket of 4 bytes
-#define PROGRAMBACKUPLENGTH 16 //3 bools and 2 longs
-#define PROGRAMSETTINGSADDRESS 104 //place where the information should be written in RTC RAM
+//RTC RAM survives everything except a power cycle. The user part runs from bucket 64 to 191,
+//every bucket is 4 bytes. Buckets 64 and 65 are taken by the multi reset detector (MRD_ADDRESS 0),
+//our own state starts at bucket 100 and is laid out by RTCState below.
+#define RTC_STATE_FIRST_BUCKET 100
+#define RTC_USER_END_BUCKET 192
 
 uint32_t calculateChecksum(uint8_t byteBuffer[], uint8_t bufferSize);
 void WriteToRTCRAM (int address, uint8_t byteBuffer[], uint8_t bufferSize);
 bool ReadFromRTCRAMAndCheck(int address, uint8_t byteBuffer[], uint8_t bufferSize);
 
-#endif
\ No newline at end of file
+struct RTCLayoutStart{
+  static constexpr int END = RTC_STATE_FIRST_BUCKET;
+};
+
+//Keeps one plain struct in RTC RAM behind a version tag and the CRC32 used by the helpers above.
+//Every RTCState is placed right after PREVIOUS, so the layout follows from the struct sizes:
+//  typedef RTCState<A, 1> RTCA;
+//  typedef RTCState<B, 1, RTCA> RTCB;
+//Bump VERSION when the meaning of a struct changes, a size change is caught by the tag anyway.
+template <typename T, uint16_t VERSION, typename PREVIOUS = RTCLayoutStart>
+class RTCState{
+  public:
+    struct Record{
+      uint32_t tag;
+      T data;
+    };
+    static constexpr uint32_t TAG = ((uint32_t)VERSION << 16) | (sizeof(T) & 0xFFFF);
+    static constexpr int BUFFERSIZE = ((sizeof(Record) + 3) & ~3) + 4; //whole buckets plus the crc
+    static constexpr int ADDRESS = PREVIOUS::END;
+    static constexpr int END = ADDRESS + BUFFERSIZE / 4;
+
+    static_assert(std::is_trivially_copyable<T>::value, "only plain structs can be kept in RTC RAM");
+    static_assert(BUFFERSIZE < 256, "RTCRAM helpers handle at most 252 bytes per record");
+    static_assert(END <= RTC_USER_END_BUCKET, "RTC RAM is full");
+
+    static bool load(T* data){
+      uint8_t byteBuffer[BUFFERSIZE] __attribute__((aligned(4)));
+      if (!ReadFromRTCRAMAndCheck(ADDRESS, byteBuffer, BUFFERSIZE)) return false;
+      Record record;
+      memcpy(&record, byteBuffer, sizeof(Record));
+      if (record.tag != TAG) return false;
+      *data = record.data;
+      return true;
+    }
+
+    static void save(const T& data){
+      uint8_t byteBuffer[BUFFERSIZE] __attribute__((aligned(4))) = {0};
+      Record record;
+      record.tag = TAG;
+      record.data = data;
+      memcpy(byteBuffer, &record, sizeof(Record));
+      uint32_t checksum = calculateChecksum(byteBuffer, BUFFERSIZE);
+      memcpy(&byteBuffer[BUFFERSIZE-4], &checksum, sizeof(uint32_t));
+      WriteToRTCRAM(ADDRESS, byteBuffer, BUFFERSIZE);
+    }
+
+    static void invalidate(){
+      uint8_t byteBuffer[BUFFERSIZE] __attribute__((aligned(4))) = {0};
+      //a zero crc never matches the crc of the zeroed record
+      WriteToRTCRAM(ADDRESS, byteBuffer, BUFFERSIZE);
+    }
+};
+
+//Program state kept over soft resets (exceptions, watchdog, ESP.restart)
+typedef RTCState<SampleIndexSummary, 2> RTCSampleIndex;
+typedef RTCState<SDSettings, 1, RTCSampleIndex> RTCSDSettings;
+typedef RTCState<PlaybackState, 1, RTCSDSettings> RTCPlayback;
+
+#endif
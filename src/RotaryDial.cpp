@@ -0,0 +1,106 @@
+#include "RotaryDial.h"
+
+RotaryDial::RotaryDial(uint8_t breakLevel)
+{
+  _breakLevel = breakLevel;
+  _lastLevel = !breakLevel;
+}
+
+void IRAM_ATTR RotaryDial::edge(uint32_t micros, uint8_t level)
+{
+  if (level == _lastLevel) return;
+  _lastLevel = level;
+  if (_head - _tail >= ROTARY_RING_SIZE){
+    _overflows++;
+    return;
+  }
+  Edge& e = _ring[_head & (ROTARY_RING_SIZE - 1)];
+  e.micros = micros;
+  e.isBreak = level == _breakLevel;
+  _head = _head + 1;
+}
+
+//the level of the last edge counts once it has been stable for ROTARY_DEBOUNCE_US
+void RotaryDial::_settle(uint32_t micros)
+{
+  if (!_bouncing || micros - _bounceLastMicros < ROTARY_DEBOUNCE_US) return;
+  _bouncing = false;
+  if (_bounceIsBreak != _inBreak) _transition(_bounceStartMicros, _bounceIsBreak);
+}
+
+void RotaryDial::_transition(uint32_t micros, bool isBreak)
+{
+  _inBreak = isBreak;
+  if (isBreak){
+    //a pause long enough before this break ended the previous digit
+    if (_pulses && micros - _digitMicros >= ROTARY_INTERDIGIT_US) _ready = _finishDigit();
+    _breakMicros = micros;
+    return;
+  }
+  uint32_t breakLength = micros - _breakMicros;
+  if (breakLength < ROTARY_BREAK_MIN_US) return; //a glitch, not a pulse
+  if (breakLength > ROTARY_BREAK_MAX_US){
+    //line open or hook flash, not a pulse: forget the digit
+    _errors++;
+    _pulses = 0;
+    return;
+  }
+  _pulses++;
+  _digitMicros = micros;
+}
+
+char RotaryDial::_finishDigit()
+{
+  uint8_t pulses = _pulses;
+  _pulses = 0;
+  if (!pulses) return 0;
+  if (pulses > 10){
+    _errors++;
+    return 0;
+  }
+  return pulses == 10 ? '0' : '0' + pulses;
+}
+
+char RotaryDial::poll(uint32_t nowMicros)
+{
+  while (_tail != _head){
+    Edge e = _ring[_tail & (ROTARY_RING_SIZE - 1)];
+    _tail = _tail + 1;
+    _settle(e.micros);
+    if (!_bouncing){
+      _bouncing = true;
+      _bounceStartMicros = e.micros;
+    }
+    _bounceIsBreak = e.isBreak;
+    _bounceLastMicros = e.micros;
+    if (_ready){
+      //the rest of the edges belong to the next digit, they wait for the next poll()
+      char digit = _ready;
+      _ready = 0;
+      return digit;
+    }
+  }
+  _settle(nowMicros);
+  if (_ready){
+    char digit = _ready;
+    _ready = 0;
+    return digit;
+  }
+  if (!_inBreak && !_bouncing && _pulses && nowMicros - _digitMicros >= ROTARY_INTERDIGIT_US) return _finishDigit();
+  return 0;
+}
+
+uint32_t RotaryDial::getDigitMicros()
+{
+  return _digitMicros;
+}
+
+uint32_t RotaryDial::getOverflows()
+{
+  return _overflows;
+}
+
+uint32_t RotaryDial::getErrors()
+{
+  return _errors;
+}
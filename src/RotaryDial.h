@@ -0,0 +1,64 @@
+#ifndef ROTARYDIAL_H_
+#define ROTARYDIAL_H_
+
+#include <Arduino.h>
+
+//Decodes the pulse contact of a rotary dial. Edges are timestamped in the interrupt
+//(edge() is IRAM safe) and classified from loop() by poll():
+//  a level counts once it has been stable for ROTARY_DEBOUNCE_US, from the first edge of
+//  its bounces on. A break of ROTARY_BREAK_MIN..MAX is one pulse and a make longer than
+//  ROTARY_INTERDIGIT ends the digit (1..9 pulses = '1'..'9', 10 = '0').
+//A 10 pps dial breaks 60ms and makes 40ms, fast dials go up to 20 pps (33/17ms).
+//
+//Every edge is only seen when edge() is called from the pin interrupt (ROTARY_PULSE_GPIO in
+//main.cpp). On P1 of the GPIO expander the level is read once per loop() pass, so the edges
+//between two passes merge into one. Replays of generated trains (d1_mini_rotaryreplay_expander)
+//decode every digit at 20 pps while passes stay under 10ms, and at 10 pps under 20ms. Longer
+//passes, like SD stalls, drop or merge pulses into wrong digits.
+#define ROTARY_RING_SIZE 32 //power of two, a full 0 is 20 edges plus what bounces between two poll() calls
+#define ROTARY_BREAK_MIN_US 15000
+#define ROTARY_BREAK_MAX_US 120000
+#define ROTARY_DEBOUNCE_US 5000
+#define ROTARY_INTERDIGIT_US 150000
+
+class RotaryDial
+{
+public:
+  RotaryDial(uint8_t breakLevel = HIGH);
+  //a level seen on the pulse contact, repeats of the current level are ignored
+  void IRAM_ATTR edge(uint32_t micros, uint8_t level);
+  //the dialed digit once its inter-digit pause has passed, 0 otherwise
+  char poll(uint32_t nowMicros);
+  uint32_t getDigitMicros(); //time of the last pulse of the digit poll() returned
+  uint32_t getOverflows();
+  uint32_t getErrors(); //digits with more than 10 pulses or breaks too long to be a pulse
+
+protected:
+  void _settle(uint32_t micros);
+  void _transition(uint32_t micros, bool isBreak);
+  char _finishDigit();
+
+  struct Edge{
+    uint32_t micros;
+    bool isBreak;
+  };
+  Edge _ring[ROTARY_RING_SIZE];
+  volatile uint32_t _head = 0;
+  volatile uint32_t _tail = 0;
+  volatile uint8_t _lastLevel;
+  volatile uint32_t _overflows = 0;
+  uint8_t _breakLevel;
+
+  bool _inBreak = false; //debounced level
+  bool _bouncing = false; //edges seen that have not settled yet
+  bool _bounceIsBreak = false; //level of the last of those edges
+  uint32_t _bounceStartMicros = 0;
+  uint32_t _bounceLastMicros = 0;
+  uint32_t _breakMicros = 0;
+  uint8_t _pulses = 0;
+  uint32_t _digitMicros = 0; //end of the last confirmed pulse
+  char _ready = 0; //digit finished while reading the ring
+  uint32_t _errors = 0;
+};
+
+#endif
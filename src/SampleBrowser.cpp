@@ -0,0 +1,173 @@
+#include "SampleBrowser.h"
+#include <SD.h>
+#include "SampleIndex.h"
+
+struct Download{
+  bool active;
+  File file;
+  uint32_t start; //first byte of the range
+  uint32_t length;
+  uint32_t startMillis;
+  uint32_t lastSliceMillis;
+  AsyncWebServerRequest* request;
+};
+
+static Download download;
+static BrowserStats stats;
+static bool (*audioBusy)() = NULL;
+
+static void endDownload(){
+  if (!download.active) return;
+  download.file.close();
+  download.active = false;
+  download.request = NULL;
+  stats.sendMillis += millis() - download.startMillis;
+}
+
+//"bytes=a-b", "bytes=a-" or "bytes=-n" against a file of size bytes, false if it does not fit
+static bool parseRange(const char* header, uint32_t size, uint32_t* start, uint32_t* length){
+  if (strncmp(header, "bytes=", 6) != 0 || !size) return false;
+  const char* spec = header + 6;
+  char* end;
+  uint32_t first, last = size - 1;
+  if (*spec == '-'){
+    uint32_t suffix = strtoul(spec + 1, &end, 10);
+    if (end == spec + 1 || !suffix) return false;
+    first = suffix >= size ? 0 : size - suffix;
+  }
+  else {
+    first = strtoul(spec, &end, 10);
+    if (end == spec || *end != '-') return false;
+    if (end[1]){
+      last = strtoul(end + 1, &end, 10);
+      if (*end) return false; //multiple ranges are not supported
+      if (last >= size) last = size - 1;
+    }
+  }
+  if (first > last) return false;
+  *start = first;
+  *length = last - first + 1;
+  return true;
+}
+
+static const char* contentType(const char* path){
+  switch (SampleFormatOf(path)){
+    case SAMPLE_WAV: return "audio/wav";
+    case SAMPLE_MP3: return "audio/mpeg";
+    default: return "application/octet-stream";
+  }
+}
+
+//called by the TCP send path whenever there is room in the send buffer
+static size_t fillDownload(uint8_t* buffer, size_t maxLen, size_t index){
+  if (!download.active || index >= download.length) return 0;
+  uint32_t now = millis();
+  if (audioBusy && audioBusy() && now - download.lastSliceMillis < BROWSER_BUSY_INTERVAL_MILLIS){
+    stats.throttled++;
+    return RESPONSE_TRY_AGAIN;
+  }
+  size_t len = min(min(maxLen, (size_t)BROWSER_SLICE_BYTES), (size_t)(download.length - index));
+  uint32_t start = micros();
+  int read = download.file.read(buffer, len);
+  uint32_t took = micros() - start;
+  stats.readMicros += took;
+  if (took > stats.worstSliceMicros) stats.worstSliceMicros = took;
+  download.lastSliceMillis = now;
+  if (read <= 0){
+    //the file got shorter, the client sees a short body
+    endDownload();
+    return 0;
+  }
+  stats.bytesSent += read;
+  if (index + read >= download.length) endDownload();
+  return read;
+}
+
+static void onSample(AsyncWebServerRequest* request){
+  if (!request->hasParam("file")){
+    request->send(400, "text/plain", "missing file parameter");
+    return;
+  }
+  String path = request->getParam("file")->value();
+  if (path.length() < 2 || path.length() >= BROWSER_PATH_MAX || path[0] != '/' || path.indexOf("..") >= 0){
+    request->send(400, "text/plain", "bad file parameter");
+    return;
+  }
+  //only the samples of the listing: the card also holds the WiFi credentials, firmware and messages
+  if (path.indexOf('/', 1) >= 0 || SampleFormatOf(path.c_str()) == SAMPLE_FORMAT_UNKNOWN){
+    request->send(403, "text/plain", "only samples in the root can be downloaded");
+    return;
+  }
+  if (download.active){
+    request->send(409, "text/plain", "another download is in progress");
+    return;
+  }
+  File file = SD.open(path, FILE_READ);
+  if (!file || file.isDirectory()){
+    if (file) file.close();
+    request->send(404, "text/plain", "no such file");
+    return;
+  }
+  uint32_t size = file.size();
+  uint32_t start = 0, length = size;
+  bool partial = request->hasHeader("Range");
+  if (partial && !parseRange(request->getHeader("Range")->value().c_str(), size, &start, &length)){
+    file.close();
+    AsyncWebServerResponse* response = request->beginResponse(416, "text/plain", "range not satisfiable");
+    response->addHeader("Content-Range", String("bytes */") + size);
+    request->send(response);
+    return;
+  }
+  if (start) file.seek(start);
+
+  download.file = file;
+  download.start = start;
+  download.length = length;
+  download.startMillis = millis();
+  download.lastSliceMillis = 0;
+  download.request = request;
+  download.active = true;
+  stats.downloads++;
+  request->onDisconnect([request](){
+    if (download.request == request) endDownload();
+  });
+
+  AsyncWebServerResponse* response = request->beginResponse(contentType(path.c_str()), length, fillDownload);
+  response->addHeader("Accept-Ranges", "bytes");
+  if (partial){
+    char range[48];
+    snprintf(range, sizeof(range), "bytes %u-%u/%u", start, start + length - 1, size);
+    response->setCode(206);
+    response->addHeader("Content-Range", range);
+  }
+  request->send(response);
+}
+
+static void onSampleList(AsyncWebServerRequest* request){
+  if (!SD.exists(SAMPLE_LIST_PATH)){
+    request->send(503, "text/plain", "no sample listing yet");
+    return;
+  }
+  //small and read once, a plain file response is fine here
+  request->send(SDFS, SAMPLE_LIST_PATH, "text/plain");
+}
+
+static void onBrowserStats(AsyncWebServerRequest* request){
+  char text[256];
+  uint32_t sdKBps = stats.readMicros ? (uint32_t)((uint64_t)stats.bytesSent * 1000 / stats.readMicros) : 0;
+  uint32_t httpKBps = stats.sendMillis ? stats.bytesSent / stats.sendMillis : 0;
+  snprintf(text, sizeof(text), "downloads: %u\nbytes sent: %u\nsd read: %u.%03u MB/s (%u ms)\nhttp: %u kB/s\nworst slice: %u us\nthrottled slices: %u\n",
+    stats.downloads, stats.bytesSent, sdKBps / 1000, sdKBps % 1000, stats.readMicros / 1000, httpKBps, stats.worstSliceMicros, stats.throttled);
+  request->send(200, "text/plain", text);
+}
+
+void SetupSampleBrowser(AsyncWebServer* server, bool (*isAudioBusy)()){
+  audioBusy = isAudioBusy;
+  server->on("/samples/stats", HTTP_GET, onBrowserStats);
+  server->on("/samples", HTTP_GET, onSampleList);
+  server->on("/sample", HTTP_GET, onSample);
+}
+
+const BrowserStats* GetBrowserStats(){
+  return &stats;
+}
@@ -0,0 +1,34 @@
+#ifndef SAMPLEBROWSER_H_
+#define SAMPLEBROWSER_H_
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+
+//Read-only view of the SD card for auditing a phone from a laptop.
+//
+//  GET /samples                     the cached listing, one "<name>,<bytes>" line per sample
+//  GET /sample?file=/770.mp3        the sample, with Range: bytes=a-b / a- / -n support (206).
+//                                   Only .mp3 and .wav in the root, anything else is 403.
+//  GET /samples/stats               SD read and HTTP throughput of the downloads so far
+//
+//The response is filled straight from the SD file by the TCP send path, at most
+//BROWSER_SLICE_BYTES per SD read so the SPI bus is never held for long. While a sample plays
+//only one slice per BROWSER_BUSY_INTERVAL_MILLIS is read, the decoder gets the rest.
+//One download at a time, a second one gets 409.
+#define BROWSER_SLICE_BYTES 2048 //about 1ms of SPI at 20MHz
+#define BROWSER_BUSY_INTERVAL_MILLIS 20
+#define BROWSER_PATH_MAX 48
+
+struct BrowserStats{
+  uint32_t downloads;
+  uint32_t bytesSent;
+  uint32_t readMicros; //time spent inside SD reads only
+  uint32_t sendMillis; //first to last byte of every download
+  uint32_t worstSliceMicros;
+  uint32_t throttled; //slices put off because audio was playing
+};
+
+void SetupSampleBrowser(AsyncWebServer* server, bool (*isAudioBusy)());
+const BrowserStats* GetBrowserStats();
+
+#endif
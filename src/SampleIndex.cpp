@@ -0,0 +1,103 @@
+#include "SampleIndex.h"
+#include "RTCRAM.h"
+
+static SampleIndexSummary summary;
+
+static const char* const sampleExtensions[SAMPLE_FORMAT_COUNT] = {".wav", ".mp3"};
+
+SampleFormat SampleFormatOf(const char* path){
+  const char* dot = strrchr(path, '.');
+  if (!dot) return SAMPLE_FORMAT_UNKNOWN;
+  for (uint8_t format = 0; format < SAMPLE_FORMAT_COUNT; format++){
+    if (strcasecmp(dot, sampleExtensions[format]) == 0) return (SampleFormat)format;
+  }
+  return SAMPLE_FORMAT_UNKNOWN;
+}
+
+//returns the number of digits of a "<digits>.<mp3|wav>" name, 0 for anything else
+static uint8_t sampleDigits(const char* name){
+  if (*name == '/') name++;
+  const char* dot = strrchr(name, '.');
+  if (!dot || SampleFormatOf(name) == SAMPLE_FORMAT_UNKNOWN || dot == name) return 0;
+  for (const char* c = name; c < dot; c++){
+    if (!isdigit(*c)) return 0;
+  }
+  return (uint8_t)min((int)(dot - name), 31);
+}
+
+//single key samples like /A.mp3 are not dialable numbers but count for the formats
+static void addFormat(const char* name){
+  SampleFormat format = SampleFormatOf(name);
+  if (format != SAMPLE_FORMAT_UNKNOWN) summary.formatMask |= 1 << format;
+}
+
+static void addSample(uint8_t digits, uint32_t size){
+  summary.count++;
+  summary.lengthMask |= (1UL << digits);
+  if (digits > summary.maxDigits) summary.maxDigits = digits;
+  summary.totalKBytes += size / 1024;
+}
+
+//one "<name>,<bytes>" line per sample
+static void listSample(File& list, const char* name, uint32_t size){
+  if (*name == '/') name++;
+  list.printf("%s,%u\n", name, size);
+}
+
+void SampleIndexScan(){
+  memset(&summary, 0, sizeof(summary));
+  SD.remove(SAMPLE_LIST_PATH);
+  File list = SD.open(SAMPLE_LIST_PATH, FILE_WRITE);
+  File root = SD.open("/");
+  File entry = root.openNextFile();
+  while (entry){
+    if (!entry.isDirectory() && SampleFormatOf(entry.name()) != SAMPLE_FORMAT_UNKNOWN){
+      addFormat(entry.name());
+      uint8_t digits = sampleDigits(entry.name());
+      if (digits) addSample(digits, entry.size());
+      if (list) listSample(list, entry.name(), entry.size());
+    }
+    entry.close();
+    entry = root.openNextFile();
+  }
+  root.close();
+  list.close();
+  RTCSampleIndex::save(summary);
+}
+
+bool SampleIndexRestore(){
+  //the listing lives on the card, a card that was cleaned gets a fresh scan. A swapped card is
+  //caught by main.cpp, which does not restore after the reset button.
+  return SD.exists(SAMPLE_LIST_PATH) && RTCSampleIndex::load(&summary);
+}
+
+void SampleIndexAdd(const char* path, uint32_t size){
+  if (SampleFormatOf(path) == SAMPLE_FORMAT_UNKNOWN || strchr(path + 1, '/')) return;
+  File list = SD.open(SAMPLE_LIST_PATH, FILE_WRITE);
+  if (list){
+    listSample(list, path, size);
+    list.close();
+  }
+  uint8_t formats = summary.formatMask;
+  addFormat(path);
+  uint8_t digits = sampleDigits(path);
+  if (digits) addSample(digits, size);
+  if (digits || formats != summary.formatMask) RTCSampleIndex::save(summary);
+}
+
+bool SampleIndexMayExist(uint8_t digits){
+  return digits < 32 && (summary.lengthMask & (1UL << digits));
+}
+
+bool SampleIndexFind(const char* name, char* path, size_t size){
+  for (uint8_t format = 0; format < SAMPLE_FORMAT_COUNT; format++){
+    if (!(summary.formatMask & (1 << format))) continue;
+    snprintf(path, size, "/%s%s", name, sampleExtensions[format]);
+    if (SD.exists(path)) return true;
+  }
+  return false;
+}
+
+const SampleIndexSummary* GetSampleIndexSummary(){
+  return &summary;
+}
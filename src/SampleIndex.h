@@ -0,0 +1,22 @@
+#ifndef SAMPLEINDEX_H_
+#define SAMPLEINDEX_H_
+
+#include <SD.h>
+#include "datatypes.h"
+
+//Summary of the dialable samples in the root of the SD card, used to skip SD lookups for
+//numbers that cannot exist. Kept in RTC RAM so a warm boot does not need to scan the card.
+//The scan also writes the listing of all samples to SAMPLE_LIST_PATH for the web browser.
+#define SAMPLE_LIST_PATH "/samples.lst"
+
+void SampleIndexScan();
+bool SampleIndexRestore();
+void SampleIndexAdd(const char* path, uint32_t size);
+bool SampleIndexMayExist(uint8_t digits);
+SampleFormat SampleFormatOf(const char* path);
+//looks for /<name>.wav, /<name>.mp3 on the card, only in formats the card holds.
+//path receives the first that exists.
+bool SampleIndexFind(const char* name, char* path, size_t size);
+const SampleIndexSummary* GetSampleIndexSummary();
+
+#endif
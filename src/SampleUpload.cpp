@@ -0,0 +1,308 @@
+#include "SampleUpload.h"
+#include <CRC32.h>
+#include "SampleIndex.h"
+#include "DeltaUpdate.h"
+
+struct UploadSession{
+  UploadState state;
+  int error; //http status to answer the owner with, 0 if all is well
+  AsyncWebServerRequest* owner;
+  AsyncClient* client;
+  char path[UPLOAD_PATH_MAX];
+  char partPath[UPLOAD_PATH_MAX + 5];
+  File file;
+  uint8_t* buffer;
+  uint16_t bufferLen;
+  uint32_t total; //size of the complete file
+  uint32_t flushed; //bytes stored in the .part file
+  uint32_t expectedCrc;
+  size_t pendingAck;
+  uint32_t lastAckMillis;
+  CRC32 crc;
+  uint32_t verifyPos;
+};
+
+static UploadSession session;
+static UploadStats stats;
+static bool (*audioBusy)() = NULL;
+
+static bool flushUploadBuffer(){
+  if (!session.bufferLen) return true;
+  uint32_t start = micros();
+  size_t written = session.file.write(session.buffer, session.bufferLen);
+  stats.writeMicros += micros() - start;
+  stats.bytesWritten += written;
+  session.flushed += written;
+  bool ok = written == session.bufferLen;
+  session.bufferLen = 0;
+  return ok;
+}
+
+static void releaseUploadBuffer(){
+  if (session.file) session.file.close();
+  free(session.buffer);
+  session.buffer = NULL;
+  session.bufferLen = 0;
+}
+
+static void commitUpload(){
+  bool replaced = SD.exists(session.path);
+  if (replaced) SD.remove(session.path);
+  session.state = SD.rename(session.partPath, session.path) ? UPLOAD_DONE : UPLOAD_IO_ERROR;
+  if (session.state != UPLOAD_DONE) return;
+  stats.uploadsCompleted++;
+  if (!replaced) SampleIndexAdd(session.path, session.total);
+}
+
+static void finishUpload(){
+  //the crc is checked by reading the file back from loop(), a few MB would trip the watchdog here
+  session.file = SD.open(session.partPath, FILE_READ);
+  if (!session.file){
+    session.state = UPLOAD_IO_ERROR;
+    return;
+  }
+  session.crc.reset();
+  session.verifyPos = 0;
+  session.state = UPLOAD_VERIFYING;
+}
+
+static bool validUploadPath(const String& path){
+  return path.length() > 1 && path.length() < UPLOAD_PATH_MAX && path[0] == '/' && path.indexOf("..") < 0;
+}
+
+//samples in the root and what the updates read: the card also holds the WiFi credentials,
+//the menu and the sample listing, none of which may be replaced from the network
+static bool allowedUploadPath(const String& path){
+  if (path == FIRMWARE_PATH || path == FIRMWARE_MANIFEST_PATH || path == DELTA_PATH) return true;
+  return path.indexOf('/', 1) < 0 && SampleFormatOf(path.c_str()) != SAMPLE_FORMAT_UNKNOWN;
+}
+
+static int beginUpload(AsyncWebServerRequest* request, size_t contentLength){
+  if (session.owner || session.state == UPLOAD_RECEIVING || session.state == UPLOAD_VERIFYING) return 409;
+  if (!request->hasParam("file")) return 400;
+  String path = request->getParam("file")->value();
+  if (!validUploadPath(path)) return 400;
+  if (!allowedUploadPath(path)) return 403;
+  //nothing is committed unchecked
+  if (!request->hasHeader("X-CRC32")) return 400;
+
+  uint32_t start = 0;
+  uint32_t total = contentLength;
+  if (request->hasHeader("Content-Range")){
+    unsigned int rangeStart, rangeEnd, rangeTotal;
+    if (sscanf(request->getHeader("Content-Range")->value().c_str(), "bytes %u-%u/%u", &rangeStart, &rangeEnd, &rangeTotal) != 3) return 400;
+    if (rangeEnd - rangeStart + 1 != contentLength || rangeEnd >= rangeTotal) return 400;
+    start = rangeStart;
+    total = rangeTotal;
+  }
+
+  strlcpy(session.path, path.c_str(), sizeof(session.path));
+  snprintf(session.partPath, sizeof(session.partPath), "%s.part", session.path);
+  if (start == 0 && SD.exists(session.partPath)) SD.remove(session.partPath);
+  session.file = SD.open(session.partPath, FILE_WRITE);
+  if (!session.file) return 500;
+  //a resume may repeat bytes we already have but may not leave a hole
+  if (session.file.size() < start){
+    session.file.close();
+    return 416;
+  }
+  if (session.file.size() > start) session.file.truncate(start);
+  session.file.seek(start);
+
+  session.buffer = (uint8_t*)malloc(UPLOAD_BUFFER_SIZE);
+  if (!session.buffer){
+    session.file.close();
+    return 507;
+  }
+  session.bufferLen = 0;
+  session.flushed = start;
+  session.total = total;
+  session.expectedCrc = strtoul(request->getHeader("X-CRC32")->value().c_str(), NULL, 16);
+  session.client = request->client();
+  session.pendingAck = 0;
+  session.lastAckMillis = millis();
+  session.state = UPLOAD_RECEIVING;
+  return 0;
+}
+
+static void onUploadDisconnect(AsyncWebServerRequest* request){
+  if (session.owner != request) return;
+  session.client = NULL;
+  session.pendingAck = 0;
+  session.owner = NULL;
+  if (session.state == UPLOAD_RECEIVING){
+    //keep what we have, the client can resume from GET /upload
+    flushUploadBuffer();
+    releaseUploadBuffer();
+    session.state = UPLOAD_IDLE;
+  }
+}
+
+static void onUploadBody(AsyncWebServerRequest* request, uint8_t* data, size_t len, size_t index, size_t total){
+  if (index == 0){
+    int error = beginUpload(request, total);
+    //busy with another client, onUploadRequest() answers this one
+    if (error == 409) return;
+    session.owner = request;
+    session.error = error;
+    request->onDisconnect([request](){ onUploadDisconnect(request); });
+  }
+  if (session.owner != request || session.error || session.state != UPLOAD_RECEIVING) return;
+
+  size_t remaining = len;
+  while (remaining){
+    //flush on sector boundaries of the file, not of the buffer, so a resumed upload realigns
+    size_t limit = UPLOAD_BUFFER_SIZE - (session.flushed % UPLOAD_SECTOR_SIZE);
+    size_t chunk = min(remaining, limit - session.bufferLen);
+    memcpy(session.buffer + session.bufferLen, data, chunk);
+    session.bufferLen += chunk;
+    data += chunk;
+    remaining -= chunk;
+    if (session.bufferLen == limit && !flushUploadBuffer()){
+      session.error = 500;
+      session.state = UPLOAD_IO_ERROR;
+      releaseUploadBuffer();
+      return;
+    }
+  }
+  if (audioBusy && audioBusy() && session.client){
+    //hold back the tcp ack, UploadPump() releases it at a rate the decoder can live with
+    session.client->ackLater();
+    session.pendingAck += len;
+  }
+
+  if (index + len == total){
+    bool ok = flushUploadBuffer();
+    releaseUploadBuffer();
+    if (!ok){
+      session.error = 500;
+      session.state = UPLOAD_IO_ERROR;
+    }
+    else if (session.flushed >= session.total) finishUpload();
+    else session.state = UPLOAD_IDLE; //partial upload, waiting for the next range
+  }
+}
+
+static const char* uploadStateString(UploadState state){
+  switch (state){
+    case UPLOAD_IDLE: return "idle";
+    case UPLOAD_RECEIVING: return "receiving";
+    case UPLOAD_VERIFYING: return "verifying";
+    case UPLOAD_DONE: return "done";
+    case UPLOAD_CRC_ERROR: return "crc_error";
+    case UPLOAD_IO_ERROR: return "io_error";
+  }
+  return "unknown";
+}
+
+static void sendUploadStatus(AsyncWebServerRequest* request, int code, const char* path){
+  char partPath[UPLOAD_PATH_MAX + 5];
+  snprintf(partPath, sizeof(partPath), "%s.part", path);
+  uint32_t received = 0;
+  UploadState state = UPLOAD_IDLE;
+  if (strcmp(path, session.path) == 0){
+    state = session.state;
+    received = session.flushed;
+  }
+  else if (SD.exists(partPath)){
+    File part = SD.open(partPath, FILE_READ);
+    received = part.size();
+    part.close();
+  }
+  else if (SD.exists(path)){
+    state = UPLOAD_DONE;
+  }
+  char json[96];
+  snprintf(json, sizeof(json), "{\"received\":%u,\"total\":%u,\"state\":\"%s\"}", received, strcmp(path, session.path) == 0 ? session.total : 0, uploadStateString(state));
+  request->send(code, "application/json", json);
+}
+
+static const char* uploadErrorString(int error){
+  switch (error){
+    case 400: return "bad file parameter or Content-Range, or no X-CRC32 header";
+    case 403: return "only samples in the root and the firmware files can be uploaded";
+    case 416: return "resume offset beyond received data, GET /upload first";
+  }
+  return "upload failed";
+}
+
+static void onUploadRequest(AsyncWebServerRequest* request){
+  if (session.owner != request){
+    request->send(409, "text/plain", "another upload is in progress");
+    return;
+  }
+  int error = session.error;
+  session.owner = NULL;
+  session.error = 0;
+  if (error){
+    request->send(error, "text/plain", uploadErrorString(error));
+    return;
+  }
+  //202: the crc check still runs in the background, poll GET /upload for the result
+  sendUploadStatus(request, session.state == UPLOAD_VERIFYING ? 202 : 200, session.path);
+}
+
+static void onUploadStatus(AsyncWebServerRequest* request){
+  if (!request->hasParam("file")){
+    request->send(400, "text/plain", "missing file parameter");
+    return;
+  }
+  sendUploadStatus(request, 200, request->getParam("file")->value().c_str());
+}
+
+static void onUploadStats(AsyncWebServerRequest* request){
+  char text[160];
+  uint32_t kBps = stats.writeMicros ? (uint32_t)((uint64_t)stats.bytesWritten * 1000 / stats.writeMicros) : 0;
+  snprintf(text, sizeof(text), "bytes written: %u\nwrite time: %u ms\nsustained write: %u.%03u MB/s\nuploads: %u\ncrc errors: %u\n",
+    stats.bytesWritten, stats.writeMicros / 1000, kBps / 1000, kBps % 1000, stats.uploadsCompleted, stats.crcErrors);
+  request->send(200, "text/plain", text);
+}
+
+void SetupSampleUpload(AsyncWebServer* server, bool (*isAudioBusy)()){
+  audioBusy = isAudioBusy;
+  server->on("/upload/stats", HTTP_GET, onUploadStats);
+  server->on("/upload", HTTP_GET, onUploadStatus);
+  server->on("/upload", HTTP_PUT, onUploadRequest, NULL, onUploadBody);
+}
+
+void UploadPump(){
+  bool busy = audioBusy && audioBusy();
+  if (session.pendingAck && session.client){
+    uint32_t now = millis();
+    size_t budget = busy ? (now - session.lastAckMillis) * UPLOAD_THROTTLED_BYTES_PER_SECOND / 1000 : session.pendingAck;
+    if (budget){
+      session.pendingAck -= session.client->ack(min(budget, session.pendingAck));
+      session.lastAckMillis = now;
+    }
+  }
+
+  if (session.state != UPLOAD_VERIFYING) return;
+  uint8_t slice[UPLOAD_SECTOR_SIZE];
+  int sectors = busy ? UPLOAD_VERIFY_SECTORS_THROTTLED : UPLOAD_VERIFY_SECTORS;
+  int len = 0;
+  for (int i = 0; i < sectors; i++){
+    len = session.file.read(slice, sizeof(slice));
+    if (len <= 0) break;
+    session.crc.update(slice, len);
+    session.verifyPos += len;
+  }
+  if (len > 0 && session.verifyPos < session.total) return;
+  session.file.close();
+  if (session.verifyPos != session.total || session.crc.finalize() != session.expectedCrc){
+    //keep nothing of a corrupt upload, the next attempt starts from zero
+    SD.remove(session.partPath);
+    session.flushed = 0;
+    session.state = UPLOAD_CRC_ERROR;
+    stats.crcErrors++;
+    return;
+  }
+  commitUpload();
+}
+
+UploadState GetUploadState(){
+  return session.state;
+}
+
+const UploadStats* GetUploadStats(){
+  return &stats;
+}
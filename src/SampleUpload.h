@@ -0,0 +1,55 @@
+#ifndef SAMPLEUPLOAD_H_
+#define SAMPLEUPLOAD_H_
+
+#include <Arduino.h>
+#include <SD.h>
+#include <ESPAsyncWebServer.h>
+
+//Streaming sample upload to the SD card over the async webserver.
+//
+//  PUT /upload?file=/123.mp3          body = (part of) the file, Content-Type application/octet-stream
+//      Content-Range: bytes 4096-8191/20000   optional, to resume a partial upload
+//      X-CRC32: 1a2b3c4d                      crc32 of the complete file, checked once all bytes are in.
+//                                             Required, an upload without it is answered with 400.
+//  GET /upload?file=/123.mp3          {"received":4096,"total":20000,"state":"receiving"}
+//  GET /upload/stats                  sustained SD write speed of the uploads so far
+//
+//Only .mp3 and .wav samples in the root, /firmware.bin, /firmware.json and /firmware.dlt
+//can be uploaded, anything else is 403. The data goes to <file>.part and is only renamed to
+//<file> when the crc matches.
+//tools/upload_samples.py is the matching client.
+
+//data is collected until a whole number of SD sectors can be written in one go
+#define UPLOAD_SECTOR_SIZE 512
+#define UPLOAD_BUFFER_SIZE (4 * UPLOAD_SECTOR_SIZE)
+#define UPLOAD_PATH_MAX 48
+//while a sample is playing the tcp window is only reopened at this rate, so the SD writes
+//cannot starve the decoder
+#define UPLOAD_THROTTLED_BYTES_PER_SECOND 32768
+//sectors read back per UploadPump() call when checking the crc
+#define UPLOAD_VERIFY_SECTORS 4
+#define UPLOAD_VERIFY_SECTORS_THROTTLED 1
+
+enum UploadState{
+  UPLOAD_IDLE = 0,
+  UPLOAD_RECEIVING,
+  UPLOAD_VERIFYING,
+  UPLOAD_DONE,
+  UPLOAD_CRC_ERROR,
+  UPLOAD_IO_ERROR
+};
+
+struct UploadStats{
+  uint32_t bytesWritten;
+  uint32_t writeMicros; //time spent inside SD writes only
+  uint32_t uploadsCompleted;
+  uint32_t crcErrors;
+};
+
+void SetupSampleUpload(AsyncWebServer* server, bool (*isAudioBusy)());
+//call from loop(), releases throttled tcp data and runs the crc check in small slices
+void UploadPump();
+UploadState GetUploadState();
+const UploadStats* GetUploadStats();
+
+#endif
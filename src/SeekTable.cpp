@@ -0,0 +1,58 @@
+#include "SeekTable.h"
+#include <SD.h>
+#include "Log.h"
+#include "datatypes.h"
+
+static bool readEntry(File& table, uint32_t index, uint32_t* offset){
+  return table.seek(sizeof(SeekTableHeader) + index * sizeof(uint32_t)) && table.read((uint8_t*)offset, sizeof(uint32_t)) == sizeof(uint32_t);
+}
+
+bool SeekTableFind(const char* samplePath, uint32_t sampleSize, uint32_t* entry, uint32_t samples, uint32_t position, int16_t seconds, uint32_t* offset){
+  char path[PLAYBACK_PATH_MAX];
+  const char* dot = strrchr(samplePath, '.');
+  size_t len = dot ? dot - samplePath : strlen(samplePath);
+  if (len + sizeof(SEEK_TABLE_EXTENSION) > sizeof(path)) return false;
+  memcpy(path, samplePath, len);
+  strcpy(path + len, SEEK_TABLE_EXTENSION);
+
+  File table = SD.open(path, FILE_READ);
+  if (!table) return false;
+  SeekTableHeader header;
+  bool valid = table.read((uint8_t*)&header, sizeof(header)) == sizeof(header) && memcmp(header.magic, "LDS1", 4) == 0 &&
+    header.entryCount && header.sampleRate && header.samplesPerFrame && header.framesPerEntry;
+  if (valid && header.sampleSize != sampleSize){
+    LOG_WARN("Seek table '%s' is for another version of the sample", path);
+    valid = false;
+  }
+  if (!valid){
+    table.close();
+    return false;
+  }
+
+  uint32_t entrySamples = (uint32_t)header.samplesPerFrame * header.framesPerEntry;
+  uint32_t current;
+  if (*entry != SEEK_ENTRY_UNKNOWN){
+    current = *entry + samples / entrySamples;
+  }
+  else {
+    //last entry at or before position
+    uint32_t first = 0, last = header.entryCount - 1, candidate;
+    while (first < last){
+      uint32_t middle = (first + last + 1) / 2;
+      if (!readEntry(table, middle, &candidate)) break;
+      if (candidate <= position) first = middle;
+      else last = middle - 1;
+    }
+    current = first;
+  }
+  if (current > header.entryCount - 1) current = header.entryCount - 1;
+  //entries to skip, at least one so a short skip still moves
+  int32_t skip = ((int32_t)abs(seconds) * header.sampleRate + entrySamples / 2) / entrySamples;
+  if (!skip) skip = 1;
+  int32_t target = (int32_t)current + (seconds < 0 ? -skip : skip);
+  target = constrain(target, 0, (int32_t)header.entryCount - 1);
+  bool found = readEntry(table, target, offset);
+  table.close();
+  if (found) *entry = target;
+  return found;
+}
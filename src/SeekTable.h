@@ -0,0 +1,35 @@
+#ifndef SEEKTABLE_H_
+#define SEEKTABLE_H_
+
+#include <Arduino.h>
+
+//Seek tables for skipping through long MP3 samples, written by tools/mp3_seektable.py next
+//to the sample: /7.mp3 gets /7.sek. The file holds a SeekTableHeader and the byte offset of
+//every framesPerEntry-th frame. The player keeps the entry its decoder started at (0 for the
+//start of the sample, the target of the last skip) and counts the frames decoded since, so a
+//skip reads the header and exactly one entry, then seeks once in the sample and the decoder
+//syncs on a single frame, wherever in the sample it lands. Only after a warm-boot resume,
+//which restarts at a saved byte offset, the first skip has to search the table for it.
+//The table is read from the card on every skip, nothing stays in RAM.
+#define SEEK_TABLE_EXTENSION ".sek"
+#define SEEK_ENTRY_UNKNOWN 0xFFFFFFFF
+
+struct SeekTableHeader{
+  char magic[4]; //"LDS1"
+  uint32_t sampleSize; //size of the mp3 it was made for, a replaced sample makes it stale
+  uint16_t sampleRate;
+  uint16_t samplesPerFrame;
+  uint16_t framesPerEntry;
+  uint16_t reserved;
+  uint32_t entryCount;
+  //followed by entryCount uint32_t file offsets
+};
+
+//offset to continue samplePath at, seconds (negative: back) away from the frame the decoder
+//is at: samples (per channel) decoded after table entry *entry, or at byte position when *entry
+//is SEEK_ENTRY_UNKNOWN.
+//*entry becomes the entry of the offset. False when the sample has no table or it does not
+//match the sample.
+bool SeekTableFind(const char* samplePath, uint32_t sampleSize, uint32_t* entry, uint32_t samples, uint32_t position, int16_t seconds, uint32_t* offset);
+
+#endif
@@ -0,0 +1,91 @@
+#include "StatusLed.h"
+#include "I2CTrace.h"
+
+const LedStep LED_PATTERN_ACK[LED_PATTERN_ACK_STEPS] = {{LOW, 500}, {HIGH, 500}};
+const LedStep LED_PATTERN_ERROR[LED_PATTERN_ERROR_STEPS] = {{LOW, 200}, {HIGH, 200}};
+
+ExpanderPort::ExpanderPort(PCF8574* expander, uint8_t address)
+{
+  _expander = expander;
+  _address = address;
+}
+
+bool ExpanderPort::writePin(uint8_t pin, uint8_t level)
+{
+  uint8_t bit = 1 << pin;
+  if ((_known & bit) && ((_outputs & bit) != 0) == (level != LOW)) return true;
+  I2C_TRACE_START();
+  bool ok = _expander->digitalWrite(pin, level);
+  I2C_TRACE_RECORD(_address, bit, level, ok ? I2C_OP_EXPANDER_WRITE : I2C_OP_EXPANDER_WRITE | I2C_OP_ERROR);
+  _writes++;
+  //a failed write is retried on the next call
+  if (!ok){
+    _known &= ~bit;
+    return false;
+  }
+  _known |= bit;
+  if (level == LOW) _outputs &= ~bit;
+  else _outputs |= bit;
+  return true;
+}
+
+uint8_t ExpanderPort::getOutputs()
+{
+  return _outputs;
+}
+
+uint32_t ExpanderPort::getWrites()
+{
+  return _writes;
+}
+
+StatusLed::StatusLed(ExpanderPort* port, uint8_t pin)
+{
+  _port = port;
+  _pin = pin;
+}
+
+void StatusLed::set(uint8_t level)
+{
+  _level = level;
+  if (!_pattern) _port->writePin(_pin, level);
+}
+
+void StatusLed::play(const LedStep* pattern, uint8_t steps, uint8_t repeats)
+{
+  if (!steps || !repeats) return;
+  _pattern = pattern;
+  _steps = steps;
+  _step = 0;
+  _repeats = repeats;
+  _stepMillis = millis();
+  _port->writePin(_pin, pattern[0].level);
+}
+
+bool StatusLed::isPlaying()
+{
+  return _pattern != NULL;
+}
+
+void StatusLed::run()
+{
+  if (!_pattern) return;
+  unsigned long now = millis();
+  //catch up if loop() was away longer than a step
+  while (_pattern && now - _stepMillis >= _pattern[_step].millis){
+    _stepMillis += _pattern[_step].millis;
+    if (++_step == _steps){
+      _step = 0;
+      if (--_repeats == 0) _pattern = NULL;
+    }
+  }
+  _port->writePin(_pin, _pattern ? _pattern[_step].level : _level);
+}
+
+void StatusLed::finish()
+{
+  while (_pattern){
+    run();
+    delay(10);
+  }
+}
@@ -0,0 +1,61 @@
+#ifndef STATUSLED_H_
+#define STATUSLED_H_
+
+#include <Arduino.h>
+#include "PCF8574.h"
+
+//Cached view of the GPIO expander outputs. A pin is only written over I2C when its level
+//actually changes, so code that sets the same level on every loop() pass costs nothing.
+class ExpanderPort
+{
+public:
+  ExpanderPort(PCF8574* expander, uint8_t address);
+  bool writePin(uint8_t pin, uint8_t level);
+  uint8_t getOutputs(); //cached levels, bit n is pin n
+  uint32_t getWrites(); //I2C writes actually issued
+
+protected:
+  PCF8574* _expander;
+  uint8_t _address;
+  uint8_t _outputs = 0;
+  uint8_t _known = 0; //pins written at least once, the power-on level is not trusted
+  uint32_t _writes = 0;
+};
+
+//one step of a blink pattern, the LED is active low
+struct LedStep{
+  uint8_t level;
+  uint16_t millis;
+};
+
+extern const LedStep LED_PATTERN_ACK[];   //slow blink, 5 times in 5 s
+extern const LedStep LED_PATTERN_ERROR[]; //fast blink, 5 times in 2 s
+#define LED_PATTERN_ACK_STEPS 2
+#define LED_PATTERN_ERROR_STEPS 2
+
+//Plays blink patterns from loop() without blocking. Outside a pattern the LED follows the
+//level last given to set().
+class StatusLed
+{
+public:
+  StatusLed(ExpanderPort* port, uint8_t pin);
+  void set(uint8_t level);
+  void play(const LedStep* pattern, uint8_t steps, uint8_t repeats);
+  bool isPlaying();
+  //advances the pattern, call from loop()
+  void run();
+  //blocks until the pattern is done, for right before a reset
+  void finish();
+
+protected:
+  ExpanderPort* _port;
+  uint8_t _pin;
+  uint8_t _level = HIGH;
+  const LedStep* _pattern = NULL;
+  uint8_t _steps = 0;
+  uint8_t _step = 0;
+  uint8_t _repeats = 0;
+  unsigned long _stepMillis = 0;
+};
+
+#endif
@@ -0,0 +1,202 @@
+#include "VoiceRecorder.h"
+#include "Metrics.h"
+#include "Log.h"
+
+static inline void writeLE16(uint8_t *p, uint16_t value){
+  p[0] = value;
+  p[1] = value >> 8;
+}
+
+static inline void writeLE32(uint8_t *p, uint32_t value){
+  writeLE16(p, value);
+  writeLE16(p + 2, value >> 16);
+}
+
+//the directory is read once, after that the number just counts up
+bool VoiceRecorder::_nextPath()
+{
+  if (!SD.exists(RECORD_DIR) && !SD.mkdir(RECORD_DIR)) return false;
+  if (_lastNumber < 0){
+    _lastNumber = 0;
+    File dir = SD.open(RECORD_DIR);
+    File entry;
+    while ((entry = dir.openNextFile())){
+      int number = atoi(entry.name());
+      if (number > _lastNumber) _lastNumber = number;
+      entry.close();
+    }
+    dir.close();
+  }
+  if (_lastNumber >= 9999) return false;
+  snprintf(_path, sizeof(_path), RECORD_DIR "/%04d.wav", ++_lastNumber);
+  return true;
+}
+
+//RIFF, fmt and fact chunks, a JUNK chunk up to the end of the sector and the data chunk header
+void VoiceRecorder::_buildHeader(uint8_t *header, uint32_t samples, uint32_t blocks)
+{
+  uint32_t dataSize = blocks * RECORD_BLOCK_SIZE;
+  memset(header, 0, RECORD_BLOCK_SIZE);
+  memcpy(header, "RIFF", 4);
+  writeLE32(header + 4, RECORD_BLOCK_SIZE - 8 + dataSize);
+  memcpy(header + 8, "WAVE", 4);
+  memcpy(header + 12, "fmt ", 4);
+  writeLE32(header + 16, 20);
+  writeLE16(header + 20, 0x11); //IMA-ADPCM
+  writeLE16(header + 22, 1);
+  writeLE32(header + 24, RECORD_SAMPLE_RATE);
+  writeLE32(header + 28, (uint32_t)RECORD_SAMPLE_RATE * RECORD_BLOCK_SIZE / RECORD_BLOCK_SAMPLES);
+  writeLE16(header + 32, RECORD_BLOCK_SIZE);
+  writeLE16(header + 34, 4);
+  writeLE16(header + 36, 2);
+  writeLE16(header + 38, RECORD_BLOCK_SAMPLES);
+  memcpy(header + 40, "fact", 4);
+  writeLE32(header + 44, 4);
+  writeLE32(header + 48, samples);
+  memcpy(header + 52, "JUNK", 4);
+  writeLE32(header + 56, RECORD_BLOCK_SIZE - 68);
+  memcpy(header + RECORD_BLOCK_SIZE - 8, "data", 4);
+  writeLE32(header + RECORD_BLOCK_SIZE - 4, dataSize);
+}
+
+bool VoiceRecorder::start(MicSource *mic)
+{
+  if (_recording || !mic || !_nextPath()) return false;
+  //FILE_WRITE is append mode, every write would go to the end and stop() could not patch the header
+  _file = SDFS.open(_path, "w+");
+  if (!_file) return false;
+  //sizes are filled in by stop()
+  _buildHeader(_blocks[0], 0, 0);
+  if (_file.write(_blocks[0], RECORD_BLOCK_SIZE) != RECORD_BLOCK_SIZE || !mic->begin(RECORD_SAMPLE_RATE)){
+    _file.close();
+    SD.remove(_path);
+    LOG_ERROR("Cannot record to %s", _path);
+    return false;
+  }
+  _mic = mic;
+  _encoder = ImaAdpcmEncoder();
+  _writeIndex = 0;
+  _full = 0;
+  _fillSamples = 0;
+  _samples = 0;
+  _blocksWritten = 0;
+  _writeError = false;
+  _recording = true;
+  _stats.messages++;
+  LOG_INFO("Recording %s", _path);
+  return true;
+}
+
+void VoiceRecorder::_encode(int16_t sample)
+{
+  uint8_t *block = _blocks[(_writeIndex + _full) & 1];
+  if (_fillSamples == 0){
+    //block header: the first sample as is and the step index to continue with
+    _encoder.predictor = sample;
+    writeLE16(block, sample);
+    block[2] = _encoder.stepIndex;
+    block[3] = 0;
+  }
+  else {
+    uint16_t k = _fillSamples - 1;
+    uint8_t nibble = _encoder.encode(sample);
+    uint8_t *p = block + 4 + (k >> 1);
+    *p = (k & 1) ? (*p | nibble << 4) : nibble;
+  }
+  _samples++;
+  if (++_fillSamples == RECORD_BLOCK_SAMPLES){
+    _fillSamples = 0;
+    _full++;
+  }
+}
+
+bool VoiceRecorder::_writeBlock()
+{
+  uint32_t start = micros();
+  size_t written = _file.write(_blocks[_writeIndex], RECORD_BLOCK_SIZE);
+  uint32_t took = micros() - start;
+  MetricObserve(MET_RECORD_WRITE_US, took);
+  if (took > _stats.worstWriteMicros) _stats.worstWriteMicros = took;
+  _writeIndex ^= 1;
+  _full--;
+  _blocksWritten++;
+  _stats.blocksWritten++;
+  return written == RECORD_BLOCK_SIZE;
+}
+
+void VoiceRecorder::pump()
+{
+  if (!_recording) return;
+  //the queue is at its fullest right after the previous pass wrote a block
+  uint16_t queued = _mic->getQueued();
+  if (queued > _stats.worstQueued) _stats.worstQueued = queued;
+
+  int16_t samples[RECORD_READ_CHUNK];
+  while (_full < 2){
+    uint16_t count = _mic->read(samples, min(RECORD_READ_CHUNK, RECORD_BLOCK_SAMPLES - _fillSamples));
+    if (!count) break;
+    uint32_t start = ESP.getCycleCount();
+    for (uint16_t i = 0; i < count; i++) _encode(samples[i]);
+    _stats.encodeCycles += ESP.getCycleCount() - start;
+    _stats.encodedSamples += count;
+  }
+  if (_full && !_writeBlock()){
+    LOG_ERROR("SD write failed, %s ends here", _path);
+    _writeError = true;
+    stop();
+    return;
+  }
+  if (_samples >= (uint32_t)RECORD_MAX_SECONDS * RECORD_SAMPLE_RATE || _mic->isDone()) stop();
+}
+
+void VoiceRecorder::stop()
+{
+  if (!_recording) return;
+  _recording = false;
+  _mic->end();
+  _stats.overruns += _mic->getOverruns();
+  //the last block is padded with the last sample, a flat line decodes as silence
+  uint32_t samples = _samples;
+  int16_t last = _encoder.predictor;
+  while (_fillSamples) _encode(last);
+  _samples = samples;
+  while (_full && !_writeError) _writeError = !_writeBlock();
+  _buildHeader(_blocks[0], _samples, _blocksWritten);
+  _file.seek(0);
+  _file.write(_blocks[0], RECORD_BLOCK_SIZE);
+  _file.close();
+  LOG_INFO("Message %s: %u s, %u samples dropped", _path, getSeconds(), _mic->getOverruns());
+}
+
+bool VoiceRecorder::checkMessage()
+{
+  if (_recording || !_path[0]) return false;
+  File file = SD.open(_path, FILE_READ);
+  if (!file) return false;
+  //both blocks are free between messages
+  bool ok = file.size() == (uint32_t)RECORD_BLOCK_SIZE * (_blocksWritten + 1) &&
+    file.read(_blocks[1], RECORD_BLOCK_SIZE) == RECORD_BLOCK_SIZE;
+  file.close();
+  _buildHeader(_blocks[0], _samples, _blocksWritten);
+  return ok && memcmp(_blocks[0], _blocks[1], RECORD_BLOCK_SIZE) == 0;
+}
+
+bool VoiceRecorder::isRecording()
+{
+  return _recording;
+}
+
+const char *VoiceRecorder::getPath()
+{
+  return _path;
+}
+
+uint32_t VoiceRecorder::getSeconds()
+{
+  return _samples / RECORD_SAMPLE_RATE;
+}
+
+const RecorderStats *VoiceRecorder::getStats()
+{
+  return &_stats;
+}
@@ -0,0 +1,74 @@
+#ifndef VOICERECORDER_H_
+#define VOICERECORDER_H_
+
+#include <Arduino.h>
+#include <SD.h>
+#include "ImaAdpcm.h"
+#include "MicSource.h"
+
+//Records voice messages as IMA-ADPCM WAV files /msg/0001.wav, /msg/0002.wav, ... that
+//WavGenerator plays back. An ADPCM block is exactly one SD sector and the WAV header is
+//padded to one sector, so every write is a whole, aligned sector.
+//
+//Two blocks are double-buffered: pump() encodes into one while the other waits for its SD
+//write. A slow write only delays encoding, the mic queue (MIC_RING_SAMPLES) holds the samples
+//that arrive in the meantime. Write stalls go to the ledafoon_record_write_us histogram and
+//the fullest the mic queue got is kept, so a card that comes close to dropping audio shows
+//before it does.
+#define RECORD_SAMPLE_RATE 8000
+#define RECORD_BLOCK_SIZE 512
+#define RECORD_BLOCK_SAMPLES ((RECORD_BLOCK_SIZE - 4) * 2 + 1) //the block header holds the first sample
+#define RECORD_MAX_SECONDS 120
+#define RECORD_DIR "/msg"
+#define RECORD_PATH_MAX 16
+#define RECORD_READ_CHUNK 64 //samples fetched from the mic at a time
+
+struct RecorderStats{
+  uint32_t messages;
+  uint32_t encodedSamples; //all messages
+  uint64_t encodeCycles; //cpu cycles spent in the encoder, for all messages
+  uint32_t blocksWritten;
+  uint32_t worstWriteMicros;
+  uint16_t worstQueued; //fullest the mic queue got, in samples
+  uint32_t overruns; //samples the mic dropped
+};
+
+class VoiceRecorder
+{
+public:
+  //opens the next numbered file and starts the mic
+  bool start(MicSource *mic);
+  //call from loop(): encodes what the mic collected and writes at most one block
+  void pump();
+  //pads and writes the last block, fills in the header and closes the file
+  void stop();
+  //reads the last message back: the header stop() wrote at the start and nothing after the blocks
+  bool checkMessage();
+  bool isRecording();
+  const char *getPath();
+  uint32_t getSeconds(); //length of the current or last message
+  const RecorderStats *getStats();
+
+protected:
+  bool _nextPath();
+  void _buildHeader(uint8_t *header, uint32_t samples, uint32_t blocks);
+  void _encode(int16_t sample);
+  bool _writeBlock();
+
+  MicSource *_mic = NULL;
+  File _file;
+  bool _recording = false;
+  char _path[RECORD_PATH_MAX] = "";
+  int _lastNumber = -1; //highest message number on the card, -1 until the directory was read
+  ImaAdpcmEncoder _encoder;
+  uint8_t _blocks[2][RECORD_BLOCK_SIZE];
+  uint8_t _writeIndex = 0; //oldest full block
+  uint8_t _full = 0; //blocks waiting for the SD card
+  uint16_t _fillSamples = 0; //samples in the block being encoded
+  uint32_t _samples = 0;
+  uint32_t _blocksWritten = 0;
+  bool _writeError = false;
+  RecorderStats _stats = {};
+};
+
+#endif
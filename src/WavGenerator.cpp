@@ -0,0 +1,228 @@
+#include "WavGenerator.h"
+#include "ImaAdpcm.h"
+
+static inline uint16_t readLE16(const uint8_t* p){
+  return p[0] | (p[1] << 8);
+}
+
+static inline uint32_t readLE32(const uint8_t* p){
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+WavGenerator::WavGenerator()
+{
+  running = false;
+  file = NULL;
+  output = NULL;
+}
+
+WavGenerator::~WavGenerator()
+{
+  stop();
+}
+
+bool WavGenerator::stop()
+{
+  running = false;
+  if (!file || !output) return true;
+  output->stop();
+  return file->close();
+}
+
+bool WavGenerator::isRunning()
+{
+  return running;
+}
+
+uint16_t WavGenerator::getFormat()
+{
+  return _format;
+}
+
+bool WavGenerator::readFully(void *data, uint32_t len)
+{
+  uint8_t *p = reinterpret_cast<uint8_t *>(data);
+  while (len){
+    uint32_t read = file->read(p, len);
+    if (!read) return false;
+    p += read;
+    len -= read;
+  }
+  return true;
+}
+
+bool WavGenerator::readHeader()
+{
+  uint8_t header[20];
+  if (!readFully(header, 12) || memcmp(header, "RIFF", 4) != 0 || memcmp(header + 8, "WAVE", 4) != 0) return false;
+  _format = 0;
+  while (readFully(header, 8)){
+    uint32_t size = readLE32(header + 4);
+    if (memcmp(header, "fmt ", 4) == 0){
+      if (size < 16) return false;
+      uint32_t len = min(size, (uint32_t)sizeof(header));
+      if (!readFully(header, len)) return false;
+      _format = readLE16(header);
+      _channels = readLE16(header + 2);
+      _sampleRate = readLE32(header + 4);
+      _blockAlign = readLE16(header + 12);
+      _bitsPerSample = readLE16(header + 14);
+      size -= len;
+    }
+    else if (memcmp(header, "data", 4) == 0){
+      _dataStart = file->getPos();
+      _dataSize = size;
+      return _format != 0;
+    }
+    //chunks are padded to an even size
+    if (size && !file->seek(size + (size & 1), SEEK_CUR)) return false;
+  }
+  return false;
+}
+
+bool WavGenerator::begin(AudioFileSource *source, AudioOutput *output)
+{
+  if (!source || !output) return false;
+  file = source;
+  this->output = output;
+  if (!file->isOpen() || !readHeader()){
+    audioLogger->printf_P(PSTR("WAV: no valid header\n"));
+    return false;
+  }
+  bool supported = _channels >= 1 && _channels <= 2 && _sampleRate &&
+    ((_format == WAV_FORMAT_PCM && (_bitsPerSample == 8 || _bitsPerSample == 16)) ||
+     (_format == WAV_FORMAT_IMA_ADPCM && _bitsPerSample == 4 && _blockAlign > 4 * _channels && _blockAlign <= WAV_BUFFER_SIZE));
+  if (!supported){
+    audioLogger->printf_P(PSTR("WAV: format %u, %u bit, %u channels not supported\n"), _format, _bitsPerSample, _channels);
+    return false;
+  }
+  _dataRead = 0;
+  _bufferLen = 0;
+  _bufferPos = 0;
+  _blockSamples = 0;
+  output->SetRate(_sampleRate);
+  output->SetBitsPerSample(16);
+  output->SetChannels(2);
+  if (!output->begin()) return false;
+  _framesLen = 0;
+  _framesPos = 0;
+  running = true;
+  return true;
+}
+
+bool WavGenerator::seekToFilePosition(uint32_t position)
+{
+  if (!running) return false;
+  uint32_t offset = position > _dataStart ? position - _dataStart : 0;
+  uint32_t unit = _format == WAV_FORMAT_IMA_ADPCM ? _blockAlign : _channels * _bitsPerSample / 8;
+  offset -= offset % unit;
+  if (offset >= _dataSize) return false;
+  if (!file->seek(_dataStart + offset, SEEK_SET)) return false;
+  _dataRead = offset;
+  _bufferLen = 0;
+  _bufferPos = 0;
+  _blockSamples = 0;
+  _framesLen = 0;
+  _framesPos = 0;
+  return true;
+}
+
+//next ADPCM block, or the next run of PCM frames
+bool WavGenerator::fillBuffer()
+{
+  uint32_t remaining = _dataSize - _dataRead;
+  uint32_t len;
+  if (_format == WAV_FORMAT_IMA_ADPCM){
+    len = min(remaining, (uint32_t)_blockAlign);
+    if (len <= 4u * _channels) return false;
+  }
+  else {
+    uint16_t frame = _channels * _bitsPerSample / 8;
+    len = min(remaining, (uint32_t)(sizeof(_buffer) - sizeof(_buffer) % frame));
+    len -= len % frame;
+    if (!len) return false;
+  }
+  if (!readFully(_buffer, len)) return false;
+  _dataRead += len;
+  _bufferLen = len;
+  _bufferPos = 0;
+  if (_format == WAV_FORMAT_IMA_ADPCM){
+    //every channel starts with its predictor and step index, which is also the first sample
+    for (uint8_t c = 0; c < _channels; c++){
+      _predictor[c] = (int16_t)readLE16(_buffer + 4 * c);
+      _stepIndex[c] = min(_buffer[4 * c + 2], (uint8_t)IMA_STEP_INDEX_MAX);
+    }
+    _blockSamples = (len - 4 * _channels) * 2 / _channels + 1;
+  }
+  return true;
+}
+
+int16_t WavGenerator::decodeNibble(uint8_t channel, uint8_t nibble)
+{
+  int32_t step = pgm_read_word(&imaStepTable[_stepIndex[channel]]);
+  int32_t diff = step >> 3;
+  if (nibble & 1) diff += step >> 2;
+  if (nibble & 2) diff += step >> 1;
+  if (nibble & 4) diff += step;
+  int32_t predictor = _predictor[channel] + ((nibble & 8) ? -diff : diff);
+  if (predictor > 32767) predictor = 32767;
+  else if (predictor < -32768) predictor = -32768;
+  _predictor[channel] = predictor;
+  int8_t index = _stepIndex[channel] + imaIndexTable[nibble];
+  _stepIndex[channel] = index < 0 ? 0 : (index > IMA_STEP_INDEX_MAX ? IMA_STEP_INDEX_MAX : index);
+  return predictor;
+}
+
+bool WavGenerator::getOneSample(int16_t sample[2])
+{
+  if (_format == WAV_FORMAT_IMA_ADPCM){
+    if (_bufferPos >= _blockSamples && !fillBuffer()) return false;
+    if (_bufferPos == 0){
+      for (uint8_t c = 0; c < _channels; c++) sample[c] = _predictor[c];
+    }
+    else {
+      //after the headers the channels take turns with 4 bytes (8 samples), low nibble first
+      uint16_t k = _bufferPos - 1;
+      for (uint8_t c = 0; c < _channels; c++){
+        uint8_t byte = _buffer[4 * _channels * (1 + (k >> 3)) + 4 * c + ((k & 7) >> 1)];
+        sample[c] = decodeNibble(c, (k & 1) ? byte >> 4 : byte & 0x0F);
+      }
+    }
+    _bufferPos++;
+  }
+  else {
+    if (_bufferPos >= _bufferLen && !fillBuffer()) return false;
+    for (uint8_t c = 0; c < _channels; c++){
+      if (_bitsPerSample == 16){
+        sample[c] = (int16_t)readLE16(_buffer + _bufferPos);
+        _bufferPos += 2;
+      }
+      else {
+        sample[c] = ((int16_t)_buffer[_bufferPos++] - 128) << 8;
+      }
+    }
+  }
+  if (_channels == 1) sample[AudioOutput::RIGHTCHANNEL] = sample[AudioOutput::LEFTCHANNEL];
+  return true;
+}
+
+bool WavGenerator::loop()
+{
+  while (running){
+    if (_framesPos == _framesLen){
+      _framesPos = 0;
+      _framesLen = 0;
+      while (_framesLen < WAV_BLOCK_FRAMES && getOneSample(_frames[_framesLen])) _framesLen++;
+      if (!_framesLen){
+        running = false;
+        break;
+      }
+    }
+    //outputs without a block path take them one by one, see AudioOutput::ConsumeSamples()
+    _framesPos += output->ConsumeSamples(_frames[_framesPos], _framesLen - _framesPos);
+    if (_framesPos < _framesLen) break;
+  }
+  if (file) file->loop();
+  if (output) output->loop();
+  return running;
+}
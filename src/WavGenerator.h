@@ -0,0 +1,58 @@
+#ifndef WAVGENERATOR_H_
+#define WAVGENERATOR_H_
+
+#include <Arduino.h>
+#include "AudioGenerator.h"
+
+//Generator for WAV samples in 8/16 bit PCM or 4 bit IMA-ADPCM. PCM needs no decoding and
+//IMA-ADPCM only a table lookup and a few shifts and adds per sample, against the full
+//MP3 synthesis, so speech samples cost a fraction of the cpu time. All buffers are part of
+//the object, begin() does not allocate.
+//tools/transcode_samples.py picks the format per sample.
+
+#define WAV_FORMAT_PCM 0x0001
+#define WAV_FORMAT_IMA_ADPCM 0x0011
+#define WAV_BUFFER_SIZE 1024 //largest ADPCM block we play, the encoder writes 512 bytes
+#define WAV_BLOCK_FRAMES 32 //decoded ahead and handed to the output at once
+
+class WavGenerator : public AudioGenerator
+{
+public:
+  WavGenerator();
+  virtual ~WavGenerator() override;
+  virtual bool begin(AudioFileSource *source, AudioOutput *output) override;
+  virtual bool loop() override;
+  virtual bool stop() override;
+  virtual bool isRunning() override;
+  //continues from a byte offset of the file (rounded down to a block), after begin()
+  bool seekToFilePosition(uint32_t position);
+  uint16_t getFormat();
+
+protected:
+  bool readHeader();
+  bool readFully(void *data, uint32_t len);
+  bool fillBuffer();
+  bool getOneSample(int16_t sample[2]);
+  int16_t decodeNibble(uint8_t channel, uint8_t nibble);
+
+  uint16_t _format = 0;
+  uint16_t _channels = 0;
+  uint16_t _bitsPerSample = 0;
+  uint16_t _blockAlign = 0;
+  uint32_t _sampleRate = 0;
+  uint32_t _dataStart = 0;
+  uint32_t _dataSize = 0;
+  uint32_t _dataRead = 0;
+
+  uint8_t _buffer[WAV_BUFFER_SIZE];
+  uint16_t _bufferLen = 0;
+  uint16_t _bufferPos = 0; //PCM: byte in the buffer, ADPCM: sample in the block
+  uint16_t _blockSamples = 0;
+  int16_t _frames[WAV_BLOCK_FRAMES][2]; //always stereo, mono is duplicated
+  uint16_t _framesLen = 0;
+  uint16_t _framesPos = 0; //first frame the output has not taken yet
+  int16_t _predictor[2];
+  uint8_t _stepIndex[2];
+};
+
+#endif
@@ -8,4 +8,32 @@ struct WiFiSecrets{
   String Pass;
 };
 
+//sample formats in the order a lookup tries them, cheapest to decode first
+enum SampleFormat{
+  SAMPLE_WAV = 0, //PCM or IMA-ADPCM
+  SAMPLE_MP3,
+  SAMPLE_FORMAT_COUNT,
+  SAMPLE_FORMAT_UNKNOWN = 0xFF
+};
+
+//what we know about the samples on the SD card without scanning it again
+struct SampleIndexSummary{
+  uint16_t count; //number of <digits>.<mp3|wav> samples in the root
+  uint8_t maxDigits;
+  uint8_t formatMask; //bit n set when the root holds any sample in SampleFormat n
+  uint32_t lengthMask; //bit n set when there is a sample with n digits
+  uint32_t totalKBytes;
+};
+
+struct SDSettings{
+  uint8_t spiMHz; //fastest SPI clock that passed the read test at cold boot
+};
+
+#define PLAYBACK_PATH_MAX 32
+struct PlaybackState{
+  char path[PLAYBACK_PATH_MAX];
+  uint32_t position; //byte offset in the file
+  bool playing;
+};
+
 #endif /* ifndef FORECAST_RECORD_H_ */
@@ -6,38 +6,75 @@
 #define FIRMWARE_VERSION "1.0.0"
 //#define Ledafoon1 //rode telefoon is 1, andere is de Siemens 
 
-//defines for timsyncing (not used at the moment yet)
+//#define ENABLE_WIFI //connect to the stored WiFi network and sync the time in the background
+
+//defines for timsyncing
 #define MAXSLEEPWITHOUTSYNC 24*60* 60 //standard setting Maximum 24 hours without a timesync. If this time gets exceeded a timesync will be forced. 
 #define TIMEZONE TZ_Europe_Brussels
 
-// You may need a fast SD card. Set this as high as it will work (40MHz max).
-#define SPI_SPEED SD_SCK_MHZ(10)
+// The SD clock is calibrated at cold boot (40MHz max, see CalibrateSDSpeed) and kept in RTC RAM.
 #define SPI_CS_PIN D0
 
 #define WIFI_RESET_KEY 's' //button to reset microcontroller to reset WiFiManger
 #define OTA_KEY '#' //button to open OTA over Access point and webserver on port 80
 #define SDCARD_UPDATE_KEY 'R' //button to execute a update of the firmare from a firmware.bin file on the SD card
+#define BOOTKEY_HOLD_MILLIS 3000 //how long a boot key needs to be held during power-on
+#define KEY_DEBOUNCE_MILLIS 250 //after boot, the boot key scan and hold read the keypad without it
 #define LONGPRESS_TIME_SECONDS 5 //how long the reset button needs to be pushed in order for the reset routine to be triggered
+//#define ROTARY_DIAL //a rotary dial instead of the keypad, its pulse contact on P1 of the GPIO expander
+#define ROTARY_PULSE_PIN 1
+//-DROTARY_PULSE_GPIO=<pin> puts the pulse contact on an ESP GPIO with its own interrupt instead,
+//the expander is only read once per loop() pass, see RotaryDial.h
+#define I2C_CLOCK_HZ 400000 //at 80MHz, see OnClockChange()
+#define RECORD_NUMBER "777332226667773" //record in nokia keypad presses: leaves a voice message, the sample with this name is the greeting
+//#define RECORD_FROM_FILE "/mic.wav" //records this 16 bit 8kHz WAV from the SD card instead of the microphone on A0
+#define KEY_CLICK_PATH "/click.wav" //when on the SD card, mixed over whatever plays on every key press
+#define SEEK_BACK_KEY '4' //while a sample with a seek table plays, these skip instead of dialing, see SeekTable.h
+#define SEEK_FORWARD_KEY '6'
+#define SEEK_SKIP_SECONDS 10
+#define PLAYBACK_SAVE_INTERVAL_MILLIS 1000 //how often the play position of a sample is saved to RTC RAM for a warm boot
 
 //******************************************************************
 // includes
 //******************************************************************
 
 #include <Arduino.h>
-#include "AudioFileSourceSD.h"
-#include "AudioOutputI2S.h"
+#include "PhoneAudio.h"
+#include "AudioMixer.h"
 #include "AudioGeneratorMP3.h"
 #include "AudioFileSourceID3.h"
+#include "WavGenerator.h"
 #include "datatypes.h"
 #include "FSOperations.h"
-#include "WiFiManager/defines.h"
-#include "WiFiManager/Credentials.h"
-#include "WiFiManager/dynamicParams.h"
+#include "FirmwareUpdate.h"
+#include "DeltaUpdate.h"
+#include "SampleUpload.h"
+#include "SampleBrowser.h"
+#include "BootTimeline.h"
+#include "RTCRAM.h"
+#include "SampleIndex.h"
+#include "Metrics.h"
+#include "KeyInjector.h"
+#include "LatencyBench.h"
+#include "AllocGate.h"
+#include "AudioCapture.h"
+#include "Log.h"
+#include "Connectivity.h"
+#include "PowerGovernor.h"
+#include "I2CTrace.h"
+#include "RotaryDial.h"
+#include "VoiceRecorder.h"
+#include "IvrMenu.h"
+#include "MicSource.h"
+#include "SeekTable.h"
+#include <new> //placement new of the ID3 parser, see OpenSample()
 #include <time.h>   //for doing time stuff
 #include <TZ.h>      //timezones
 #include "Wire.h"
 #include "PhoneKeypad.h"
 #include "PCF8574.h"
+#include "StatusLed.h"
+#include <ESP8266WiFi.h>
 #include <ESPAsyncTCP.h>
 #include <ESPAsyncWebServer.h>
 #include <AsyncElegantOTA.h>
@@ -47,21 +84,48 @@
 //Function Declatarions (for Platform IO compatibilty)
 //******************************************************************
 //Functions related to WiFi Manager
-void ConnectToWifi(); //Does what it says, goes to deepsleep if unsuccessful
-void RunWiFiManager(); //runs in case of hard reset (5 seconds) or first boot (no files in filesystem)
-void ResetWifiRoutine(); //
+void ResetWifiRoutine(); //removes the stored credentials and opens the config portal
+//Webserver (OTA and sample upload)
+void StartWebServer();
+void OTAUpdateAP();
+bool isAudioBusy();
 //Time-keeping functions
-void SetupTime(); //configs the time and requests time from server (automatic through time library)
-void NTP_Sync_Callback(); //gets called if UDP timepacket arrives (asynchronous callback)
+void NTP_Sync_Callback(); //called from loop() by the connectivity manager after a time sync
 //Keypad functiond
 void keyChanged();
+void rotaryPulseChanged();
 //Program Functions
 void setup();
 void loop();
+void SetupGauges();
+//Sample playback
+bool OpenSample(const char* path);
+AudioGenerator* selectDecoder(const char* path); //by extension, see SampleIndex.h
+bool playSampleFromPath(const char* path);
+void PlayKeyClick();
+void OnSampleSound(uint16_t framesAfter);
+bool SeekSample(int16_t seconds); //false when the sample cannot skip
+//Voice messages
+void StartMessage(const char* greeting); //greeting sample first, when there is one
+void StartRecording();
+void CheckRecordedMessage();
+//Voice menus
+void RunMenuAction(MenuAction action);
 //SD Card update callback
 void progressCallBack(size_t currSize, size_t totalSize);
+void UpdateSD();
+void UpdateDeltaSD();
+void RollbackSD();
 void LED_Ack();
 void LED_Error();
+//GPIO expander access, traced with -DI2C_TRACE
+bool ReadHookDown();
+uint8_t ReadExpanderInputs();
+void SetLED(uint8_t level);
+//Power management
+void OnClockChange(uint8_t mhz);
+void OnLightSleep();
+bool isNetworkBusy();
 
 
 
@@ -69,26 +133,49 @@ void LED_Error();
 // global variables
 //******************************************************************
 //Variables for WiFi
-ESPAsync_WiFiManager_Lite* ESPAsync_WiFiManager;
-WiFiSecrets wiFiSecrets;
-unsigned long wiFiConnectStartMillis;
+ConnectivityManager connectivity;
+//cpu clock and sleep
+PowerGovernor governor;
 //variables for elegantOTA
 AsyncWebServer* server = NULL;
 bool FWUpdateStarted = false;
+bool deltaUpdateRequested = false; //set by POST /delta, runs from loop()
 //timekeeping variables
-volatile bool rtc_synced = false;   //keeps track if timesync already occured or not.
-bool rtcSyncStarted = false;
 static time_t now;
-String timeString, dateString; // strings to hold time 
+char timeString[30], dateString[30]; // strings to hold time
 int StartTime, CurrentHour = 0, CurrentMin = 0, CurrentSec = 0;
 long CurrentMinuteCounter;
 File dir;
 //Audioplayback variables
-AudioFileSourceSD *source = NULL;
-AudioFileSourceID3 *id3;
+PhoneFileSource *source = NULL;
+PhoneID3Source *id3; //built in id3Space for every sample, see OpenSample()
+alignas(PhoneID3Source) uint8_t id3Space[sizeof(PhoneID3Source)];
 AudioFileSource *mp3;
-AudioOutputI2S *output = NULL;
-AudioGeneratorMP3 *decoder = NULL;
+PhoneAudioOutput *output = NULL;
+AudioMixer *mixer = NULL; //in front of output, the decoders play through voice 0
+MixerVoice *sampleVoice = NULL;
+//decoders, mixer and I2S output together, for ledafoon_audio_chain_cycles_per_second
+uint64_t audioChainCycles = 0;
+uint32_t audioChainFrames = 0;
+uint32_t seekEntry = SEEK_ENTRY_UNKNOWN; //seek table entry the sample decoder started at, see SeekTable.h
+AudioGenerator *decoder = NULL; //one of the generators below, picked per sample
+AudioGeneratorMP3 *mp3Decoder = NULL;
+WavGenerator *wavDecoder = NULL;
+void *decoderSpace = NULL; //the mp3 decoder state, reused for every sample
+//key click on voice 1 of the mixer, only allocated when the SD card has one
+PhoneFileSource *clickSource = NULL;
+WavGenerator *clickDecoder = NULL;
+//voice messages
+VoiceRecorder recorder;
+#ifdef RECORD_FROM_FILE
+FileMicSource mic(RECORD_FROM_FILE);
+#else
+AdcMicSource mic;
+#endif
+bool recordPending = false; //recording starts when the greeting ends
+//voice menus from /menu.json, without them every key dials
+IvrMenu menu;
+bool menuDialing = false; //a dial action hands the keys back to free dialing until hook down
 //Keypad variables
 const uint8_t KEYPAD_ADDRESS = 0x20;
 PhoneKeypad keyPad(KEYPAD_ADDRESS);
@@ -97,13 +184,22 @@ char keys[] = "#AH30582R69Cs471NF@";  // N = NoKey, F = Fail (e.g. >1 keys press
 #else
 char keys[] = "123N456N789NN0NNNF@";  // N = NoKey, F = Fail (e.g. >1 keys pressed), @ = Bounced
 #endif
+RotaryDial rotary; //digits go into keyPad through injectChar()
 volatile bool keyChange = false; // for interrupt in case of a keychange
+volatile uint32_t keyEventMicros = 0; // time of the last keypad interrupt, for the key to audio latency
 bool hornDown = true;
 bool samplePlaying = false;
+//warm boot variables
+bool warmBoot = false;
+bool sameCard = false; //warm boot that was not the reset button, the SD card is the one of the previous run
+PlaybackState playbackState;
+unsigned long playbackSavedMillis = 0;
 //GPIO EXPANDER
 const uint8_t GPIO_ADDRESS = 0x21;
 PCF8574 pcf8574(GPIO_ADDRESS);
+ExpanderPort expanderPort(&pcf8574, GPIO_ADDRESS);
 const uint8_t LEDPIN = 7;
+StatusLed statusLed(&expanderPort, LEDPIN);
 
 
 
@@ -117,170 +213,97 @@ const uint8_t LEDPIN = 7;
 IRAM_ATTR void keyChanged()
 {
   keyChange = true;
+  keyEventMicros = micros();
+  MetricInc(MET_KEY_EVENTS);
 }
 
+#if defined(ROTARY_DIAL) && defined(ROTARY_PULSE_GPIO)
+//every edge of the pulse contact, however long loop() takes
+IRAM_ATTR void rotaryPulseChanged()
+{
+  rotary.edge(micros(), digitalRead(ROTARY_PULSE_GPIO));
+}
+#endif
+
 
 // Called when a metadata event occurs (i.e. an ID3 tag, an ICY block, etc.)
+// runs inside decoder->loop(), so it only formats into the log buffer
 void MDCallback(void *cbData, const char *type, bool isUnicode, const char *string)
 {
   (void)cbData;
-  Serial.printf("ID3 callback for: %s = '", type);
-
+  char value[64];
+  uint8_t len = 0;
 
   if (isUnicode) {
     string += 2;
   }
  
-  while (*string) {
-    char a = *(string++);
-    if (isUnicode) {
+  while (*string && len < sizeof(value) - 1) {
+    value[len++] = *(string++);
+    if (isUnicode && *string) {
       string++;
     }
-    Serial.printf("%c", a);
   }
-  Serial.printf("'\n");
-  Serial.flush();
+  value[len] = '\0';
+  LOG_DEBUG("ID3 %s = '%s'", type, value);
 }
 
-void ConnectToWifi(){
-  WiFi.mode(WIFI_STA); // explicitly set mode, esp defaults to STA+AP
-  if (!SD.exists("/WiFiSecrets.txt")){
-    //TODO: audio signal that wifi was not saved, run the wifimanager
-    Serial.println("No WiFi credentials found, starting Ledafoon Accesspoint");
-    RunWiFiManager();
-  }
-  wiFiSecrets = RecoverWiFiSecrets();
-  WiFi.begin(wiFiSecrets.SSID, wiFiSecrets.Pass);
+void ResetWifiRoutine(){
+  LED_Ack();
+  if (SD.exists("/WiFiSecrets.txt")) SD.remove("/WiFiSecrets.txt");
+  connectivity.startPortal();
 }
 
-void heartBeatPrint()
-{
-  static int num = 1;
-
-  if (WiFi.status() == WL_CONNECTED)
-    Serial.print("H");        // H means connected to WiFi
-  else
-  {
-    if (ESPAsync_WiFiManager->isConfigMode())
-      Serial.print("C");        // C means in Config Mode
-    else
-      Serial.print("F");        // F means not connected to WiFi
-  }
-
-  if (num == 80)
-  {
-    Serial.println();
-    num = 1;
-  }
-  else if (num++ % 10 == 0)
-  {
-    Serial.print(F(" "));
-  }
+bool isAudioBusy(){
+  return (decoder && decoder->isRunning()) || (clickDecoder && clickDecoder->isRunning()) || recorder.isRecording();
 }
 
-void check_status()
-{
-  static unsigned long checkstatus_timeout = 0;
-
-  //KH
-#define HEARTBEAT_INTERVAL    20000L
-  // Print hearbeat every HEARTBEAT_INTERVAL (20) seconds.
-  if ((millis() > checkstatus_timeout) || (checkstatus_timeout == 0))
-  {
-    heartBeatPrint();
-    checkstatus_timeout = millis() + HEARTBEAT_INTERVAL;
-  }
+bool isNetworkBusy(){
+  UploadState upload = GetUploadState();
+  return upload == UPLOAD_RECEIVING || upload == UPLOAD_VERIFYING || deltaUpdateRequested;
 }
 
-#if USING_CUSTOMS_STYLE
-const char NewCustomsStyle[] PROGMEM =
-  "<style>div,input{padding:5px;font-size:1em;}input{width:95%;}body{text-align: center;}"\
-  "button{background-color:blue;color:white;line-height:2.4rem;font-size:1.2rem;width:100%;}fieldset{border-radius:0.3rem;margin:0px;}</style>";
-#endif
-
-
-
-void RunWiFiManager(){
-  //recover all current settings from the installed App's.
-  Serial.print(F("\nStarting ESPAsync_WiFi using "));
-  Serial.print(FS_Name);
-  Serial.print(F(" on "));
-  Serial.println(ARDUINO_BOARD);
-  Serial.println(ESP_ASYNC_WIFI_MANAGER_LITE_VERSION);
-#if USING_MRD
-  Serial.println(ESP_MULTI_RESET_DETECTOR_VERSION);
-#else
-  Serial.println(ESP_DOUBLE_RESET_DETECTOR_VERSION);
-#endif
-  ESPAsync_WiFiManager = new ESPAsync_WiFiManager_Lite();
-  String AP_SSID = "Ledafoon";
-  String AP_PWD  = "Leda12345";
-  // Set customized AP SSID and PWD
-  ESPAsync_WiFiManager->setConfigPortal(AP_SSID, AP_PWD);
-
-  // Optional to change default AP IP(192.168.4.1) and channel(10)
-  //ESPAsync_WiFiManager->setConfigPortalIP(IPAddress(192, 168, 120, 1));
-  ESPAsync_WiFiManager->setConfigPortalChannel(0);
-
-#if USING_CUSTOMS_STYLE
-  ESPAsync_WiFiManager->setCustomsStyle(NewCustomsStyle);
-#endif
-
-#if USING_CUSTOMS_HEAD_ELEMENT
-  ESPAsync_WiFiManager->setCustomsHeadElement(PSTR("<style>html{filter: invert(10%);}</style>"));
-#endif
-
-#if USING_CORS_FEATURE
-  ESPAsync_WiFiManager->setCORSHeader(PSTR("Your Access-Control-Allow-Origin"));
-#endif
-  // Set customized DHCP HostName
-  ESPAsync_WiFiManager->begin(HOST_NAME);
-  while (WiFi.status() != WL_CONNECTED)
-  { 
-    ESPAsync_WiFiManager->run();
-    check_status();
-    Serial.print('.');
-    yield();
-    delay(1000);
-  }
-  String SSID = ESPAsync_WiFiManager->getWiFiSSID(0);
-  String PWD = ESPAsync_WiFiManager->getWiFiPW(0);
-  Serial.print("SSID: ");
-  Serial.println(SSID);
-  wiFiSecrets.Pass = PWD;
-  wiFiSecrets.SSID = SSID;
-  StoreSettings(&wiFiSecrets);
-  Serial.println("Wifi information stored, rebooting...\n");
-  delay(5000);
-  ESP.restart();
-  return;
-  
-  //Or use default Hostname "ESP_XXXXXX"
-  //ESPAsync_WiFiManager->begin();
-  //WiFiManagerApp wiFiManagerApp;
-  //if(wiFiManagerApp.Run()){
-    //ESP.restart();
-  //}
-  //else{
-    //TODO: put some audio feedback here that wifi manager app didnt finish successfullly
-    ESP.deepSleep(UINT64_MAX,RF_DISABLED);
-  //}
+//the software I2C delays are counted in loop iterations for F_CPU (80MHz), so ask for a
+//proportionally slower clock when the cpu runs faster
+void OnClockChange(uint8_t mhz){
+  Wire.setClock((uint32_t)I2C_CLOCK_HZ * POWER_NORMAL_MHZ / mhz);
 }
 
-void ResetWifiRoutine(){
-  LED_Ack();
-  if (SD.exists("/WiFiSecrets.txt")) SD.remove("/WiFiSecrets.txt");
-  RunWiFiManager();
+//the I2S driver and its DMA interrupt keep running on silence between samples, they are
+//released before a light sleep and the next sample starts them again
+void OnLightSleep(){
+  if (output) output->shutdown();
 }
 
-void SetupTime() {
-  if(!rtc_synced){
-    configTime(TIMEZONE, "be.pool.ntp.org");
-    settimeofday_cb(NTP_Sync_Callback);
-  }
-  return;
+void StartWebServer(){
+  if (server) return;
+  server = new AsyncWebServer(80);
+  server->on("/", HTTP_GET, [](AsyncWebServerRequest *request) {
+    request->send(200, "text/plain", "Welkom bij de Ledafoon, om een ota update uit te voeren ga naar <ip>/update, samples uploaden kan met PUT <ip>/upload?file=/<nummer>.mp3");
+  });
+  AsyncElegantOTA.begin(server);    // Start AsyncElegantOTA
+  SetupSampleUpload(server, isAudioBusy);
+  SetupSampleBrowser(server, isAudioBusy);
+  SetupMetrics(server);
+  SetupKeyInjection(server, &keyPad);
+  SetupI2CTrace(server);
+  SetupLatencyBench(server);
+  SetupAllocGate(server);
+  SetupAudioCapture(server);
+  //upload the patch with PUT /upload?file=/firmware.dlt first
+  server->on("/delta", HTTP_POST, [](AsyncWebServerRequest *request) {
+    if (!SD.exists(DELTA_PATH)){
+      request->send(404, "text/plain", "no /firmware.dlt on the SD card");
+      return;
+    }
+    deltaUpdateRequested = true;
+    request->send(202, "text/plain", "delta update started, the phone reboots when it is done");
+  });
+  server->begin();
+  Serial.println("Webserver started");
 }
 
+//opens the access point with the OTA and sample upload pages, the phone keeps working meanwhile
 void OTAUpdateAP(){
   LED_Ack();
   const char *ssidOTA = "LEDAFOONOTA";
@@ -289,89 +312,257 @@ void OTAUpdateAP(){
   IPAddress IP = WiFi.softAPIP();
   Serial.print("AP IP address: ");
   Serial.println(IP);
-
-  server = new AsyncWebServer(80);
-  server->on("/", HTTP_GET, [](AsyncWebServerRequest *request) {
-    request->send(200, "text/plain", "Welkom bij de Ledafoon, om een ota update uit te voeren ga naar <ip>/update");
-  });
-  AsyncElegantOTA.begin(server);    // Start AsyncElegantOTA
-  server->begin();
-  Serial.println("OTA server started");
-  while(1) delay(5000);
+  StartWebServer();
 }
 
 void UpdateSD(){
   Serial.print(F("\nCurrent firmware version: "));
   Serial.println(FIRMWARE_VERSION);
- 
+  if (SD.exists(DELTA_PATH)){
+    UpdateDeltaSD();
+    return;
+  }
+
   Serial.print(F("\nSearch for firmware.bin..."));
-  File firmware =  SD.open("/firmware.bin");
-  if (firmware) {
-    for (int i=0; i<5;i++){
-      pcf8574.digitalWrite(LEDPIN, LOW);
-      delay(200);
-      pcf8574.digitalWrite(LEDPIN, HIGH);
-      delay(200);
-    }
-    FWUpdateStarted=true;
-    Serial.println(F("found!"));
-    Serial.println(F("Try to update!"));
-
-    Update.onProgress(progressCallBack);
-
-    Update.begin(firmware.size(), U_FLASH);
-    Update.writeStream(firmware);
-    if (Update.end()){
-        Serial.println(F("Update finished!"));
-        LED_Ack();
-    }else{
-        Serial.println(F("Update error!"));
-        LED_Error();
-        Serial.println(Update.getError());
-    }
+  FirmwareManifest manifest;
+  if (!SD.exists(FIRMWARE_PATH) || !ReadFirmwareManifest(FIRMWARE_MANIFEST_PATH, &manifest)){
+    Serial.println(F("not found or no valid firmware.json next to it!"));
+    LED_Error();
+    return;
+  }
+  Serial.printf_P(PSTR("found version %s (%u bytes)\n"), manifest.version, manifest.size);
+  FWUpdateStarted=true;
+  SetLED(LOW);
+
+  //keep the running image on the card, so a bad update can be rolled back
+  Serial.println(F("Backing up running firmware..."));
+  FirmwareUpdateResult result = BackupRunningFirmware(FIRMWARE_VERSION);
+  if (result != FW_OK){
+    Serial.printf_P(PSTR("Backup failed: %s, update aborted\n"), FirmwareUpdateResultString(result));
+    LED_Error();
+    return;
+  }
 
-    firmware.close();
+  Serial.println(F("Try to update!"));
+  FirmwareUpdateStats stats = {};
+  result = FlashFirmwareFromSD(FIRMWARE_PATH, FIRMWARE_MANIFEST_PATH, progressCallBack, &stats);
+  Serial.printf_P(PSTR("Flashed %u bytes in %u ms (%u kB/s)\n"), stats.bytes, stats.durationMillis, stats.bytesPerSecond / 1024);
+  if (result != FW_OK){
+    //nothing was committed, the current firmware stays active and firmware.bin stays for a retry
+    Serial.printf_P(PSTR("Update error: %s\n"), FirmwareUpdateResultString(result));
+    LED_Error();
+    return;
+  }
+  Serial.println(F("Update finished!"));
+  if (SD.exists(FIRMWARE_DONE_PATH)) SD.remove(FIRMWARE_DONE_PATH);
+  if (SD.exists(FIRMWARE_DONE_MANIFEST_PATH)) SD.remove(FIRMWARE_DONE_MANIFEST_PATH);
+  if (SD.rename(FIRMWARE_PATH, FIRMWARE_DONE_PATH) && SD.rename(FIRMWARE_MANIFEST_PATH, FIRMWARE_DONE_MANIFEST_PATH)){
+      Serial.println(F("Firmware rename succesfully!"));
+  }else{
+      Serial.println(F("Firmware rename error!"));
+  }
+  LED_Ack();
+  statusLed.finish();
+  LogFlush();
+  ESP.reset();
+}
 
-    if (SD.rename("/firmware.bin", "/firmware.bak")){
-        Serial.println(F("Firmware rename succesfully!"));
-    }else{
-        Serial.println(F("Firmware rename error!"));
-    }
-    delay(2000);
+//rebuilds the new firmware from the running one and firmware.dlt
+void UpdateDeltaSD(){
+  Serial.println(F("Delta update found, backing up running firmware..."));
+  FWUpdateStarted=true;
+  SetLED(LOW);
+  FirmwareUpdateResult backup = BackupRunningFirmware(FIRMWARE_VERSION);
+  if (backup != FW_OK){
+    Serial.printf_P(PSTR("Backup failed: %s, update aborted\n"), FirmwareUpdateResultString(backup));
+    LED_Error();
+    return;
+  }
+  FirmwareUpdateStats stats = {};
+  DeltaResult result = ApplyDeltaFromSD(DELTA_PATH, progressCallBack, &stats);
+  Serial.printf_P(PSTR("Rebuilt %u bytes in %u ms (%u kB/s)\n"), stats.bytes, stats.durationMillis, stats.bytesPerSecond / 1024);
+  if (result != DELTA_OK){
+    Serial.printf_P(PSTR("Delta update error: %s\n"), DeltaResultString(result));
+    LED_Error();
+    return;
+  }
+  Serial.println(F("Update finished!"));
+  if (SD.exists(DELTA_DONE_PATH)) SD.remove(DELTA_DONE_PATH);
+  SD.rename(DELTA_PATH, DELTA_DONE_PATH);
+  LED_Ack();
+  statusLed.finish();
+  LogFlush();
+  ESP.reset();
+}
 
-    ESP.reset();
-  }else{
-      Serial.println(F("not found!"));
+void RollbackSD(){
+  Serial.print(F("\nRolling back to previous firmware..."));
+  FirmwareUpdateStats stats = {};
+  FirmwareUpdateResult result = FlashFirmwareFromSD(FIRMWARE_ROLLBACK_PATH, FIRMWARE_ROLLBACK_MANIFEST_PATH, progressCallBack, &stats);
+  if (result != FW_OK){
+    Serial.printf_P(PSTR("Rollback error: %s\n"), FirmwareUpdateResultString(result));
+    LED_Error();
+    return;
   }
+  Serial.printf_P(PSTR("Rolled back in %u ms (%u kB/s)\n"), stats.durationMillis, stats.bytesPerSecond / 1024);
+  LED_Ack();
+  statusLed.finish();
+  LogFlush();
+  ESP.reset();
 }
 
+//the blink patterns play from loop(), see StatusLed.h
 void LED_Ack(){
-  for (int i=0; i<5;i++){
-      pcf8574.digitalWrite(LEDPIN, LOW);
-      delay(500);
-      pcf8574.digitalWrite(LEDPIN, HIGH);
-      delay(500);
-  }
+  statusLed.play(LED_PATTERN_ACK, LED_PATTERN_ACK_STEPS, 5);
 }
 
 void LED_Error(){
-  for (int i=0; i<5;i++){
-      pcf8574.digitalWrite(LEDPIN, LOW);
-      delay(200);
-      pcf8574.digitalWrite(LEDPIN, HIGH);
-      delay(200);
+  statusLed.play(LED_PATTERN_ERROR, LED_PATTERN_ERROR_STEPS, 5);
+}
+
+//all eight pins of the GPIO expander in one transaction
+uint8_t ReadExpanderInputs(){
+  I2C_TRACE_START();
+  PCF8574::DigitalInput input = pcf8574.digitalReadAll();
+  uint8_t levels = input.p0 | input.p1 << 1 | input.p2 << 2 | input.p3 << 3 | input.p4 << 4 | input.p5 << 5 | input.p6 << 6 | input.p7 << 7;
+  I2C_TRACE_RECORD(GPIO_ADDRESS, 0x01, levels, I2C_OP_EXPANDER_READ);
+  return levels;
+}
+
+//the hook switch is P0 of the GPIO expander, the rotary dial pulse contact P1
+bool ReadHookDown(){
+  uint8_t levels = ReadExpanderInputs();
+#if defined(ROTARY_DIAL) && !defined(ROTARY_PULSE_GPIO)
+  //every expander interrupt is a possible dial edge, stamped with the interrupt time. Only the
+  //level at this read is seen, edges between two loop() passes are lost.
+  rotary.edge(keyEventMicros, (levels >> ROTARY_PULSE_PIN) & 1);
+#endif
+  return (levels & 0x01) == LOW;
+}
+
+//only reaches the I2C bus when the level changes
+void SetLED(uint8_t level){
+  statusLed.set(level);
+}
+
+#ifdef I2C_TRACE_REPLAY
+//feeds /i2ctrace.bin through the keypad decoder instead of booting the phone
+void RunI2CReplay(){
+  Serial.begin(74880);
+  if (!SD.begin(SPI_CS_PIN, SD_SCK_MHZ(10)) || !I2CReplayLoad(I2C_TRACE_PATH)){
+    Serial.println(F("I2C replay: no " I2C_TRACE_PATH " on the SD card"));
+    return;
+  }
+  keyPad.loadKeyMap(keys);
+  keyPad.setLatestCharsDepth(20);
+  keyPad.setDebounce(250);
+  uint32_t scans = 0, dialed = 0, bounces = 0, fails = 0;
+  uint32_t decodeCycles = 0, worstDecodeCycles = 0;
+  while (!I2CReplayDone()){
+    uint32_t start = ESP.getCycleCount();
+    uint8_t index = keyPad.readKey();
+    uint32_t cycles = ESP.getCycleCount() - start;
+    scans++;
+    decodeCycles += cycles;
+    if (cycles > worstDecodeCycles) worstDecodeCycles = cycles;
+    if (index < 16){
+      dialed++;
+      Serial.printf_P(PSTR("%u ms: key '%c'\n"), I2CReplayMillis(), keyPad.getChar());
+    }
+    else if (index == I2C_KEYPAD_BOUNCE) bounces++;
+    else if (index == I2C_KEYPAD_FAIL) fails++;
+    yield();
+  }
+  Serial.printf_P(PSTR("I2C replay: %u scans, %u keys, %u bounced, %u failed, %u mask mismatches\n"), scans, dialed, bounces, fails, I2CReplayMaskMismatches());
+  Serial.printf_P(PSTR("dialed: %s\n"), keyPad.getLatestChars());
+  if (scans){
+    //what the scan cost on the real bus, against what the decoding itself costs
+    Serial.printf_P(PSTR("per scan: decode avg %u worst %u cycles, recorded I2C avg %u cycles\n"),
+      decodeCycles / scans, worstDecodeCycles, (uint32_t)(I2CReplayBusCycles() / scans));
   }
 }
+#endif
 
+#ifdef ROTARY_REPLAY
+//feeds the recorded or generated pulse train in /pulses.txt through the rotary dial decoder,
+//one "<micros> <level>" edge per line, see tools/rotary_trains.py. By default every edge
+//reaches the decoder, as with ROTARY_PULSE_GPIO. With ROTARY_REPLAY_LOOP_US the level is
+//only looked at once per pass of that length, as the expander read in ReadHookDown() does.
+#ifndef ROTARY_REPLAY_LOOP_US
+#define ROTARY_REPLAY_LOOP_US 0
+#endif
+void RunRotaryReplay(){
+  Serial.begin(74880);
+  File pulses;
+  if (!SD.begin(SPI_CS_PIN, SD_SCK_MHZ(10)) || !(pulses = SD.open("/pulses.txt", FILE_READ))){
+    Serial.println(F("Rotary replay: no /pulses.txt on the SD card"));
+    return;
+  }
+  keyPad.loadKeyMap(keys);
+  keyPad.setLatestCharsDepth(20);
+  keyPad.setDebounce(0); //the train is replayed faster than it was dialed
+  keyPad.setKeyPadMode(I2C_KEYPAD_NONE);
+  char line[32];
+  uint32_t edges = 0, digits = 0, lastMicros = 0;
+  uint32_t decodeCycles = 0, worstDecodeCycles = 0;
+  unsigned int level = 0;
+  uint32_t passMicros = 0;
+  bool changed = false;
+  //one loop() pass: poll, then the expander read that sees the level of the last edge
+  auto pass = [&](uint32_t now){
+    uint32_t start = ESP.getCycleCount();
+    char digit = rotary.poll(now);
+    if (changed) rotary.edge(lastMicros, level);
+    uint32_t cycles = ESP.getCycleCount() - start;
+    changed = false;
+    decodeCycles += cycles;
+    if (cycles > worstDecodeCycles) worstDecodeCycles = cycles;
+    if (digit && keyPad.injectChar(digit) && keyPad.readKey() < 16){
+      digits++;
+      Serial.printf_P(PSTR("%u ms: digit '%c'\n"), rotary.getDigitMicros() / 1000, digit);
+    }
+  };
+  while (pulses.available()){
+    size_t len = pulses.readBytesUntil('\n', line, sizeof(line) - 1);
+    line[len] = '\0';
+    unsigned int edgeMicros, edgeLevel;
+    if (line[0] == '#' || sscanf(line, "%u %u", &edgeMicros, &edgeLevel) != 2) continue;
+    if (!edges) passMicros = edgeMicros;
+    //the passes up to this edge, the edges since the previous pass only leave their last level
+    for (; ROTARY_REPLAY_LOOP_US && passMicros < edgeMicros; passMicros += ROTARY_REPLAY_LOOP_US) pass(passMicros);
+    level = edgeLevel;
+    lastMicros = edgeMicros;
+    changed = true;
+    edges++;
+    //without ROTARY_REPLAY_LOOP_US every edge gets a pass of its own
+    if (!ROTARY_REPLAY_LOOP_US) pass(edgeMicros);
+    yield();
+  }
+  if (changed) pass(lastMicros + ROTARY_REPLAY_LOOP_US);
+  pulses.close();
+  //the pause after the last digit
+  char digit;
+  while ((digit = rotary.poll(lastMicros + 1000000)) != 0){
+    if (keyPad.injectChar(digit) && keyPad.readKey() < 16){
+      digits++;
+      Serial.printf_P(PSTR("%u ms: digit '%c'\n"), rotary.getDigitMicros() / 1000, digit);
+    }
+  }
+  Serial.printf_P(PSTR("Rotary replay: %u edges, %u digits, %u errors\n"), edges, digits, rotary.getErrors());
+  Serial.printf_P(PSTR("dialed: %s\n"), keyPad.getLatestChars());
+  if (edges) Serial.printf_P(PSTR("per edge: decode avg %u worst %u cycles\n"), decodeCycles / edges, worstDecodeCycles);
+}
+#endif
 
 //called to report progress of the update over SD card
 void progressCallBack(size_t currSize, size_t totalSize) {
+  //only print every 64kB, printing every block at 74880 baud costs more than the flash write itself
+  if ((currSize % 0x10000) < FIRMWARE_BLOCK_SIZE || currSize == totalSize){
       Serial.printf("CALLBACK:  Update process at %d of %d bytes...\n", currSize, totalSize);
+  }
 }
 
 void NTP_Sync_Callback(){
-  rtc_synced=true;
-  char output[30], day_output[30];
   now = time(nullptr);
   const tm* tm = localtime(&now);
   CurrentHour = tm->tm_hour;
@@ -382,223 +573,604 @@ void NTP_Sync_Callback(){
   //Serial.print("Current minute couter: ");
   //Serial.println(CurrentMinuteCounter);
   #ifdef METRIC
-    strftime(day_output, 30, "%d-%b-%y", tm);     // Displays: 24-Jun-17
-    strftime(output, 30, "%H:%M", tm);            // Creates: '14:05'
+    strftime(dateString, sizeof(dateString), "%d-%b-%y", tm);     // Displays: 24-Jun-17
+    strftime(timeString, sizeof(timeString), "%H:%M", tm);        // Creates: '14:05'
   #else 
-    strftime(day_output, 30, "%b-%d-%y", tm);     // Creates: Jun-24-17
-    strftime(output, 30, "%I:%M%p", tm);          // Creates: '2:05pm'
+    strftime(dateString, sizeof(dateString), "%b-%d-%y", tm);     // Creates: Jun-24-17
+    strftime(timeString, sizeof(timeString), "%I:%M%p", tm);      // Creates: '2:05pm'
   #endif
-  dateString = day_output;
-  timeString = output;
-  Serial.println(dateString);
-  Serial.println(timeString);
+  LOG_INFO("%s %s", dateString, timeString);
 }
 
-bool playMP3FromPath(String path){
-  if (SD.exists(path)){
-      source->close();
-      if ((decoder) && (decoder->isRunning())){
-        decoder->stop();
-      }
-      File file = SD.open(path);
-      if (source->open(file.name())){
-        Serial.printf_P(PSTR("Playing '%s' from SD card...\n"), file.name());
-        id3 = new AudioFileSourceID3(source);
-        decoder->begin(id3, output);
-        return true;
-      }
-      else {
-          Serial.printf_P(PSTR("Error opening '%s'\n"), file.name());
-          return false;
-      }
-    }
-    else {
-      Serial.printf_P(PSTR("No file '%s' found on SD card...\n"), path);
-      return false;
-    }
-  return false;
+void SavePlaybackState(const char* path, uint32_t position, bool playing){
+  if (path != playbackState.path) strlcpy(playbackState.path, path, sizeof(playbackState.path));
+  playbackState.position = position;
+  playbackState.playing = playing;
+  RTCPlayback::save(playbackState);
+  playbackSavedMillis = millis();
+}
+
+//after a soft reset, continue the sample that was playing if the horn is still up
+void ResumePlayback(){
+  if (!warmBoot || !RTCPlayback::load(&playbackState) || !playbackState.playing) return;
+  //clear it first, a sample that crashes the decoder should not be resumed forever
+  SavePlaybackState(playbackState.path, playbackState.position, false);
+  if (ReadHookDown()) return;
+  if (!OpenSample(playbackState.path)) return;
+  LOG_INFO("Resuming '%s' at byte %u", playbackState.path, playbackState.position);
+  hornDown = false;
+  samplePlaying = true;
+  decoder = selectDecoder(playbackState.path);
+  seekEntry = SEEK_ENTRY_UNKNOWN;
+  //a wav needs its header before it can jump into the data
+  if (decoder == wavDecoder){
+    if (wavDecoder->begin(id3, sampleVoice)) wavDecoder->seekToFilePosition(playbackState.position);
+    return;
+  }
+  source->seek(playbackState.position, SEEK_SET);
+  decoder->begin(id3, sampleVoice);
+}
+
+//the ID3 parser of the library looks for a tag only once per instance and has no open(),
+//so every sample gets a new one in the same static storage, no allocation. The old one is
+//not destroyed: its destructor would only close the source that was just opened.
+bool OpenSample(const char* path){
+  if (!source->open(path)) return false;
+  id3 = new (id3Space) PhoneID3Source(source);
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+  id3->RegisterMetadataCB(MDCallback, NULL);
+#endif
+  return true;
+}
+
+AudioGenerator* selectDecoder(const char* path){
+  return SampleFormatOf(path) == SAMPLE_WAV ? (AudioGenerator*)wavDecoder : (AudioGenerator*)mp3Decoder;
+}
+
+//no heap allocations from here to the first audible sample, see AllocGate.h
+bool playSampleFromPath(const char* path){
+  source->close();
+  if ((decoder) && (decoder->isRunning())){
+    decoder->stop();
+  }
+  if (!OpenSample(path)){
+    LOG_ERROR("Error opening '%s'", path);
+    return false;
+  }
+  LatencyMark(LAT_OPEN);
+  LOG_INFO("Playing '%s' from SD card", path);
+  output->armLatency(keyEventMicros);
+  decoder = selectDecoder(path);
+  decoder->begin(id3, sampleVoice);
+  seekEntry = 0;
+  MetricInc(MET_SAMPLES_STARTED);
+  SavePlaybackState(path, 0, samplePlaying);
+  return true;
+}
+
+//a new decoder start at the offset from the table, as ResumePlayback() does
+bool SeekSample(int16_t seconds){
+  if (decoder != mp3Decoder || !decoder->isRunning()) return false;
+  uint32_t offset;
+  if (!SeekTableFind(playbackState.path, source->getSize(), &seekEntry, sampleVoice->framesSinceBegin(), source->getPos(), seconds, &offset)) return false;
+  LOG_DEBUG("Skipping %d s to byte %u", seconds, offset);
+  decoder->stop();
+  if (!OpenSample(playbackState.path)) return false;
+  source->seek(offset, SEEK_SET);
+  decoder->begin(id3, sampleVoice);
+  SavePlaybackState(playbackState.path, offset, true);
+  return true;
+}
+
+//the first audible frame of the sample on voice 0, not of a click mixed over it
+void OnSampleSound(uint16_t framesAfter){
+  output->soundQueued(framesAfter);
+}
+
+void PlayKeyClick(){
+  if (!clickDecoder) return;
+  clickDecoder->stop();
+  if (clickSource->open(KEY_CLICK_PATH)) clickDecoder->begin(clickSource, mixer->getVoice(1));
+}
+
+void StartMessage(const char* greeting){
+  decoder->stop();
+  samplePlaying = false;
+  recordPending = true;
+  char path[PLAYBACK_PATH_MAX];
+  if (greeting && SampleIndexFind(greeting, path, sizeof(path)) && playSampleFromPath(path)) return;
+  StartRecording();
+}
+
+void StartRecording(){
+  recordPending = false;
+#ifndef RECORD_FROM_FILE
+  if (connectivity.isActive()){
+    LOG_WARN("No voice messages with WiFi on, the ADC cannot be read fast enough");
+    LED_Error();
+    return;
+  }
+#endif
+  //opening the message file allocates, and no sample follows to close the window
+  AllocGatePause();
+  bool started = recorder.start(&mic);
+  AllocGateResume();
+  if (!started) LED_Error();
+}
+
+#ifdef RECORD_FROM_FILE
+//recording from a file is a test run, the message has to be intact and play back
+void CheckRecordedMessage(){
+  bool intact = recorder.checkMessage();
+  bool plays = intact && !hornDown && playSampleFromPath(recorder.getPath());
+  if (intact) LOG_INFO("Message %s intact, %u s%s", recorder.getPath(), recorder.getSeconds(), plays ? ", playing it back" : "");
+  else {
+    LOG_ERROR("Message %s is not a valid WAV file", recorder.getPath());
+    LED_Error();
+  }
+}
+#endif
+
+void RunMenuAction(MenuAction action){
+  char name[MENU_NAME_MAX];
+  char path[PLAYBACK_PATH_MAX];
+  switch (action.type){
+    case MENU_PLAY:
+      if (menu.getString(action.arg, name, sizeof(name)) && SampleIndexFind(name, path, sizeof(path))) playSampleFromPath(path);
+      else LOG_WARN("Menu sample '%s' not on SD card", name);
+      break;
+    case MENU_GOTO:
+      LOG_DEBUG("Menu %u", action.arg);
+      RunMenuAction(menu.enter(action.arg, millis()));
+      break;
+    case MENU_RECORD:
+      StartMessage(menu.getString(action.arg, name, sizeof(name)) ? name : NULL);
+      break;
+    case MENU_DIAL:
+      menuDialing = true;
+      keyPad.clearLatestChars();
+      break;
+  }
 }
 
 void resetState(){
   if(decoder && decoder->isRunning()){
     decoder->stop();
   }
+  if (clickDecoder) clickDecoder->stop();
+  recordPending = false;
+  recorder.stop();
+  menuDialing = false;
+  if(samplePlaying) SavePlaybackState(playbackState.path, 0, false);
   samplePlaying=false;
   keyPad.clearLatestChars();
-  pcf8574.digitalWrite(LEDPIN, HIGH);
+  SetLED(HIGH);
 }
     
 
-void setup() {
-   
-  Serial.begin(74880); //Same as ESP8266 bootloader
-  delay(1000);
-  Serial.println("Serial started");
-  
-  // NOTE: PCF8574 will generate an interrupt on key press and release.
-  pinMode(D3, INPUT_PULLUP);
-  attachInterrupt(D3, keyChanged, FALLING);
-  keyChange = false;
-  Wire.setClock(400000);
-  Wire.begin();
-  keyPad.loadKeyMap(keys);
-  keyPad.setLatestCharsDepth(20);
-  keyPad.setDebounce(250);
-  if (keyPad.begin() == false)
-  {
-    Serial.println("\nERROR: cannot communicate to keypad.\nRebooting.\n");
-    delay(5000);
-    ESP.restart();
-  }
-  
-   // Set pinMode to OUTPUT, ALL unused pins must be set to output (datasheet)
-  pcf8574.pinMode(P0, INPUT);
-  for(int i=1;i<8;i++) {
-    pcf8574.pinMode(i, OUTPUT);
-  }
-	Serial.print("Init pcf8574...");
-	if (pcf8574.begin()){
-		Serial.println("OK");
-	}else{
-		Serial.println("NOK, rebooting.");
-    delay(5000);
-    ESP.restart();
-	}
-  
-  audioLogger = &Serial;  
-  source = new AudioFileSourceSD();
-  output = new AudioOutputI2S();
-  decoder = new AudioGeneratorMP3();
- 
-  // NOTE: SD.begin(...) should be called AFTER AudioOutput...()
-  //       to takover the the SPI pins if they share some with I2S
-  //       (i.e. D8 on Wemos D1 mini is both I2S BCK and SPI SS)
-  if(!SD.begin(SPI_CS_PIN, SPI_SPEED)){
-    Serial.println("Communication with SD card Failed");
-    ESP.deepSleep(ESP.deepSleepMax());
-    ESP.restart();
-  }
-  dir = SD.open("/");
-
-  if(keyPad.readKey()==OTA_KEY){
-    long startTimeONBOOTKEYPRESS = millis();
-    while(millis()-startTimeONBOOTKEYPRESS < 3000 && keyPad.readKey()==OTA_KEY){
-      yield();
-      delay(250);
-    }
-    if(keyPad.readKey()==OTA_KEY && millis()-startTimeONBOOTKEYPRESS > 3000){
-      OTAUpdateAP();
-    }
+//boot keys, checked with a single keypad scan while the rest of the hardware initialises
+struct BootKeyAction{
+  char key;
+  void (*action)();
+};
+const BootKeyAction bootKeyActions[] = {
+  {OTA_KEY, OTAUpdateAP},
+  {WIFI_RESET_KEY, ResetWifiRoutine},
+  {SDCARD_UPDATE_KEY, UpdateSD}
+};
+
+enum BootState{
+  BOOT_SERIAL,
+  BOOT_I2C,
+  BOOT_KEYSCAN,
+  BOOT_AUDIO,
+  BOOT_SD,
+  BOOT_KEYHOLD,
+  BOOT_READY
+};
+
+const BootKeyAction* ScanBootKeys(){
+  uint8_t index = keyPad.readKey();
+  if (index >= 16) return NULL;
+  char key = keyPad.getChar();
+  for (const BootKeyAction& bootKey : bootKeyActions){
+    if (bootKey.key == key) return &bootKey;
   }
+  return NULL;
+}
 
-  if(keyPad.readKey()==WIFI_RESET_KEY){
-    long startTimeONBOOTKEYPRESS = millis();
-    while(millis()-startTimeONBOOTKEYPRESS < 3000 && keyPad.readKey()==WIFI_RESET_KEY){
-      yield();
-      delay(250);
-    }
-    if(keyPad.readKey()==WIFI_RESET_KEY && millis()-startTimeONBOOTKEYPRESS > 3000){
-      ResetWifiRoutine();
+void setup() {
+#ifdef I2C_TRACE_REPLAY
+  RunI2CReplay();
+  while (true) delay(1000);
+#endif
+#ifdef ROTARY_REPLAY
+  RunRotaryReplay();
+  while (true) delay(1000);
+#endif
+#ifdef MIXER_BENCH
+  Serial.begin(74880);
+  AudioMixerBench(Serial);
+  while (true) delay(1000);
+#endif
+  BootState state = BOOT_SERIAL;
+  const BootKeyAction* bootKey = NULL;
+  unsigned long bootKeyStartMillis = 0;
+
+  while (state != BOOT_READY){
+    switch (state){
+      case BOOT_SERIAL:
+        Serial.begin(74880); //Same as ESP8266 bootloader
+        Serial.println("Serial started");
+        BootMark("serial");
+        state = BOOT_I2C;
+        break;
+
+      case BOOT_I2C:
+        // NOTE: PCF8574 will generate an interrupt on key press and release.
+        pinMode(D3, INPUT_PULLUP);
+        attachInterrupt(D3, keyChanged, FALLING);
+        keyChange = false;
+        Wire.begin();
+        keyPad.loadKeyMap(keys);
+        keyPad.setLatestCharsDepth(20);
+        //every read of a held boot key would be a bounce, the debounce is set after the boot
+        keyPad.setDebounce(0);
+#ifdef ROTARY_DIAL
+        //no keypad on the bus, keyPad only collects the dialed digits
+        keyPad.setKeyPadMode(I2C_KEYPAD_NONE);
+#ifdef ROTARY_PULSE_GPIO
+        pinMode(ROTARY_PULSE_GPIO, INPUT_PULLUP);
+        attachInterrupt(digitalPinToInterrupt(ROTARY_PULSE_GPIO), rotaryPulseChanged, CHANGE);
+#endif
+#else
+        if (keyPad.begin() == false)
+        {
+          Serial.println("\nERROR: cannot communicate to keypad.\nRebooting.\n");
+          delay(5000);
+          ESP.restart();
+        }
+#endif
+        //begin() resets the bus to 100kHz, so only now switch to fast mode
+        Wire.setClock(I2C_CLOCK_HZ);
+
+         // Set pinMode to OUTPUT, ALL unused pins must be set to output (datasheet)
+        pcf8574.pinMode(P0, INPUT);
+        for(int i=1;i<8;i++) {
+#if defined(ROTARY_DIAL) && !defined(ROTARY_PULSE_GPIO)
+          if (i == ROTARY_PULSE_PIN){
+            pcf8574.pinMode(i, INPUT);
+            continue;
+          }
+#endif
+          pcf8574.pinMode(i, OUTPUT);
+        }
+        Serial.print("Init pcf8574...");
+        if (pcf8574.begin()){
+          Serial.println("OK");
+        }else{
+          Serial.println("NOK, rebooting.");
+          delay(5000);
+          ESP.restart();
+        }
+        BootMark("i2c");
+        state = BOOT_KEYSCAN;
+        break;
+
+      case BOOT_KEYSCAN:
+        //the hold time of a boot key runs while audio and SD initialise
+        bootKey = ScanBootKeys();
+        bootKeyStartMillis = millis();
+        BootMark("keyscan");
+        state = BOOT_AUDIO;
+        break;
+
+      case BOOT_AUDIO:
+        audioLogger = &LogOutput;
+        //everything a play needs is allocated once here, see playSampleFromPath()
+        source = new PhoneFileSource();
+        output = new PhoneAudioOutput();
+        output->setAudioStartCallback(KeyInjectAudioStarted);
+        decoderSpace = malloc(AudioGeneratorMP3::preAllocSize());
+        mp3Decoder = new AudioGeneratorMP3(decoderSpace, AudioGeneratorMP3::preAllocSize());
+        wavDecoder = new WavGenerator();
+        mixer = new AudioMixer(output);
+        sampleVoice = mixer->getVoice(0);
+        mixer->setSoundCallback(OnSampleSound);
+        decoder = mp3Decoder;
+        BootMark("audio");
+        state = BOOT_SD;
+        break;
+
+      case BOOT_SD:
+        // NOTE: SD.begin(...) should be called AFTER AudioOutput...()
+        //       to takover the the SPI pins if they share some with I2S
+        //       (i.e. D8 on Wemos D1 mini is both I2S BCK and SPI SS)
+        {
+          //a warm boot reuses the SD clock and sample index of the previous run. The card can
+          //be swapped while the phone runs, so after the reset button both are redone for it.
+          uint32_t resetReason = ESP.getResetInfoPtr()->reason;
+          warmBoot = resetReason != REASON_DEFAULT_RST;
+          sameCard = warmBoot && resetReason != REASON_EXT_SYS_RST;
+          SDSettings sdSettings;
+          if (!(sameCard && RTCSDSettings::load(&sdSettings) && SD.begin(SPI_CS_PIN, SD_SCK_MHZ(sdSettings.spiMHz)))){
+            sdSettings.spiMHz = CalibrateSDSpeed(SPI_CS_PIN);
+            if (!sdSettings.spiMHz){
+              Serial.println("Communication with SD card Failed");
+              ESP.deepSleep(ESP.deepSleepMax());
+              ESP.restart();
+            }
+            RTCSDSettings::save(sdSettings);
+          }
+          Serial.printf_P(PSTR("SD card running at %u MHz\n"), sdSettings.spiMHz);
+        }
+        dir = SD.open("/");
+        BootMark("sd");
+        if (!(sameCard && SampleIndexRestore())) SampleIndexScan();
+        Serial.printf_P(PSTR("%u samples on SD card\n"), GetSampleIndexSummary()->count);
+        BootMark("index");
+        if (SD.exists(KEY_CLICK_PATH)){
+          clickSource = new PhoneFileSource();
+          clickDecoder = new WavGenerator();
+        }
+        if (menu.begin()) Serial.printf_P(PSTR("%u voice menus\n"), menu.getMenuCount());
+        BootMark("menu");
+        state = bootKey ? BOOT_KEYHOLD : BOOT_READY;
+        break;
+
+      case BOOT_KEYHOLD: {
+        uint8_t index = keyPad.readKey();
+        if (index >= 16 || keyPad.getChar() != bootKey->key){
+          //released too early or another key, normal boot
+          bootKey = NULL;
+          state = BOOT_READY;
+        }
+        else if (millis() - bootKeyStartMillis >= BOOTKEY_HOLD_MILLIS){
+          BootMark("keyhold");
+          bootKey->action();
+          state = BOOT_READY;
+        }
+        else delay(10);
+        break;
+      }
+
+      case BOOT_READY:
+        break;
     }
   }
+  keyPad.setDebounce(KEY_DEBOUNCE_MILLIS);
+  keyPad.clearLatestChars();
 
-  if(keyPad.readKey()==SDCARD_UPDATE_KEY){
-    long startTimeONBOOTKEYPRESS = millis();
-    while(millis()-startTimeONBOOTKEYPRESS < 3000 && keyPad.readKey()==SDCARD_UPDATE_KEY){
-      yield();
-      delay(250);
-    }
-    if(keyPad.readKey()==SDCARD_UPDATE_KEY && millis()-startTimeONBOOTKEYPRESS > 3000){
-      UpdateSD();
-    }
+#ifdef ENABLE_WIFI
+  //connecting and the time sync run in the background from loop()
+  if (!connectivity.isActive()){
+    Serial.println("Connecting to WiFi");
+    connectivity.begin(TIMEZONE, NTP_Sync_Callback);
   }
+#endif
 
-  Serial.println("Connecting to WiFi");
-  wiFiConnectStartMillis = millis();
-  //ConnectToWifi();
+  SetupGauges();
+  governor.begin(D3, keyChanged, OnClockChange, OnLightSleep);
+  ResumePlayback();
+  BootMark("ready");
+  BootTimelinePrint(Serial);
+  Serial.printf_P(PSTR("Ready for dial tone %u ms after power-on\n"), BootMillis());
+}
 
-  Serial.println("update from SD Card succeeded, Hurray!! Redundancy!!! ");
+void SetupGauges(){
+  MetricAddGauge("ledafoon_heap_free_bytes", "Free heap", []() -> uint32_t { return ESP.getFreeHeap(); });
+  MetricAddGauge("ledafoon_heap_max_block_bytes", "Largest free heap block", []() -> uint32_t { return ESP.getMaxFreeBlockSize(); });
+  MetricAddGauge("ledafoon_heap_fragmentation_percent", "Heap fragmentation", []() -> uint32_t { return ESP.getHeapFragmentation(); });
+  MetricAddGauge("ledafoon_uptime_seconds", "Time since boot", []() -> uint32_t { return millis() / 1000; });
+  MetricAddGauge("ledafoon_boot_ms", "Power-on to ready for dial tone", []() -> uint32_t { return BootMillis(); });
+  MetricAddGauge("ledafoon_i2c_errors", "Failed keypad I2C transactions", []() -> uint32_t { return keyPad.getI2CErrors(); });
+  MetricAddGauge("ledafoon_samples_on_sd", "Dialable samples on the SD card", []() -> uint32_t { return GetSampleIndexSummary()->count; });
+#ifdef ROTARY_DIAL
+  MetricAddGauge("ledafoon_rotary_errors", "Rotary dial digits dropped for a bad pulse train", []() -> uint32_t { return rotary.getErrors() + rotary.getOverflows(); });
+#endif
+  MetricAddGauge("ledafoon_expander_writes", "I2C writes to the GPIO expander outputs", []() -> uint32_t { return expanderPort.getWrites(); });
+  MetricAddGauge("ledafoon_log_dropped", "Log messages dropped because the buffer was full", []() -> uint32_t { return GetLogStats()->dropped; });
+  MetricAddGauge("ledafoon_power_boost_ms", "Time at 160MHz", []() -> uint32_t { return governor.getStateMillis(POWER_BOOST); });
+  MetricAddGauge("ledafoon_power_normal_ms", "Time at 80MHz", []() -> uint32_t { return governor.getStateMillis(POWER_NORMAL); });
+  MetricAddGauge("ledafoon_power_idle_ms", "Time idle or in light sleep with the horn down", []() -> uint32_t { return governor.getStateMillis(POWER_IDLE); });
+  MetricAddGauge("ledafoon_power_worst_transition_us", "Slowest clock switch or wake from light sleep", []() -> uint32_t { return governor.getWorstTransitionMicros(); });
+  MetricAddGauge("ledafoon_record_encode_cycles", "IMA-ADPCM encoder cpu cycles per recorded sample", []() -> uint32_t {
+    const RecorderStats* stats = recorder.getStats();
+    return stats->encodedSamples ? stats->encodeCycles / stats->encodedSamples : 0;
+  });
+  MetricAddGauge("ledafoon_record_worst_write_us", "Slowest SD write of a voice message", []() -> uint32_t { return recorder.getStats()->worstWriteMicros; });
+  MetricAddGauge("ledafoon_record_worst_queue_ms", "Most microphone audio waiting for the encoder, drops at 256ms", []() -> uint32_t { return recorder.getStats()->worstQueued * 1000 / RECORD_SAMPLE_RATE; });
+  MetricAddGauge("ledafoon_record_dropped_samples", "Microphone samples lost because the encoder fell behind", []() -> uint32_t { return recorder.getStats()->overruns; });
+  MetricAddGauge("ledafoon_mixer_voice_block_cycles", "Mixer cpu cycles per voice per block", []() -> uint32_t {
+    const MixerStats* stats = mixer->getStats();
+    return stats->voiceBlocks ? stats->mixCycles / stats->voiceBlocks : 0;
+  });
+  MetricAddGauge("ledafoon_mixer_worst_block_cycles", "Slowest mixed block, all voices", []() -> uint32_t { return mixer->getStats()->worstBlockCycles; });
+  MetricAddGauge("ledafoon_audio_output_cycles_per_second", "Cpu cycles of the I2S output for a second of 44.1kHz audio", []() -> uint32_t { return output->getCyclesPerSecond(); });
+  MetricAddGauge("ledafoon_audio_chain_cycles_per_second", "Cpu cycles of decoding, mixing and the I2S output for a second of 44.1kHz audio", []() -> uint32_t {
+    return audioChainFrames ? audioChainCycles * PHONEAUDIO_CYCLES_RATE / audioChainFrames : 0;
+  });
+  MetricAddGauge("ledafoon_audio_depth_frames", "Frames kept queued in the I2S DMA ring", []() -> uint32_t { return output->getDepthFrames(); });
+  MetricAddGauge("ledafoon_audio_start_depth_frames", "Frames queued at the start of a sample, adapted to underruns", []() -> uint32_t { return output->getStartDepthFrames(); });
+  MetricAddGauge("ledafoon_wifi_worst_slice_us", "Longest connectivity slice in loop()", []() -> uint32_t { return connectivity.getWorstSliceMicros(); });
 }
 
 void loop() {
+  uint32_t loopStartMicros = micros();
   
-  //wifi and rtc management
-  // if(!rtcSyncStarted && !rtc_synced && WiFi.status()==WL_CONNECTED){
-  //   Serial.println("WiFi Connected, synchronising time");
-  //   rtcSyncStarted = true;
-  //   SetupTime();
-  // }
-  // if(rtc_synced && WiFi.status()==WL_CONNECTION_LOST){
-  //   rtc_synced=false;
-  // }
+  //wifi and rtc management, one short slice per pass
+  if (connectivity.isActive()){
+    connectivity.run();
+    //the config portal brings its own webserver on port 80
+    if (connectivity.isConnected() && !server) StartWebServer();
+  }
+
+#ifdef ROTARY_DIAL
+  //a finished digit of the dial is handled as a key press at the time of its last pulse
+  char digit;
+  if (!keyChange && (digit = rotary.poll(micros())) && keyPad.injectChar(digit)){
+    keyEventMicros = rotary.getDigitMicros();
+    keyChange = true;
+  }
+#endif
+
+  //remote test events take the same path as the keypad interrupt
+  uint32_t injectedMicros;
+  if (!keyChange && KeyInjectPoll(&injectedMicros)){
+    keyEventMicros = injectedMicros;
+    keyChange = true;
+  }
 
   //keypad management
   if (keyChange)
   {
     // Serial.print("keychange");
-    //read the extra GPIO
-    PCF8574::DigitalInput val = pcf8574.digitalReadAll();
-    if (val.p0==LOW){
-      Serial.println("Horn down");
+    //read the extra GPIO, unless a remote test holds the hook
+    InjectedHook injectedHook = GetInjectedHook();
+    bool hookDown = injectedHook == HOOK_REAL ? ReadHookDown() : injectedHook == HOOK_DOWN;
+    if (hookDown){
+      LOG_INFO("Horn down");
       hornDown = true;
       resetState();
     }
     else{
+      //picking up enters the start menu
+      if (hornDown && menu.isActive()) RunMenuAction(menu.start(millis()));
       hornDown=false;
-      pcf8574.digitalWrite(LEDPIN, LOW);
+      SetLED(LOW);
     }
     
-    if(!hornDown){
+    //keys do nothing while a message is recorded, only the hook ends it
+    if(!hornDown && !recorder.isRecording()){
       //read the keypad
       uint8_t index = keyPad.readKey();
       if (index < 16)
       {
-        String path = "/s.mp3";
-        path[1]=keyPad.getChar();
-        samplePlaying=false;
-        playMP3FromPath(path);
+        //the expander also interrupts on a release, only a pressed key starts a measurement
+        LatencyStart(keyEventMicros);
+        LatencyMark(LAT_SCAN);
+        AllocGateOpen();
+        char key[] = "s";
+        key[0]=keyPad.getChar();
+        char path[PLAYBACK_PATH_MAX];
+        PlayKeyClick();
+        bool seekKey = key[0] == SEEK_BACK_KEY || key[0] == SEEK_FORWARD_KEY;
+        //a skip is not part of a number
+        if (samplePlaying && seekKey && SeekSample(key[0] == SEEK_FORWARD_KEY ? SEEK_SKIP_SECONDS : -SEEK_SKIP_SECONDS)) keyPad.clearLatestChars();
+        else {
+          samplePlaying=false;
+          recordPending=false; //a key during the greeting cancels the message
+          if (menu.isActive() && !menuDialing) RunMenuAction(menu.key(key[0], millis()));
+          else if (SampleIndexFind(key, path, sizeof(path))) playSampleFromPath(path);
+          else LOG_DEBUG("No sample for key '%s' on SD card", key);
+        }
       }
       // Serial.print(keyPad.getLatestCharsLength());
       // Serial.print(": ");
       // Serial.println(keyPad.getLatestChars());
 
-      if(keyPad.getLatestCharsLength()>2 && !hornDown){
-        String samplePath = "/" + keyPad.getLatestChars() + ".mp3";
-        if(SD.exists(samplePath)){
+      bool freeDialing = !menu.isActive() || menuDialing;
+      if(freeDialing && strcmp(keyPad.getLatestChars(), RECORD_NUMBER) == 0){
+        keyPad.clearLatestChars();
+        StartMessage(RECORD_NUMBER);
+      }
+      //only look on the SD card when a sample with this many digits exists
+      else if(freeDialing && keyPad.getLatestCharsLength()>2 && !hornDown && SampleIndexMayExist(keyPad.getLatestCharsLength())){
+        char samplePath[PLAYBACK_PATH_MAX];
+        if(SampleIndexFind(keyPad.getLatestChars(), samplePath, sizeof(samplePath))){
           decoder->stop();
           samplePlaying=true;
-          playMP3FromPath(samplePath);
+          playSampleFromPath(samplePath);
           keyPad.clearLatestChars();
       }
     }
     //update in nokia keypad presses
-    if(keyPad.getLatestChars()=="88732833"){
+    if(strcmp(keyPad.getLatestChars(), "88732833") == 0){
       decoder->stop();
       UpdateSD();
     }
     //reset in nokia keypad presses
-    if(keyPad.getLatestChars()=="777337777338"){
+    if(strcmp(keyPad.getLatestChars(), "777337777338") == 0){
       decoder->stop();
       ResetWifiRoutine();
     }
+    //rollback to the firmware that ran before the last SD update in nokia keypad presses
+    if(strcmp(keyPad.getLatestChars(), "76552225") == 0){
+      decoder->stop();
+      RollbackSD();
+    }
   }
     keyChange = false;
   }
+  //menu timeouts, counted from the end of the prompt
+  if (menu.isActive() && !hornDown && !menuDialing && !recorder.isRecording()){
+    MenuAction timeout = menu.poll(millis(), isAudioBusy() || recordPending);
+    if (timeout.type != MENU_NONE) RunMenuAction(timeout);
+  }
   if(keyPad.isPressed() && keyPad.getPressLengthMillis() > LONGPRESS_TIME_SECONDS*1000){
     //perform special reset-functions on longpresses
-    Serial.println("Longpress detected");
+    LOG_DEBUG("Longpress detected");
   }
   
+  //webserver management
+  if (server){
+    UploadPump();
+    AsyncElegantOTA.loop();
+    if (deltaUpdateRequested){
+      deltaUpdateRequested = false;
+      resetState();
+      UpdateDeltaSD();
+    }
+  }
+
   //decoder management
+  uint32_t audioFrames = metricCounters[MET_AUDIO_FRAMES];
+  uint32_t audioCycles = 0;
   if ((decoder) && (decoder->isRunning()))
   {
-    pcf8574.digitalWrite(LEDPIN, LOW);
-    if (!decoder->loop()){
+    SetLED(LOW);
+    uint32_t decodeStartMicros = micros();
+    uint32_t decodeStartCycles = ESP.getCycleCount();
+    bool decoding = decoder->loop();
+    audioCycles = ESP.getCycleCount() - decodeStartCycles;
+    AudioCaptureDecodeMicros(micros() - decodeStartMicros);
+    if (!decoding){
       decoder->stop();
+      if(samplePlaying) SavePlaybackState(playbackState.path, 0, false);
       samplePlaying=false;
-      pcf8574.digitalWrite(LEDPIN, HIGH);
+      SetLED(HIGH);
+      if (recordPending) StartRecording();
+    }
+    else if (samplePlaying && millis() - playbackSavedMillis > PLAYBACK_SAVE_INTERVAL_MILLIS){
+      SavePlaybackState(playbackState.path, source->getPos(), true);
     }
   }
+  uint32_t mixStartCycles = ESP.getCycleCount();
+  if (clickDecoder && clickDecoder->isRunning() && !clickDecoder->loop()) clickDecoder->stop();
+  mixer->pump();
+  audioCycles += ESP.getCycleCount() - mixStartCycles;
+  //idle passes are left out, they would be spread over the frames of the next sample
+  if (mixer->isPlaying() || metricCounters[MET_AUDIO_FRAMES] != audioFrames){
+    audioChainCycles += audioCycles;
+    audioChainFrames += metricCounters[MET_AUDIO_FRAMES] - audioFrames;
+  }
+  recorder.pump();
+#ifdef RECORD_FROM_FILE
+  static bool wasRecording = false;
+  if (wasRecording && !recorder.isRecording()) CheckRecordedMessage();
+  wasRecording = recorder.isRecording();
+#endif
+  statusLed.run();
+  LogPump(isAudioBusy());
+  MetricObserve(MET_LOOP_US, micros() - loopStartMicros);
+
+  //clock and sleep for the next pass, light sleep only when nothing needs the radio or a timer
+  bool canSleep = !connectivity.isActive() && !server && !statusLed.isPlaying() && !LogPendingBytes();
+  if (governor.run(isAudioBusy(), isNetworkBusy(), hornDown, canSleep)){
+    //woken by the keypad or hook, handle it as the interrupt would have
+    keyEventMicros = governor.getWakeMicros();
+    keyChange = true;
+  }
 }
 
 
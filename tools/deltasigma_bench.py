@@ -0,0 +1,139 @@
+#!/usr/bin/env python3
+"""Compares the in-band SNR of the no-DAC modulators on the host.
+
+Usage: deltasigma_bench.py [--rate 44100] [--band 4000] [--tone 1000] [--oversample 32 64 128]
+
+Runs bit-exact models of both on sine tones from -40 dBFS to -1 dBFS:
+    reference   AudioOutputI2SNoDAC of ESP8266Audio, first order, bit by bit, 32x
+    wordwise    DeltaSigmaOutput (src/DeltaSigma.cpp), second order, a word at a time,
+                at every --oversample
+and prints the SNR from --band down to 20 Hz after a third order CIC filter from the bit rate
+down to the sample rate, standing in for the RC filter and the speaker. The cpu cost is
+measured on the phone: build d1_mini_nodac and d1_mini_nodac_reference and compare
+ledafoon_audio_output_cycles_per_second on /metrics.
+"""
+import argparse
+import cmath
+import math
+import sys
+
+N = 8192
+LEVELS = 32  # DELTASIGMA_LEVELS
+
+
+def word_bits(word):
+    """The 32 bits of an I2S word in the order they go out, most significant first."""
+    return [(word >> bit) & 1 for bit in range(31, -1, -1)]
+
+
+def reference(samples, oversample=32):
+    """Bits of AudioOutputI2SNoDAC::DeltaSigma() on a mono signal."""
+    fixed_pos = 0x007fff00
+    cum_err = 0
+    last = 0
+    words = oversample // 32
+    bits = []
+    for s in samples:
+        new = s << 8
+        diff = (new - last) >> (4 + words)
+        last = new
+        for _ in range(32 * words):
+            if cum_err < 0:
+                bits.append(1)
+                cum_err += fixed_pos - new
+            else:
+                bits.append(0)
+                cum_err -= fixed_pos + new
+            new += diff
+    return bits
+
+
+def patterns():
+    """The word table of src/DeltaSigma.cpp."""
+    table = []
+    for ones in range(LEVELS + 1):
+        table.append(sum(1 << bit for bit in range(32) if (bit + 1) * ones // 32 > bit * ones // 32))
+    return table
+
+
+def wordwise(samples, oversample):
+    """Bits of DeltaSigmaOutput::writeFrames(), same integer arithmetic."""
+    table = [word_bits(w) for w in patterns()]
+    error1 = error2 = 0
+    words = oversample // 32
+    bits = []
+    for s in samples:
+        level = 32768 + ((2 * s * 7) >> 4)  # left and right are the same here
+        for _ in range(words):
+            wanted = level + 2 * error1 - error2
+            n = max(0, min(LEVELS, (wanted + 1024) >> 11))
+            error2 = error1
+            error1 = wanted - (n << 11)
+            bits.extend(table[n])
+    return bits
+
+
+def decimate(bits, ratio):
+    """Third order CIC filter down to one value per sample, about what the RC filter and
+    the speaker make of the bits."""
+    i1 = i2 = i3 = 0
+    last3 = c1_last = c2_last = 0
+    out = []
+    for n, b in enumerate(bits, 1):
+        i1 += b
+        i2 += i1
+        i3 += i2
+        if n % ratio == 0:
+            c1 = i3 - last3
+            c2 = c1 - c1_last
+            c3 = c2 - c2_last
+            last3, c1_last, c2_last = i3, c1, c2
+            out.append(c3 / float(ratio ** 3))
+    return out
+
+
+def fft(x):
+    n = len(x)
+    if n == 1:
+        return x
+    even, odd = fft(x[0::2]), fft(x[1::2])
+    twiddle = [cmath.exp(-2j * math.pi * k / n) * odd[k] for k in range(n // 2)]
+    return [even[k] + twiddle[k] for k in range(n // 2)] + [even[k] - twiddle[k] for k in range(n // 2)]
+
+
+def snr(out, rate, tone_bin, band):
+    mean = sum(out) / len(out)
+    window = [0.5 - 0.5 * math.cos(2 * math.pi * i / N) for i in range(N)]
+    spectrum = fft([(v - mean) * w for v, w in zip(out, window)])
+    power = [abs(c) ** 2 for c in spectrum[:N // 2]]
+    low, high = max(1, int(20 * N / rate)), int(band * N / rate)
+    signal = sum(power[tone_bin - 3:tone_bin + 4])
+    noise = sum(p for i, p in enumerate(power[low:high + 1], low) if abs(i - tone_bin) > 3)
+    return 10 * math.log10(signal / noise) if noise else float("inf")
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--rate", type=int, default=44100)
+    parser.add_argument("--band", type=float, default=4000.0, help="top of the band the noise counts in, Hz")
+    parser.add_argument("--tone", type=float, default=1000.0)
+    parser.add_argument("--oversample", type=int, nargs="+", default=[32, 64, 128], help="bits per sample, multiples of 32")
+    args = parser.parse_args()
+    if any(o % 32 or o <= 0 for o in args.oversample):
+        parser.error("oversampling must be a multiple of 32")
+
+    tone_bin = round(args.tone * N / args.rate)
+    columns = ["reference 32x"] + ["wordwise %dx" % o for o in args.oversample]
+    print("SNR in dB, 20 Hz to %d Hz, %d Hz tone at %d Hz" % (args.band, tone_bin * args.rate // N, args.rate))
+    print("%-8s" % "dBFS" + "".join("%16s" % c for c in columns))
+    for dbfs in (-40, -20, -10, -6, -3, -1):
+        amplitude = 32767 * 10 ** (dbfs / 20.0)
+        samples = [int(round(amplitude * math.sin(2 * math.pi * tone_bin * i / N))) for i in range(N)]
+        results = [snr(decimate(reference(samples), 32), args.rate, tone_bin, args.band)]
+        results += [snr(decimate(wordwise(samples, o), o), args.rate, tone_bin, args.band) for o in args.oversample]
+        print("%-8d" % dbfs + "".join("%16.1f" % r for r in results))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,164 @@
+#!/usr/bin/env python3
+"""Golden-audio regression run against a Ledafoon built for d1_mini_capture.
+
+Usage: golden_audio.py [--host 192.168.4.1] [--golden golden_audio.json] [--tolerance 1.0]
+                       [--update] [--wav DIR] golden_sessions.txt
+
+Every session dials through POST /inject while the phone fingerprints what its decoders
+play (see src/AudioCapture.h), then the fingerprint of the last sample the session started
+is compared with the golden file:
+    exact       same hash, every frame bit for bit the same
+    tolerance   same length (one envelope block slack) and every rms point of the
+                envelope within --tolerance percent of full scale
+    FAIL        anything else, or a key of the session did not reach the phone's keypad
+                code; the run exits with 1
+    new         no golden entry yet
+Keys are sent KEY_INTERVAL_MILLIS apart, well clear of the keypad debounce, so every session
+dials the same number.
+Decode cpu time, delivery jitter (spread of how far ahead frames were handed to the DMA)
+and underruns are printed next to the golden run's numbers but do not fail the run.
+--update writes the results as the new golden file; review it with git diff before checking
+it in. --wav also captures every session to DIR/<session>.wav (slower, it writes the SD card).
+
+Session file: "session <name>" starts a session, the lines after it are tools/key_driver.py
+steps plus "quiet", which waits until the phone stops playing. Every session ends with the
+hook down.
+"""
+import argparse
+import http.client
+import json
+import os
+import sys
+import time
+
+from key_driver import Phone, parse, run
+
+QUIET_MILLIS = 1000
+KEY_INTERVAL_MILLIS = 300
+QUIET_TIMEOUT = 600
+
+
+def request(host, method, path):
+    conn = http.client.HTTPConnection(host, timeout=30)
+    conn.request(method, path)
+    response = conn.getresponse()
+    body = response.read()
+    conn.close()
+    if response.status != 200:
+        raise RuntimeError("%s %s: %d %s" % (method, path, response.status, body[:200]))
+    return body
+
+
+def sessions(path):
+    result = []
+    for command, argument in parse(path):
+        if command == "session":
+            result.append((argument, []))
+        elif not result:
+            raise ValueError("%s: steps before the first session" % path)
+        else:
+            result[-1][1].append((command, argument))
+    return result
+
+
+def wait_quiet(host):
+    deadline = time.time() + QUIET_TIMEOUT
+    frames = -1
+    while time.time() < deadline:
+        now = json.loads(request(host, "GET", "/capture"))["frames"]
+        if now == frames and frames > 0:
+            return
+        frames = now
+        time.sleep(QUIET_MILLIS / 1000.0)
+    raise RuntimeError("still playing after %d s" % QUIET_TIMEOUT)
+
+
+def play_session(phone, host, name, steps, wav_dir, dropped):
+    request(host, "POST", "/capture?session=%s%s" % (name, "&wav=1" if wav_dir else ""))
+    try:
+        for command, argument in steps:
+            if command == "quiet":
+                wait_quiet(host)
+            else:
+                run(phone, [(command, argument)], 1000.0 / KEY_INTERVAL_MILLIS, [], [], dropped)
+    finally:
+        result = json.loads(request(host, "POST", "/capture/stop"))
+        phone.inject("hook", "down")
+        time.sleep(0.5)
+        phone.inject("hook", "real")
+    if wav_dir:
+        with open(os.path.join(wav_dir, name + ".wav"), "wb") as f:
+            f.write(request(host, "GET", "/capture.wav"))
+    return result
+
+
+def compare(result, golden, tolerance):
+    if golden is None:
+        return "new"
+    if result["hash"] == golden["hash"] and result["sample_frames"] == golden["sample_frames"]:
+        return "exact"
+    block = result["envelope_frames"]
+    if abs(result["sample_frames"] - golden["sample_frames"]) > block:
+        return "FAIL"
+    a, b = result["envelope"], golden["envelope"]
+    if abs(len(a) - len(b)) > 1:
+        return "FAIL"
+    limit = tolerance / 100.0 * 32768
+    if any(abs(x - y) > limit for x, y in zip(a, b)):
+        return "FAIL"
+    return "tolerance"
+
+
+def timing(result):
+    return "cpu %3d%% (%6d ms)  jitter %6d us  lead min %6d us  underruns %d" % (
+        result["cpu_percent"], result["decode_ms"], result["lead_max_us"] - result["lead_min_us"],
+        result["lead_min_us"], result["underruns"])
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--host", default="192.168.4.1")
+    parser.add_argument("--golden", default=os.path.join(os.path.dirname(os.path.abspath(__file__)), "golden_audio.json"))
+    parser.add_argument("--tolerance", type=float, default=1.0, help="envelope difference, percent of full scale")
+    parser.add_argument("--update", action="store_true", help="write the results as the new golden file")
+    parser.add_argument("--wav", metavar="DIR", help="also save every session as a wav")
+    parser.add_argument("sessions")
+    args = parser.parse_args()
+
+    golden = {}
+    if os.path.exists(args.golden):
+        with open(args.golden) as f:
+            golden = json.load(f)["sessions"]
+    if args.wav:
+        os.makedirs(args.wav, exist_ok=True)
+
+    phone = Phone(args.host)
+    results = {}
+    failed = 0
+    for name, steps in sessions(args.sessions):
+        dropped = []
+        result = play_session(phone, args.host, name, steps, args.wav, dropped)
+        # what played after a lost key is not the session's number, its hash means nothing
+        verdict = "FAIL" if dropped else compare(result, golden.get(name), args.tolerance)
+        if not dropped:
+            results[name] = result
+        failed += verdict == "FAIL"
+        print("%-28s %-9s %9d frames  %s" % (name, verdict, result["sample_frames"], timing(result)))
+        if dropped:
+            print("%-28s keys that did not reach the phone: %s" % ("", " ".join(dropped)))
+        if name in golden and "cpu_percent" in golden[name]:
+            print("%-28s %-9s %9s         %s" % ("", "golden", "", timing(golden[name])))
+
+    if args.update:
+        keep = ("hash", "sample_frames", "rate", "envelope_frames", "envelope", "cpu_percent", "decode_ms",
+                "lead_min_us", "lead_max_us", "underruns")
+        golden.update({name: {k: r[k] for k in keep} for name, r in results.items()})
+        with open(args.golden, "w") as f:
+            json.dump({"sessions": golden}, f, indent=1, sort_keys=True)
+            f.write("\n")
+        print("wrote %s" % args.golden)
+    return 1 if failed and not args.update else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
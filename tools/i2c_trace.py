@@ -0,0 +1,78 @@
+#!/usr/bin/env python3
+"""Fetches or reads an I2C trace of a Ledafoon built with -DI2C_TRACE and summarises it.
+
+Usage: i2c_trace.py [--host 192.168.4.1 | --file i2ctrace.bin] [--save i2ctrace.bin] [--list] [--mhz 80]
+
+Without --file the trace is fetched from GET /i2ctrace. --save keeps the raw records,
+copy that file to the SD card as /i2ctrace.bin to replay it with the d1_mini_i2creplay
+environment. Record layout: see I2CTraceRecord in src/I2CTrace.h.
+"""
+import argparse
+import http.client
+import struct
+import sys
+
+RECORD = struct.Struct("<IIHBBBBH")
+OPS = {0: "keypad", 1: "expander_read", 2: "expander_write"}
+OP_ERROR = 0x80
+
+
+def fetch(host):
+    conn = http.client.HTTPConnection(host, timeout=10)
+    conn.request("GET", "/i2ctrace")
+    response = conn.getresponse()
+    body = response.read()
+    conn.close()
+    if response.status != 200:
+        raise RuntimeError("GET /i2ctrace: %d" % response.status)
+    return body
+
+
+def percentile(values, p):
+    return values[min(len(values) - 1, int(round(p / 100.0 * (len(values) - 1))))]
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--host", default="192.168.4.1")
+    parser.add_argument("--file")
+    parser.add_argument("--save")
+    parser.add_argument("--list", action="store_true", help="print every record")
+    parser.add_argument("--mhz", type=int, default=80, help="cpu clock the trace was taken at")
+    args = parser.parse_args()
+
+    if args.file:
+        with open(args.file, "rb") as f:
+            data = f.read()
+    else:
+        data = fetch(args.host)
+    if args.save:
+        with open(args.save, "wb") as f:
+            f.write(data)
+    records = [RECORD.unpack_from(data, i) for i in range(0, len(data) - RECORD.size + 1, RECORD.size)]
+    if not records:
+        print("empty trace")
+        return 1
+
+    durations = {}
+    errors = {}
+    for cycles, millis, duration, address, mask, result, op, _ in records:
+        name = "%s@0x%02x" % (OPS.get(op & ~OP_ERROR, "op%d" % op), address)
+        durations.setdefault(name, []).append(duration / float(args.mhz))
+        if op & OP_ERROR:
+            errors[name] = errors.get(name, 0) + 1
+        if args.list:
+            print("%10u %8u ms %6.1f us  %-20s mask 0x%02x result 0x%02x%s" % (
+                cycles, millis, duration / float(args.mhz), name, mask, result, "  ERROR" if op & OP_ERROR else ""))
+
+    span = records[-1][1] - records[0][1]
+    print("%d transactions over %d ms" % (len(records), span))
+    for name, values in sorted(durations.items()):
+        values.sort()
+        print("%-22s %5d  p50 %6.1f us  p95 %6.1f us  max %6.1f us  errors %d" % (
+            name, len(values), percentile(values, 50), percentile(values, 95), values[-1], errors.get(name, 0)))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
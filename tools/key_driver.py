@@ -0,0 +1,137 @@
+#!/usr/bin/env python3
+"""Replays dialing scripts against a Ledafoon through POST /inject and reports key-to-audio latency.
+
+The phone has to be built for d1_mini_keyinject (or another environment with -DKEY_INJECT).
+After the run the phone's own per-phase breakdown (GET /latency) is printed as well.
+--alloc-gate fails the run when a phone built for d1_mini_allocgate saw heap allocations
+between a key and its sound.
+
+Usage: key_driver.py [--host 192.168.4.1] [--rate 4] [--repeat 10] [--alloc-gate] script.txt
+
+Script lines:
+    hook up | hook down | hook real
+    key 5              one key
+    dial 0499412982    keys sent at --rate keys per second, injected keys skip the keypad debounce
+    wait 500           pause in milliseconds
+Lines starting with # are ignored.
+"""
+import argparse
+import http.client
+import json
+import sys
+import time
+
+
+class Phone:
+    def __init__(self, host):
+        self.host = host
+
+    def _request(self, method, path):
+        conn = http.client.HTTPConnection(self.host, timeout=10)
+        conn.request(method, path)
+        response = conn.getresponse()
+        body = response.read()
+        conn.close()
+        if response.status != 200:
+            raise RuntimeError("%s %s: %d %s" % (method, path, response.status, body.decode()))
+        return json.loads(body)
+
+    def latency_report(self):
+        conn = http.client.HTTPConnection(self.host, timeout=10)
+        conn.request("GET", "/latency")
+        body = conn.getresponse().read().decode()
+        conn.close()
+        return body
+
+    def alloc_gate(self):
+        return self._request("GET", "/allocgate")
+
+    def inject(self, param, value):
+        return self._request("POST", "/inject?%s=%s" % (param, value))["id"]
+
+    def result(self, event_id, timeout=2.0):
+        deadline = time.time() + timeout
+        while True:
+            reply = self._request("GET", "/inject?id=%d" % event_id)
+            if reply["state"] in ("done", "no_audio") or time.time() > deadline:
+                return reply
+            time.sleep(0.02)
+
+
+def parse(path):
+    steps = []
+    with open(path) as f:
+        for line in f:
+            line = line.strip()
+            if not line or line.startswith("#"):
+                continue
+            command, _, argument = line.partition(" ")
+            steps.append((command, argument.strip()))
+    return steps
+
+
+def run(phone, steps, rate, latencies, silent, dropped=None):
+    """Keys that never reached the phone's keypad code go to dropped when given, else to silent."""
+    for command, argument in steps:
+        if command == "hook":
+            phone.inject("hook", argument)
+        elif command in ("key", "dial"):
+            # results are collected per step, the phone only remembers the last 32 events
+            pending = []
+            for key in argument:
+                pending.append((key, phone.inject("key", key)))
+                time.sleep(1.0 / rate)
+            for key, event_id in pending:
+                reply = phone.result(event_id)
+                if reply["state"] == "done":
+                    latencies.append(reply["latency_us"] / 1000.0)
+                elif dropped is not None and reply["state"] in ("dropped", "queued"):
+                    dropped.append(key)
+                else:
+                    silent.append(key)
+        elif command == "wait":
+            time.sleep(int(argument) / 1000.0)
+        else:
+            raise ValueError("unknown command " + command)
+
+
+def percentile(values, p):
+    index = min(len(values) - 1, int(round(p / 100.0 * (len(values) - 1))))
+    return values[index]
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--host", default="192.168.4.1")
+    parser.add_argument("--rate", type=float, default=4.0, help="keys per second")
+    parser.add_argument("--repeat", type=int, default=1)
+    parser.add_argument("--alloc-gate", action="store_true", help="fail on allocations in the key to sound path")
+    parser.add_argument("script")
+    args = parser.parse_args()
+
+    phone = Phone(args.host)
+    steps = parse(args.script)
+    latencies, silent = [], []
+    for _ in range(args.repeat):
+        run(phone, steps, args.rate, latencies, silent)
+    phone.inject("hook", "real")
+
+    if not latencies:
+        print("no key produced audio (%d keys)" % len(silent))
+        return 1
+    latencies.sort()
+    print("keys with audio: %d, without: %d" % (len(latencies), len(silent)))
+    print("key to audio ms: p50 %.1f  p95 %.1f  p99 %.1f  max %.1f" % (
+        percentile(latencies, 50), percentile(latencies, 95), percentile(latencies, 99), latencies[-1]))
+    print(phone.latency_report())
+    if args.alloc_gate:
+        gate = phone.alloc_gate()
+        print("alloc gate: %d presses, %d with allocations (%d allocations, first from %s)" % (
+            gate["presses"], gate["violations"], gate["allocations"], gate["first_caller"]))
+        if gate["violations"]:
+            return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,134 @@
+#!/usr/bin/env python3
+"""Builds a delta update that turns the running firmware into a new one.
+
+Usage: make_delta.py old_firmware.bin new_firmware.bin [firmware.dlt]
+
+old_firmware.bin must be exactly the image running on the phone. Copy firmware.dlt to
+the SD card (or PUT /upload?file=/firmware.dlt and POST /delta) and the phone rebuilds
+the new image from its own flash and the patch, see DeltaUpdate.h for the format.
+"""
+import hashlib
+import struct
+import sys
+import zlib
+
+MAGIC = b"LDF1"
+OP_END, OP_COPY, OP_ADD, OP_INSERT = 0, 1, 2, 3
+KEY = 16        # bytes hashed to find a match in the old image
+MIN_COPY = 24   # shorter matches are cheaper as part of an ADD
+
+
+def varint(value):
+    out = bytearray()
+    while True:
+        byte = value & 0x7F
+        value >>= 7
+        if value:
+            out.append(byte | 0x80)
+        else:
+            out.append(byte)
+            return bytes(out)
+
+
+def add_tokens(diff):
+    """Zero runs and literal runs: token = length << 1 | is_literal."""
+    out = bytearray()
+    i = 0
+    while i < len(diff):
+        j = i
+        if diff[i] == 0:
+            while j < len(diff) and diff[j] == 0:
+                j += 1
+            out += varint((j - i) << 1)
+        else:
+            # a single zero inside literals is cheaper than a token pair
+            while j < len(diff) and (diff[j] != 0 or (j + 1 < len(diff) and diff[j + 1] != 0)):
+                j += 1
+            out += varint(((j - i) << 1) | 1) + diff[i:j]
+        i = j
+    return bytes(out)
+
+
+class Delta:
+    def __init__(self, old, new):
+        self.old = old
+        self.new = new
+        self.out = bytearray()
+        self.stats = {"copy": 0, "add": 0, "insert": 0}
+
+    def pending(self, start, end, offset):
+        if end <= start:
+            return
+        src = start + offset
+        length = end - start
+        if 0 <= src and src + length <= len(self.old):
+            diff = bytes((self.new[k] - self.old[k + offset]) & 0xFF for k in range(start, end))
+            if diff.count(0) * 2 >= length:
+                self.out += bytes([OP_ADD]) + varint(src) + varint(length) + add_tokens(diff)
+                self.stats["add"] += length
+                return
+        self.out += bytes([OP_INSERT]) + varint(length) + self.new[start:end]
+        self.stats["insert"] += length
+
+    def copy(self, src, length):
+        self.out += bytes([OP_COPY]) + varint(src) + varint(length)
+        self.stats["copy"] += length
+
+    def build(self):
+        old, new = self.old, self.new
+        index = {}
+        for i in range(len(old) - KEY + 1):
+            index.setdefault(old[i:i + KEY], i)
+        i = 0
+        start = 0
+        offset = 0  # old position - new position of the last match
+        while i <= len(new) - KEY:
+            key = new[i:i + KEY]
+            j = i + offset
+            if not (0 <= j and j + KEY <= len(old) and old[j:j + KEY] == key):
+                j = index.get(key)
+                if j is None:
+                    i += 1
+                    continue
+            n = KEY
+            while i + n < len(new) and j + n < len(old) and new[i + n] == old[j + n]:
+                n += 1
+            back = 0
+            while i - back > start and j - back > 0 and new[i - back - 1] == old[j - back - 1]:
+                back += 1
+            if n + back < MIN_COPY:
+                i += 1
+                continue
+            self.pending(start, i - back, offset)
+            self.copy(j - back, n + back)
+            offset = j - i
+            i += n
+            start = i
+        self.pending(start, len(new), offset)
+        self.out.append(OP_END)
+        return bytes(self.out)
+
+
+def main():
+    if len(sys.argv) < 3:
+        print(__doc__)
+        return 1
+    with open(sys.argv[1], "rb") as f:
+        old = f.read()
+    with open(sys.argv[2], "rb") as f:
+        new = f.read()
+    out = sys.argv[3] if len(sys.argv) > 3 else "firmware.dlt"
+    delta = Delta(old, new)
+    body = delta.build()
+    header = MAGIC + struct.pack("<I", len(old)) + hashlib.md5(old).digest() \
+        + struct.pack("<I", len(new)) + hashlib.md5(new).digest() + struct.pack("<I", zlib.crc32(new) & 0xFFFFFFFF)
+    with open(out, "wb") as f:
+        f.write(header + body)
+    size = len(header) + len(body)
+    print("%s: %d bytes, %.1f%% of %d (copy %d, add %d, insert %d)" % (
+        out, size, 100.0 * size / len(new), len(new), delta.stats["copy"], delta.stats["add"], delta.stats["insert"]))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,34 @@
+#!/usr/bin/env python3
+"""Writes the firmware.json manifest that UpdateSD() checks before it commits an image.
+
+Usage: make_manifest.py .pio/build/d1_mini/firmware.bin 1.0.1 [out.json]
+Copy firmware.bin and firmware.json to the root of the SD card.
+"""
+import hashlib
+import json
+import sys
+import zlib
+
+
+def main():
+    if len(sys.argv) < 3:
+        print(__doc__)
+        return 1
+    path, version = sys.argv[1], sys.argv[2]
+    out = sys.argv[3] if len(sys.argv) > 3 else "firmware.json"
+    with open(path, "rb") as f:
+        data = f.read()
+    manifest = {
+        "version": version,
+        "size": len(data),
+        "md5": hashlib.md5(data).hexdigest(),
+        "crc32": zlib.crc32(data) & 0xFFFFFFFF,
+    }
+    with open(out, "w") as f:
+        json.dump(manifest, f)
+    print(json.dumps(manifest))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
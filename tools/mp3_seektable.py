@@ -0,0 +1,114 @@
+#!/usr/bin/env python3
+"""Writes the seek tables the phone uses to skip through long MP3 samples.
+
+Usage: mp3_seektable.py [--every-seconds 1.0] [--min-seconds 60] [--force] sample.mp3|dir [...]
+
+For every MP3 of at least --min-seconds a table is written next to it, /7.mp3 gets /7.sek.
+Copy both to the SD card; while the sample plays the phone skips back and forward with the
+keys in main.cpp (SEEK_BACK_KEY, SEEK_FORWARD_KEY). A table holds the byte offset of every
+N-th frame; the phone knows which entry it is past from the frames it decoded, so a skip reads
+the header and one entry of the table and seeks once in the sample. Tables are skipped when
+they are newer than their sample, unless --force. See src/SeekTable.h.
+"""
+import argparse
+import os
+import struct
+import sys
+
+MAGIC = b"LDS1"
+HEADER = "<4sIHHHHI"  # magic, sample size, rate, samples per frame, frames per entry, reserved, entries
+
+BITRATES = {  # kbit/s by bitrate index, layer III
+    1: [0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320],
+    2: [0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160],
+}
+RATES = {3: [44100, 48000, 32000], 2: [22050, 24000, 16000], 0: [11025, 12000, 8000]}
+
+
+def id3_size(data):
+    if data[:3] != b"ID3" or len(data) < 10:
+        return 0
+    size = (data[6] << 21) | (data[7] << 14) | (data[8] << 7) | data[9]
+    return 10 + size + (10 if data[5] & 0x10 else 0)
+
+
+def frame_header(data, pos):
+    """(length, rate, samples per frame) of the layer III frame at pos, None if there is none."""
+    if pos + 4 > len(data) or data[pos] != 0xFF or (data[pos + 1] & 0xE0) != 0xE0:
+        return None
+    version = (data[pos + 1] >> 3) & 3  # 3: MPEG1, 2: MPEG2, 0: MPEG2.5
+    layer = (data[pos + 1] >> 1) & 3
+    bitrate_index = data[pos + 2] >> 4
+    rate_index = (data[pos + 2] >> 2) & 3
+    padding = (data[pos + 2] >> 1) & 1
+    if version == 1 or layer != 1 or bitrate_index in (0, 15) or rate_index == 3:
+        return None
+    rate = RATES[version][rate_index]
+    bitrate = BITRATES[1 if version == 3 else 2][bitrate_index] * 1000
+    samples = 1152 if version == 3 else 576
+    return samples // 8 * bitrate // rate + padding, rate, samples
+
+
+def frames(data):
+    """Offsets of the frames, a frame only counts when the next one follows it."""
+    pos = id3_size(data)
+    end = len(data) - (128 if data[-128:-125] == b"TAG" else 0)
+    offsets = []
+    rate = samples = None
+    while pos < end:
+        header = frame_header(data, pos)
+        if header and (pos + header[0] >= end or frame_header(data, pos + header[0])):
+            length, rate, samples = header
+            offsets.append(pos)
+            pos += length
+        else:
+            pos += 1
+    return offsets, rate, samples
+
+
+def write_table(path, every_seconds, min_seconds):
+    with open(path, "rb") as f:
+        data = f.read()
+    offsets, rate, samples = frames(data)
+    if not offsets:
+        return "no mp3 frames"
+    seconds = len(offsets) * samples / rate
+    if seconds < min_seconds:
+        return "%.0f s, too short" % seconds
+    every = max(1, round(every_seconds * rate / samples))
+    entries = offsets[::every]
+    with open(os.path.splitext(path)[0] + ".sek", "wb") as f:
+        f.write(struct.pack(HEADER, MAGIC, len(data), rate, samples, every, 0, len(entries)))
+        f.write(struct.pack("<%dI" % len(entries), *entries))
+    return "%.0f s, %d entries of %.2f s" % (seconds, len(entries), every * samples / rate)
+
+
+def samples(paths):
+    for path in paths:
+        if os.path.isdir(path):
+            for name in sorted(os.listdir(path)):
+                if name.lower().endswith(".mp3"):
+                    yield os.path.join(path, name)
+        else:
+            yield path
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--every-seconds", type=float, default=1.0, help="audio between two table entries")
+    parser.add_argument("--min-seconds", type=float, default=60.0, help="shorter samples get no table")
+    parser.add_argument("--force", action="store_true", help="rewrite tables that are up to date")
+    parser.add_argument("samples", nargs="+", help="mp3 files or directories of them")
+    args = parser.parse_args()
+
+    for path in samples(args.samples):
+        table = os.path.splitext(path)[0] + ".sek"
+        if not args.force and os.path.exists(table) and os.path.getmtime(table) >= os.path.getmtime(path):
+            print("%s: up to date" % path)
+            continue
+        print("%s: %s" % (path, write_table(path, args.every_seconds, args.min_seconds)))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,101 @@
+#!/usr/bin/env python3
+"""Generates rotary dial pulse trains for the d1_mini_rotaryreplay environment and checks the result.
+
+Usage: rotary_trains.py [--pps 10] [--break-ratio 0.6] [--bounce 2] [--jitter 0.1] [--seed 1]
+                        [--out pulses.txt] 0499412982
+       rotary_trains.py --check serial.log 0499412982
+
+Copy pulses.txt to the SD card as /pulses.txt and boot a phone built for d1_mini_rotaryreplay
+(every edge, as the pin interrupt sees them) or d1_mini_rotaryreplay_expander (the level once per
+10ms loop() pass, as the GPIO expander read sees it), it prints what RotaryDial decoded over serial. Save that output and pass it to --check to
+compare the dialed digits with the expected ones.
+
+A dial breaks the line once per pulse, 1..9 pulses for '1'..'9' and 10 for '0'. Each edge
+gets up to --bounce extra contact bounces of a few ms and the pulse lengths vary by --jitter.
+A recorded train can be written in the same format: one "<micros> <level>" edge per line,
+level 1 is the break (the pulse contact opens).
+"""
+import argparse
+import random
+import re
+import sys
+
+BOUNCE_US = (200, 2500)  # length of a single contact bounce
+INTERDIGIT_US = (400000, 900000)  # the finger pulls the dial round for the next digit
+
+
+def pulses(digit):
+    return 10 if digit == "0" else int(digit)
+
+
+def train(digits, pps, break_ratio, bounce, jitter, rng):
+    edges = []
+    now = 1000000
+    period = 1000000.0 / pps
+
+    def edge(level, length):
+        # the first edge of a transition is the real one, bounces toggle back and forth after it
+        nonlocal now
+        edges.append((now, level))
+        t = now
+        for _ in range(rng.randint(0, bounce)):
+            t += rng.randint(*BOUNCE_US)
+            edges.append((t, 1 - level))
+            t += rng.randint(*BOUNCE_US)
+            edges.append((t, level))
+        now += int(length)
+
+    for digit in digits:
+        for _ in range(pulses(digit)):
+            edge(1, period * break_ratio * rng.uniform(1 - jitter, 1 + jitter))
+            edge(0, period * (1 - break_ratio) * rng.uniform(1 - jitter, 1 + jitter))
+        now += rng.randint(*INTERDIGIT_US)
+    return edges
+
+
+def check(path, expected):
+    with open(path, errors="replace") as f:
+        log = f.read()
+    match = re.search(r"^dialed: (\S*)", log, re.M)
+    if not match:
+        print("no 'dialed:' line in %s" % path)
+        return 1
+    summary = re.search(r"^Rotary replay: .*$", log, re.M)
+    if summary:
+        print(summary.group(0))
+    dialed = match.group(1)
+    # the phone keeps the last 20 digits
+    expected = expected[-20:]
+    print("expected %s\ndialed   %s\n%s" % (expected, dialed, "OK" if dialed == expected else "MISMATCH"))
+    return 0 if dialed == expected else 1
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--pps", type=float, default=10.0, help="pulses per second, 8..20 for real dials")
+    parser.add_argument("--break-ratio", type=float, default=0.6, help="part of a pulse the line is open")
+    parser.add_argument("--bounce", type=int, default=2, help="most contact bounces per edge")
+    parser.add_argument("--jitter", type=float, default=0.1, help="spread of the pulse lengths")
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("--out", default="pulses.txt")
+    parser.add_argument("--check", metavar="SERIAL_LOG")
+    parser.add_argument("digits")
+    args = parser.parse_args()
+    if not re.fullmatch(r"[0-9]+", args.digits):
+        parser.error("digits must be 0-9")
+
+    if args.check:
+        return check(args.check, args.digits)
+
+    edges = train(args.digits, args.pps, args.break_ratio, args.bounce, args.jitter, random.Random(args.seed))
+    with open(args.out, "w") as f:
+        f.write("# %s at %.1f pps, break ratio %.2f, bounce %d, jitter %.2f\n" % (
+            args.digits, args.pps, args.break_ratio, args.bounce, args.jitter))
+        for micros, level in edges:
+            f.write("%d %d\n" % (micros, level))
+    print("%s: %d edges for %s, %.1f s" % (args.out, len(edges), args.digits, edges[-1][0] / 1e6))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,146 @@
+#!/usr/bin/env python3
+"""Converts samples to the cheapest format the phone can play within a quality budget.
+
+Usage: transcode_samples.py [--rate 22050] [--min-snr 30] [--max-pcm-kb 256] [--out dir] sample [...]
+
+Every sample is decoded with ffmpeg to 16 bit mono and then tried, from the cheapest to
+decode to the most expensive:
+    pcm    16 bit PCM WAV, no decoding at all, but big
+    adpcm  4 bit IMA-ADPCM WAV, a shift-and-add decoder, 4x smaller than PCM
+    mp3    the original, the full MP3 synthesis on the phone
+PCM is used when it fits --max-pcm-kb, ADPCM when its signal to noise ratio against the
+PCM reaches --min-snr dB, the original otherwise. The phone plays /<n>.wav before /<n>.mp3,
+so remove the old mp3 from the card when a wav replaces it.
+"""
+import argparse
+import math
+import os
+import shutil
+import struct
+import subprocess
+import sys
+
+STEPS = [
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+    337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+    2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+    15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767]
+INDEX = [-1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8]
+BLOCK_ALIGN = 512  # must not exceed WAV_BUFFER_SIZE in src/WavGenerator.h
+SAMPLES_PER_BLOCK = (BLOCK_ALIGN - 4) * 2 + 1
+
+
+def decode_to_pcm(path, rate):
+    """16 bit mono samples of any file ffmpeg understands."""
+    raw = subprocess.run(["ffmpeg", "-v", "error", "-i", path, "-ac", "1", "-ar", str(rate), "-f", "s16le", "-"],
+                         check=True, stdout=subprocess.PIPE).stdout
+    return list(struct.unpack("<%dh" % (len(raw) // 2), raw[:len(raw) // 2 * 2]))
+
+
+class ImaState:
+    def __init__(self, predictor=0, index=0):
+        self.predictor = predictor
+        self.index = index
+
+    def step(self, nibble):
+        """Same arithmetic as WavGenerator::decodeNibble()."""
+        step = STEPS[self.index]
+        diff = step >> 3
+        if nibble & 1:
+            diff += step >> 2
+        if nibble & 2:
+            diff += step >> 1
+        if nibble & 4:
+            diff += step
+        self.predictor = max(-32768, min(32767, self.predictor - diff if nibble & 8 else self.predictor + diff))
+        self.index = max(0, min(88, self.index + INDEX[nibble]))
+        return self.predictor
+
+    def encode(self, sample):
+        step = STEPS[self.index]
+        delta = sample - self.predictor
+        nibble = 8 if delta < 0 else 0
+        delta = abs(delta)
+        for bit in (4, 2, 1):
+            if delta >= step:
+                nibble |= bit
+                delta -= step
+            step >>= 1
+        self.step(nibble)
+        return nibble
+
+
+def encode_adpcm(samples):
+    """IMA-ADPCM blocks and the samples the phone will decode from them."""
+    blocks = bytearray()
+    decoded = []
+    state = ImaState()
+    for start in range(0, len(samples), SAMPLES_PER_BLOCK):
+        block = samples[start:start + SAMPLES_PER_BLOCK]
+        state.predictor = block[0]
+        blocks += struct.pack("<hBB", state.predictor, state.index, 0)
+        decoded.append(block[0])
+        nibbles = []
+        for sample in block[1:]:
+            nibbles.append(state.encode(sample))
+            decoded.append(state.predictor)
+        if len(nibbles) % 2:
+            nibbles.append(0)
+        blocks += bytes(nibbles[i] | nibbles[i + 1] << 4 for i in range(0, len(nibbles), 2))
+    return bytes(blocks), decoded
+
+
+def snr(reference, decoded):
+    signal = sum(s * s for s in reference) or 1
+    noise = sum((a - b) ** 2 for a, b in zip(reference, decoded)) or 1
+    return 10 * math.log10(signal / noise)
+
+
+def write_wav(path, rate, fmt, data, bits, block_align, extra=b"", fact=None):
+    byte_rate = rate * block_align // (SAMPLES_PER_BLOCK if fmt == 0x11 else 1)
+    fmt_chunk = struct.pack("<HHIIHH", fmt, 1, rate, byte_rate, block_align, bits) + extra
+    chunks = b"fmt " + struct.pack("<I", len(fmt_chunk)) + fmt_chunk
+    if fact is not None:
+        chunks += b"fact" + struct.pack("<II", 4, fact)
+    chunks += b"data" + struct.pack("<I", len(data)) + data + (b"\0" if len(data) % 2 else b"")
+    with open(path, "wb") as f:
+        f.write(b"RIFF" + struct.pack("<I", 4 + len(chunks)) + b"WAVE" + chunks)
+
+
+def transcode(path, args):
+    name = os.path.splitext(os.path.basename(path))[0]
+    samples = decode_to_pcm(path, args.rate)
+    seconds = len(samples) / float(args.rate)
+    out = os.path.join(args.out, name)
+    if len(samples) * 2 <= args.max_pcm_kb * 1024:
+        write_wav(out + ".wav", args.rate, 1, struct.pack("<%dh" % len(samples), *samples), 16, 2)
+        return "pcm", seconds, os.path.getsize(out + ".wav"), None
+    data, decoded = encode_adpcm(samples)
+    quality = snr(samples, decoded)
+    if quality >= args.min_snr:
+        write_wav(out + ".wav", args.rate, 0x11, data, 4, BLOCK_ALIGN, struct.pack("<HH", 2, SAMPLES_PER_BLOCK), len(samples))
+        return "adpcm", seconds, os.path.getsize(out + ".wav"), quality
+    if os.path.abspath(path) != os.path.abspath(out + os.path.splitext(path)[1]):
+        shutil.copyfile(path, out + os.path.splitext(path)[1])
+    return "mp3", seconds, os.path.getsize(path), quality
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--rate", type=int, default=22050)
+    parser.add_argument("--min-snr", type=float, default=30.0, help="dB the ADPCM version must reach")
+    parser.add_argument("--max-pcm-kb", type=int, default=256, help="largest sample kept as plain PCM")
+    parser.add_argument("--out", default="sd")
+    parser.add_argument("samples", nargs="+")
+    args = parser.parse_args()
+    os.makedirs(args.out, exist_ok=True)
+    for path in args.samples:
+        codec, seconds, size, quality = transcode(path, args)
+        print("%-24s %-5s %6.1f s %8d bytes%s" % (
+            os.path.basename(path), codec, seconds, size, "" if quality is None else "  snr %.1f dB" % quality))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
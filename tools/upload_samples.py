@@ -0,0 +1,109 @@
+#!/usr/bin/env python3
+"""Uploads samples to a Ledafoon over PUT /upload, resuming interrupted transfers.
+
+Usage: upload_samples.py [--host 192.168.4.1] [--chunk 65536] [--drop-after N] file.mp3 [...]
+
+Every file is sent in Content-Range chunks with its crc32. When a chunk fails the
+client asks GET /upload how much arrived and continues from there. --drop-after
+closes the connection after N bytes of the first chunk to exercise the resume path.
+Prints the throughput seen by the client and the SD write speed the phone reports.
+"""
+import argparse
+import http.client
+import json
+import os
+import socket
+import sys
+import time
+import zlib
+
+
+def status(host, path):
+    conn = http.client.HTTPConnection(host, timeout=10)
+    conn.request("GET", "/upload?file=" + path)
+    reply = json.loads(conn.getresponse().read())
+    conn.close()
+    return reply
+
+
+def drop_upload(host, path, data, start, total, crc, drop_after):
+    """Sends a chunk header and only part of the body, then hangs up."""
+    sock = socket.create_connection((host, 80), timeout=10)
+    end = start + len(data) - 1
+    head = ("PUT /upload?file=%s HTTP/1.1\r\nHost: %s\r\nContent-Type: application/octet-stream\r\n"
+            "Content-Length: %d\r\nContent-Range: bytes %d-%d/%d\r\nX-CRC32: %08x\r\n\r\n"
+            % (path, host, len(data), start, end, total, crc))
+    sock.sendall(head.encode() + data[:drop_after])
+    sock.close()
+
+
+def put_chunk(host, path, data, start, total, crc):
+    conn = http.client.HTTPConnection(host, timeout=30)
+    headers = {
+        "Content-Type": "application/octet-stream",
+        "Content-Range": "bytes %d-%d/%d" % (start, start + len(data) - 1, total),
+        "X-CRC32": "%08x" % crc,
+    }
+    conn.request("PUT", "/upload?file=" + path, body=data, headers=headers)
+    response = conn.getresponse()
+    body = response.read()
+    conn.close()
+    return response.status, body
+
+
+def upload(host, local, chunk, drop_after):
+    with open(local, "rb") as f:
+        data = f.read()
+    path = "/" + os.path.basename(local)
+    crc = zlib.crc32(data) & 0xFFFFFFFF
+    offset = status(host, path).get("received", 0) if not drop_after else 0
+    if offset:
+        print("%s: resuming at %d" % (path, offset))
+    started = time.time()
+    while offset < len(data):
+        part = data[offset:offset + chunk]
+        if drop_after:
+            drop_upload(host, path, part, offset, len(data), crc, drop_after)
+            drop_after = 0
+            time.sleep(0.5)
+            offset = status(host, path)["received"]
+            print("%s: connection dropped, phone has %d bytes" % (path, offset))
+            continue
+        try:
+            code, body = put_chunk(host, path, part, offset, len(data), crc)
+        except (OSError, http.client.HTTPException) as error:
+            print("%s: %s, resuming" % (path, error))
+            code = 0
+        if code not in (200, 202):
+            time.sleep(1)
+            offset = status(host, path)["received"]
+            continue
+        offset += len(part)
+    elapsed = time.time() - started
+    state = "receiving"
+    while state in ("receiving", "verifying", "idle"):
+        state = status(host, path)["state"]
+        if state in ("receiving", "verifying"):
+            time.sleep(0.2)
+        elif state == "idle":
+            break
+    print("%s: %d bytes in %.2f s (%.3f MB/s), %s" % (path, len(data), elapsed, len(data) / elapsed / 1e6, state))
+    return state == "done"
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--host", default="192.168.4.1")
+    parser.add_argument("--chunk", type=int, default=65536)
+    parser.add_argument("--drop-after", type=int, default=0)
+    parser.add_argument("files", nargs="+")
+    args = parser.parse_args()
+    ok = all([upload(args.host, f, args.chunk, args.drop_after) for f in args.files])
+    conn = http.client.HTTPConnection(args.host, timeout=10)
+    conn.request("GET", "/upload/stats")
+    print(conn.getresponse().read().decode())
+    return 0 if ok else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())